@@ -26,6 +26,7 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 #define _FILE_OFFSET_BITS 64
 
@@ -36,6 +37,18 @@
 #include <stdbool.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#define FILE_DEV_VECTORED 1
+
+/**@brief   Segments passed to one preadv/pwritev call (<= IOV_MAX).*/
+#define FILE_DEV_IOV_MAX 64
+#else
+#define FILE_DEV_VECTORED 0
+#endif
+
 /**@brief   Default filename.*/
 static const char *fname = "ext2";
 
@@ -54,10 +67,28 @@ static int file_dev_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id
 static int file_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
 			  uint64_t blk_id, uint32_t blk_cnt);
 static int file_dev_close(struct ext4_blockdev *bdev);
+#if FILE_DEV_VECTORED
+static int file_dev_breadv(struct ext4_blockdev *bdev,
+			   const struct ext4_blockdev_iovec *iov,
+			   uint32_t iovcnt);
+static int file_dev_bwritev(struct ext4_blockdev *bdev,
+			    const struct ext4_blockdev_iovec *iov,
+			    uint32_t iovcnt);
+static int file_dev_flush(struct ext4_blockdev *bdev);
+static int file_dev_discard(struct ext4_blockdev *bdev, uint64_t blk_id,
+			    uint64_t blk_cnt);
+#else
+#define file_dev_breadv 0
+#define file_dev_bwritev 0
+#define file_dev_flush 0
+#define file_dev_discard 0
+#endif
 
 /******************************************************************************/
-EXT4_BLOCKDEV_STATIC_INSTANCE(file_dev, EXT4_FILEDEV_BSIZE, 0, file_dev_open,
-		file_dev_bread, file_dev_bwrite, file_dev_close, 0, 0);
+EXT4_BLOCKDEV_STATIC_INSTANCE5(file_dev, EXT4_FILEDEV_BSIZE, 0, file_dev_open,
+		file_dev_bread, file_dev_bwrite, file_dev_close, 0, 0,
+		file_dev_breadv, file_dev_bwritev, 0, 0, 0, file_dev_flush,
+		file_dev_discard);
 
 /******************************************************************************/
 static int file_dev_open(struct ext4_blockdev *bdev)
@@ -123,6 +154,81 @@ static int file_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
 	return EOK;
 }
 /******************************************************************************/
+#if FILE_DEV_VECTORED
+/**@brief   Transfer segments with one preadv/pwritev call per run of
+ *          adjacent segments.*/
+static int file_dev_rwv(struct ext4_blockdev *bdev,
+			const struct ext4_blockdev_iovec *iov,
+			uint32_t iovcnt, bool write)
+{
+	struct iovec v[FILE_DEV_IOV_MAX];
+	uint32_t i = 0, n;
+	uint64_t next;
+	off_t off;
+	ssize_t len, done;
+	int fd = fileno(dev_file);
+
+	while (i < iovcnt) {
+		off = (off_t)(iov[i].blk_id * bdev->bdif->ph_bsize);
+		len = 0;
+		n = 0;
+		next = iov[i].blk_id;
+		while (i < iovcnt && n < FILE_DEV_IOV_MAX && iov[i].blk_id == next) {
+			v[n].iov_base = iov[i].buf;
+			v[n].iov_len = iov[i].blk_cnt * bdev->bdif->ph_bsize;
+			len += v[n].iov_len;
+			next += iov[i].blk_cnt;
+			n++;
+			i++;
+		}
+
+		done = write ? pwritev(fd, v, n, off) : preadv(fd, v, n, off);
+		if (done != len)
+			return EIO;
+	}
+
+	if (write)
+		drop_cache();
+
+	return EOK;
+}
+
+static int file_dev_breadv(struct ext4_blockdev *bdev,
+			   const struct ext4_blockdev_iovec *iov,
+			   uint32_t iovcnt)
+{
+	return file_dev_rwv(bdev, iov, iovcnt, false);
+}
+
+static int file_dev_bwritev(struct ext4_blockdev *bdev,
+			    const struct ext4_blockdev_iovec *iov,
+			    uint32_t iovcnt)
+{
+	return file_dev_rwv(bdev, iov, iovcnt, true);
+}
+
+static int file_dev_flush(struct ext4_blockdev *bdev)
+{
+	if (fdatasync(fileno(dev_file)))
+		return EIO;
+
+	return EOK;
+}
+
+static int file_dev_discard(struct ext4_blockdev *bdev, uint64_t blk_id,
+			    uint64_t blk_cnt)
+{
+	/*Deallocate the image file range, reads return zeros*/
+	if (fallocate(fileno(dev_file),
+		      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      blk_id * bdev->bdif->ph_bsize,
+		      blk_cnt * bdev->bdif->ph_bsize))
+		return EIO;
+
+	return EOK;
+}
+#endif
+
 static int file_dev_close(struct ext4_blockdev *bdev)
 {
 	fclose(dev_file);
@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+#include <ext4_errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lat_dev.h"
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+/**@brief   Maximum emulated queue depth.*/
+#define LAT_DEV_QDEPTH_MAX 64
+
+const struct lat_dev_model lat_dev_hdd = {
+	.read_us = 100,
+	.write_us = 100,
+	.flush_us = 5000,
+	.discard_us = 100,
+	.seek_min_us = 4000,
+	.seek_max_us = 12000,
+	.read_bw = 150000000,
+	.write_bw = 150000000,
+	.qdepth = 1,
+};
+
+const struct lat_dev_model lat_dev_ssd = {
+	.read_us = 80,
+	.write_us = 30,
+	.flush_us = 500,
+	.discard_us = 200,
+	.read_bw = 540000000,
+	.write_bw = 500000000,
+	.qdepth = 32,
+};
+
+const struct lat_dev_model lat_dev_net = {
+	.read_us = 500,
+	.write_us = 500,
+	.flush_us = 1000,
+	.discard_us = 500,
+	.read_bw = 117000000,
+	.write_bw = 117000000,
+	.qdepth = 16,
+};
+
+/**@brief   Asynchronous request in flight.*/
+struct lat_dev_io {
+	struct ext4_blockdev_req *req;
+
+	/**@brief   Service start (device clock)*/
+	uint64_t start;
+
+	/**@brief   Completion (device clock)*/
+	uint64_t end;
+};
+
+/**@brief   Block device instance.*/
+struct lat_dev {
+	/**@brief   Block device interface (callbacks find the instance
+	 *          through bdev->bdif, shared by partitions)*/
+	struct ext4_blockdev_iface bdif;
+
+	/**@brief   Whole device*/
+	struct ext4_blockdev bdev;
+
+	/**@brief   Stacked device*/
+	struct ext4_blockdev *lower;
+
+	struct lat_dev_model model;
+
+	/**@brief   LAT_DEV_* flags*/
+	uint32_t flags;
+
+	/**@brief   Device clock (us)*/
+	uint64_t clock;
+
+	/**@brief   Time each queue slot becomes free (device clock)*/
+	uint64_t slot[LAT_DEV_QDEPTH_MAX];
+
+	/**@brief   Time the transfer bus becomes free (device clock)*/
+	uint64_t bus;
+
+	/**@brief   Block following the previous request (head position)*/
+	uint64_t head;
+
+	/**@brief   Trace output, NULL - no trace*/
+	FILE *trace;
+
+	/**@brief   Asynchronous requests in flight*/
+	struct lat_dev_io io[CONFIG_BLOCK_DEV_AIO_DEPTH];
+	uint32_t io_cnt;
+
+#ifdef __linux__
+	/**@brief   Wall clock deadline of the last sleep*/
+	struct timespec wall;
+#endif
+};
+
+static struct lat_dev *lat_dev_of(struct ext4_blockdev *bdev)
+{
+	return (struct lat_dev *)bdev->bdif;
+}
+
+/**@brief   Schedule a request on the device clock.
+ * @param   op trace operation (R, W, U, F or D)
+ * @param   start service start
+ * @return  completion time*/
+static uint64_t lat_dev_sched(struct lat_dev *ld, char op, uint64_t blk_id,
+			      uint64_t blk_cnt, uint64_t *start)
+{
+	const struct lat_dev_model *m = &ld->model;
+	uint64_t *slot = &ld->slot[0];
+	uint64_t t, dist, bw = 0;
+	uint32_t i;
+
+	if (op == 'F') {
+		/* Flush waits for the whole queue and holds it. */
+		t = ld->clock;
+		for (i = 0; i < m->qdepth; i++)
+			if (ld->slot[i] > t)
+				t = ld->slot[i];
+
+		*start = t;
+		t += m->flush_us;
+		for (i = 0; i < m->qdepth; i++)
+			ld->slot[i] = t;
+		return t;
+	}
+
+	for (i = 1; i < m->qdepth; i++)
+		if (ld->slot[i] < *slot)
+			slot = &ld->slot[i];
+
+	t = ld->clock > *slot ? ld->clock : *slot;
+	*start = t;
+
+	switch (op) {
+	case 'R':
+		t += m->read_us;
+		bw = m->read_bw;
+		break;
+	case 'U':
+		t += m->flush_us;
+		/* fallthrough */
+	case 'W':
+		t += m->write_us;
+		bw = m->write_bw;
+		break;
+	default:
+		t += m->discard_us;
+		break;
+	}
+
+	if (bw) {
+		if (blk_id != ld->head && m->seek_max_us) {
+			dist = blk_id > ld->head ? blk_id - ld->head
+						 : ld->head - blk_id;
+			if (dist > ld->bdif.ph_bcnt)
+				dist = ld->bdif.ph_bcnt;
+			t += m->seek_min_us;
+			t += (uint64_t)(m->seek_max_us - m->seek_min_us) *
+			     dist / (ld->bdif.ph_bcnt ? ld->bdif.ph_bcnt : 1);
+		}
+		ld->head = blk_id + blk_cnt;
+
+		/* Transfers are serialized on the bus. */
+		if (t < ld->bus)
+			t = ld->bus;
+		t += blk_cnt * ld->bdif.ph_bsize * 1000000 / bw;
+		ld->bus = t;
+	}
+
+	*slot = t;
+	return t;
+}
+
+/**@brief   Advance the device clock to @p t, sleep as long.*/
+static void lat_dev_wait(struct lat_dev *ld, uint64_t t)
+{
+	uint64_t d;
+#ifdef __linux__
+	struct timespec now;
+#endif
+
+	if (t <= ld->clock)
+		return;
+
+	d = t - ld->clock;
+	ld->clock = t;
+	if (ld->flags & LAT_DEV_NOSLEEP)
+		return;
+
+#ifdef __linux__
+	/* Sleep up to a deadline: oversleeping is paid back by the next
+	 * request if the host did not spend the time in between. */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ld->wall.tv_sec < now.tv_sec ||
+	    (ld->wall.tv_sec == now.tv_sec && ld->wall.tv_nsec < now.tv_nsec))
+		ld->wall = now;
+
+	ld->wall.tv_sec += d / 1000000;
+	ld->wall.tv_nsec += (d % 1000000) * 1000;
+	if (ld->wall.tv_nsec >= 1000000000) {
+		ld->wall.tv_sec++;
+		ld->wall.tv_nsec -= 1000000000;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ld->wall,
+			       NULL) == EINTR)
+		;
+#endif
+}
+
+static void lat_dev_record(struct lat_dev *ld, char op, uint64_t blk_id,
+			   uint64_t blk_cnt, uint64_t start, uint64_t end)
+{
+	if (!ld->trace)
+		return;
+
+	fprintf(ld->trace, "%" PRIu64 " %c %" PRIu64 " %" PRIu64 " %" PRIu64
+		"\n", start, op, blk_id, blk_cnt, end - start);
+}
+
+/**@brief   Synchronous request: schedule, wait, record.*/
+static void lat_dev_sync(struct lat_dev *ld, char op, uint64_t blk_id,
+			 uint64_t blk_cnt)
+{
+	uint64_t start, end;
+
+	end = lat_dev_sched(ld, op, blk_id, blk_cnt, &start);
+	lat_dev_wait(ld, end);
+	lat_dev_record(ld, op, blk_id, blk_cnt, start, end);
+}
+
+/**********************BLOCKDEV INTERFACE**************************************/
+static int lat_dev_open(struct ext4_blockdev *bdev)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+	struct ext4_blockdev *lower = ld->lower;
+	int r;
+
+	r = lower->bdif->open(lower);
+	if (r != EOK)
+		return r;
+
+	ld->bdev.part_offset = lower->part_offset;
+	ld->bdev.part_size = lower->part_size;
+	ld->bdif.ph_bcnt = lower->bdif->ph_bcnt;
+
+	ld->clock = 0;
+	ld->bus = 0;
+	ld->head = 0;
+	ld->io_cnt = 0;
+	memset(ld->slot, 0, sizeof(ld->slot));
+#ifdef __linux__
+	memset(&ld->wall, 0, sizeof(ld->wall));
+#endif
+	return EOK;
+}
+
+static int lat_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			 uint64_t blk_id, uint32_t blk_cnt)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+
+	lat_dev_sync(ld, 'R', blk_id, blk_cnt);
+	return ld->lower->bdif->bread(ld->lower, buf, blk_id, blk_cnt);
+}
+
+static int lat_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+
+	lat_dev_sync(ld, 'W', blk_id, blk_cnt);
+	return ld->lower->bdif->bwrite(ld->lower, buf, blk_id, blk_cnt);
+}
+
+static int lat_dev_bwrite_fua(struct ext4_blockdev *bdev, const void *buf,
+			      uint64_t blk_id, uint32_t blk_cnt)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+	struct ext4_blockdev *lower = ld->lower;
+	int r;
+
+	lat_dev_sync(ld, 'U', blk_id, blk_cnt);
+	if (lower->bdif->bwrite_fua)
+		return lower->bdif->bwrite_fua(lower, buf, blk_id, blk_cnt);
+
+	r = lower->bdif->bwrite(lower, buf, blk_id, blk_cnt);
+	if (r == EOK && lower->bdif->flush)
+		r = lower->bdif->flush(lower);
+	return r;
+}
+
+static int lat_dev_flush(struct ext4_blockdev *bdev)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+
+	lat_dev_sync(ld, 'F', 0, 0);
+	if (!ld->lower->bdif->flush)
+		return EOK;
+
+	return ld->lower->bdif->flush(ld->lower);
+}
+
+static int lat_dev_discard(struct ext4_blockdev *bdev, uint64_t blk_id,
+			   uint64_t blk_cnt)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+
+	lat_dev_sync(ld, 'D', blk_id, blk_cnt);
+	return ld->lower->bdif->discard(ld->lower, blk_id, blk_cnt);
+}
+
+static int lat_dev_submit(struct ext4_blockdev *bdev,
+			  struct ext4_blockdev_req *req)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+	struct lat_dev_io *io;
+
+	if (ld->io_cnt == CONFIG_BLOCK_DEV_AIO_DEPTH)
+		return EIO;
+
+	io = &ld->io[ld->io_cnt++];
+	io->req = req;
+	io->end = lat_dev_sched(ld, req->write ? 'W' : 'R', req->seg.blk_id,
+				req->seg.blk_cnt, &io->start);
+	return EOK;
+}
+
+static int lat_dev_poll(struct ext4_blockdev *bdev, uint32_t min_done)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+	struct ext4_blockdev *lower = ld->lower;
+	struct ext4_blockdev_req *req;
+	struct lat_dev_io io;
+	uint32_t i, next, done = 0;
+	int r;
+
+	while (ld->io_cnt) {
+		next = 0;
+		for (i = 1; i < ld->io_cnt; i++)
+			if (ld->io[i].end < ld->io[next].end)
+				next = i;
+
+		if (done >= min_done && ld->io[next].end > ld->clock)
+			break;
+
+		io = ld->io[next];
+		ld->io[next] = ld->io[--ld->io_cnt];
+		lat_dev_wait(ld, io.end);
+
+		/* Requests reach the stacked device in completion order. */
+		req = io.req;
+		if (req->write)
+			r = lower->bdif->bwrite(lower, req->seg.buf,
+						req->seg.blk_id,
+						req->seg.blk_cnt);
+		else
+			r = lower->bdif->bread(lower, req->seg.buf,
+					       req->seg.blk_id,
+					       req->seg.blk_cnt);
+
+		lat_dev_record(ld, req->write ? 'W' : 'R', req->seg.blk_id,
+			       req->seg.blk_cnt, io.start, io.end);
+		ext4_block_aio_complete(req->bdev, req, r);
+		done++;
+	}
+
+	return EOK;
+}
+
+static int lat_dev_lock(struct ext4_blockdev *bdev)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+	return ld->lower->bdif->lock(ld->lower);
+}
+
+static int lat_dev_unlock(struct ext4_blockdev *bdev)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+	return ld->lower->bdif->unlock(ld->lower);
+}
+
+static int lat_dev_close(struct ext4_blockdev *bdev)
+{
+	struct lat_dev *ld = lat_dev_of(bdev);
+
+	/* Requests still in flight are finished first. */
+	lat_dev_poll(bdev, ld->io_cnt);
+	return ld->lower->bdif->close(ld->lower);
+}
+
+/******************************************************************************/
+const struct lat_dev_model *lat_dev_model_find(const char *name)
+{
+	if (!strcmp(name, "hdd"))
+		return &lat_dev_hdd;
+	if (!strcmp(name, "ssd"))
+		return &lat_dev_ssd;
+	if (!strcmp(name, "net"))
+		return &lat_dev_net;
+	return NULL;
+}
+
+/******************************************************************************/
+struct ext4_blockdev *lat_dev_create(struct ext4_blockdev *lower,
+				     const struct lat_dev_model *model,
+				     uint32_t flags)
+{
+	struct ext4_blockdev_iface *lif;
+	struct lat_dev *ld;
+
+	if (!lower || !model || (flags & ~LAT_DEV_NOSLEEP) ||
+	    model->qdepth > LAT_DEV_QDEPTH_MAX ||
+	    model->seek_max_us < model->seek_min_us)
+		return NULL;
+
+	lif = lower->bdif;
+	ld = calloc(1, sizeof(struct lat_dev) + lif->ph_bsize);
+	if (!ld)
+		return NULL;
+
+	ld->lower = lower;
+	ld->model = *model;
+	if (!ld->model.qdepth)
+		ld->model.qdepth = 1;
+	ld->flags = flags;
+
+	ld->bdif.open = lat_dev_open;
+	ld->bdif.bread = lat_dev_bread;
+	ld->bdif.bwrite = lat_dev_bwrite;
+	ld->bdif.bwrite_fua = lat_dev_bwrite_fua;
+	ld->bdif.flush = lat_dev_flush;
+	ld->bdif.close = lat_dev_close;
+	if (lif->discard)
+		ld->bdif.discard = lat_dev_discard;
+	if (ld->model.qdepth > 1) {
+		ld->bdif.submit = lat_dev_submit;
+		ld->bdif.poll = lat_dev_poll;
+	}
+	if (lif->lock && lif->unlock) {
+		ld->bdif.lock = lat_dev_lock;
+		ld->bdif.unlock = lat_dev_unlock;
+	}
+	ld->bdif.ph_bsize = lif->ph_bsize;
+	ld->bdif.ph_bcnt = lif->ph_bcnt;
+	ld->bdif.ph_bbuf = (uint8_t *)(ld + 1);
+
+	ld->bdev.bdif = &ld->bdif;
+	ld->bdev.part_offset = lower->part_offset;
+	ld->bdev.part_size = lower->part_size;
+	return &ld->bdev;
+}
+
+/******************************************************************************/
+void lat_dev_trace(struct ext4_blockdev *bdev, FILE *trace)
+{
+	lat_dev_of(bdev)->trace = trace;
+}
+
+/******************************************************************************/
+int lat_dev_replay(struct ext4_blockdev *bdev, FILE *trace)
+{
+	struct ext4_blockdev_iface *bdif = bdev->bdif;
+	uint64_t start, blk_id, blk_cnt, lat;
+	uint8_t *buf = NULL;
+	size_t len = 0, need;
+	char op;
+	int n, r = EOK;
+
+	while (r == EOK) {
+		n = fscanf(trace, "%" SCNu64 " %c %" SCNu64 " %" SCNu64
+			   " %" SCNu64, &start, &op, &blk_id, &blk_cnt, &lat);
+		if (n == EOF)
+			break;
+		if (n != 5) {
+			r = EINVAL;
+			break;
+		}
+
+		if (op == 'R' || op == 'W' || op == 'U') {
+			if (blk_cnt > UINT32_MAX ||
+			    blk_cnt > SIZE_MAX / bdif->ph_bsize) {
+				r = EINVAL;
+				break;
+			}
+
+			need = (size_t)blk_cnt * bdif->ph_bsize;
+			if (need > len) {
+				free(buf);
+				buf = calloc(1, need);
+				len = buf ? need : 0;
+				if (!buf) {
+					r = ENOMEM;
+					break;
+				}
+			}
+		}
+
+		switch (op) {
+		case 'R':
+			r = bdif->bread(bdev, buf, blk_id, (uint32_t)blk_cnt);
+			break;
+		case 'W':
+			memset(buf, 0, (size_t)blk_cnt * bdif->ph_bsize);
+			r = bdif->bwrite(bdev, buf, blk_id, (uint32_t)blk_cnt);
+			break;
+		case 'U':
+			memset(buf, 0, (size_t)blk_cnt * bdif->ph_bsize);
+			if (bdif->bwrite_fua) {
+				r = bdif->bwrite_fua(bdev, buf, blk_id,
+						     (uint32_t)blk_cnt);
+				break;
+			}
+			r = bdif->bwrite(bdev, buf, blk_id, (uint32_t)blk_cnt);
+			if (r == EOK && bdif->flush)
+				r = bdif->flush(bdev);
+			break;
+		case 'F':
+			if (bdif->flush)
+				r = bdif->flush(bdev);
+			break;
+		case 'D':
+			if (bdif->discard)
+				r = bdif->discard(bdev, blk_id, blk_cnt);
+			break;
+		default:
+			r = EINVAL;
+			break;
+		}
+	}
+
+	free(buf);
+	return r;
+}
+
+/******************************************************************************/
+uint64_t lat_dev_time(struct ext4_blockdev *bdev)
+{
+	return lat_dev_of(bdev)->clock;
+}
+
+/******************************************************************************/
+void lat_dev_destroy(struct ext4_blockdev *bdev)
+{
+	if (!bdev)
+		return;
+
+	free(lat_dev_of(bdev));
+}
+/******************************************************************************/
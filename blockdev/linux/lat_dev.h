@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef LAT_DEV_H_
+#define LAT_DEV_H_
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**@brief   Device latency model. Every request gets the fixed latency
+ *          of its operation, plus a seek penalty when it does not start
+ *          where the previous one ended, plus its transfer time. Up to
+ *          qdepth requests are served in parallel, transfers share
+ *          the bandwidth.*/
+struct lat_dev_model {
+	/**@brief   Read latency (us)*/
+	uint32_t read_us;
+
+	/**@brief   Write latency (us)*/
+	uint32_t write_us;
+
+	/**@brief   Write cache flush latency (us)*/
+	uint32_t flush_us;
+
+	/**@brief   Discard latency (us)*/
+	uint32_t discard_us;
+
+	/**@brief   Seek penalty of the shortest non-sequential access (us)*/
+	uint32_t seek_min_us;
+
+	/**@brief   Seek penalty across the whole device (us), penalties
+	 *          grow linearly with the LBA distance*/
+	uint32_t seek_max_us;
+
+	/**@brief   Read bandwidth (bytes/s), 0 - unlimited*/
+	uint64_t read_bw;
+
+	/**@brief   Write bandwidth (bytes/s), 0 - unlimited*/
+	uint64_t write_bw;
+
+	/**@brief   Requests served in parallel. Asynchronous requests
+	 *          (submit/poll) are emulated if greater than 1.*/
+	uint32_t qdepth;
+};
+
+/**@brief   7200 rpm hard disk.*/
+extern const struct lat_dev_model lat_dev_hdd;
+
+/**@brief   SATA solid state disk.*/
+extern const struct lat_dev_model lat_dev_ssd;
+
+/**@brief   Network block device over 1 Gbit ethernet.*/
+extern const struct lat_dev_model lat_dev_net;
+
+/**@brief   Only advance the device clock, do not sleep.*/
+#define LAT_DEV_NOSLEEP (1 << 0)
+
+/**@brief   Find a predefined model by name ("hdd", "ssd", "net").
+ * @param   name model name
+ * @return  model, NULL if unknown*/
+const struct lat_dev_model *lat_dev_model_find(const char *name);
+
+/**@brief   Create a block device stacked over @p lower. Requests are
+ *          passed to @p lower and delayed as the model says. Delays are
+ *          computed on a device clock which only advances with modeled
+ *          service time, so it is the same for the same request
+ *          stream whatever the host does.
+ * @param   lower block device (opened and closed with the new one)
+ * @param   model latency model (copied)
+ * @param   flags LAT_DEV_* flags
+ * @return  block device, NULL if out of memory or invalid arguments*/
+struct ext4_blockdev *lat_dev_create(struct ext4_blockdev *lower,
+				     const struct lat_dev_model *model,
+				     uint32_t flags);
+
+/**@brief   Record finished requests, one line each:
+ *          "<start us> <op> <blk_id> <blk_cnt> <latency us>", op is
+ *          R (read), W (write), U (FUA write), F (flush) or D (discard).
+ * @param   bdev latency block device
+ * @param   trace output stream, NULL - stop recording*/
+void lat_dev_trace(struct ext4_blockdev *bdev, FILE *trace);
+
+/**@brief   Issue the requests of a trace to a block device, one after
+ *          another. Written blocks are zero filled, so use a scratch
+ *          device (or a latency device to compare models).
+ * @param   bdev block device (ext4_block_init done)
+ * @param   trace input stream
+ * @return  standard error code*/
+int lat_dev_replay(struct ext4_blockdev *bdev, FILE *trace);
+
+/**@brief   Device clock: modeled time since open (us).
+ * @param   bdev latency block device*/
+uint64_t lat_dev_time(struct ext4_blockdev *bdev);
+
+/**@brief   Destroy a block device created by lat_dev_create (the lower
+ *          device is left alone).
+ * @param   bdev block device (closed)*/
+void lat_dev_destroy(struct ext4_blockdev *bdev);
+
+#endif /* LAT_DEV_H_ */
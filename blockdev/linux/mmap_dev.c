@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+#include <ext4_errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mmap_dev.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**@brief   Image block size.*/
+#define MMAP_DEV_BSIZE 512
+
+/**@brief   Block device instance.*/
+struct mmap_dev {
+	/**@brief   Block device interface (callbacks find the instance
+	 *          through bdev->bdif, shared by partitions)*/
+	struct ext4_blockdev_iface bdif;
+
+	/**@brief   Whole device*/
+	struct ext4_blockdev bdev;
+
+	/**@brief   Physical block buffer*/
+	uint8_t ph_bbuf[MMAP_DEV_BSIZE];
+
+	/**@brief   File descriptor (-1: closed)*/
+	int fd;
+
+	/**@brief   MMAP_DEV_* flags*/
+	uint32_t flags;
+
+	/**@brief   Mapped image (NULL: empty image or closed)*/
+	uint8_t *map;
+
+	/**@brief   Mapped length*/
+	size_t size;
+
+	/**@brief   Mapping written since open*/
+	bool dirty;
+
+	/**@brief   File name*/
+	char fname[];
+};
+
+static struct mmap_dev *mmap_dev_of(struct ext4_blockdev *bdev)
+{
+	return (struct mmap_dev *)bdev->bdif;
+}
+
+/**@brief   Image bytes of blocks (NULL if out of range).*/
+static uint8_t *mmap_dev_at(struct mmap_dev *md, uint64_t blk_id,
+			    uint32_t blk_cnt)
+{
+	uint64_t off = blk_id * md->bdif.ph_bsize;
+	uint64_t len = (uint64_t)blk_cnt * md->bdif.ph_bsize;
+
+	if (off > md->size || len > md->size - off)
+		return NULL;
+
+	return md->map + off;
+}
+
+/**********************BLOCKDEV INTERFACE**************************************/
+static int mmap_dev_open(struct ext4_blockdev *bdev)
+{
+	struct mmap_dev *md = mmap_dev_of(bdev);
+	bool rdonly = md->flags & MMAP_DEV_RDONLY;
+	off_t size;
+
+	md->fd = open(md->fname, rdonly ? O_RDONLY : O_RDWR);
+	if (md->fd < 0)
+		return EIO;
+
+	size = lseek(md->fd, 0, SEEK_END);
+	if (size < 0 || (uint64_t)size > SIZE_MAX) {
+		close(md->fd);
+		md->fd = -1;
+		return EFAULT;
+	}
+
+	md->size = (size_t)size;
+	md->map = NULL;
+	md->dirty = false;
+	if (md->size) {
+		/* Checksum verification temporarily modifies zero-copy
+		 * buffers, a read-only image is mapped copy-on-write. */
+		void *map = mmap(NULL, md->size, PROT_READ | PROT_WRITE,
+				 rdonly ? MAP_PRIVATE : MAP_SHARED, md->fd, 0);
+		if (map == MAP_FAILED) {
+			close(md->fd);
+			md->fd = -1;
+			return ENOMEM;
+		}
+		md->map = map;
+	}
+
+	md->bdev.part_offset = 0;
+	md->bdev.part_size = md->size;
+	md->bdif.ph_bcnt = md->size / md->bdif.ph_bsize;
+
+	return EOK;
+}
+
+static int mmap_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt)
+{
+	struct mmap_dev *md = mmap_dev_of(bdev);
+	uint8_t *p = mmap_dev_at(md, blk_id, blk_cnt);
+
+	if (!p)
+		return EIO;
+
+	/* Zero-copy buffers are read in place. */
+	if (p != buf)
+		memcpy(buf, p, (size_t)blk_cnt * bdev->bdif->ph_bsize);
+	return EOK;
+}
+
+static int mmap_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt)
+{
+	struct mmap_dev *md = mmap_dev_of(bdev);
+	uint8_t *p = mmap_dev_at(md, blk_id, blk_cnt);
+
+	if (md->flags & MMAP_DEV_RDONLY)
+		return EROFS;
+	if (!p)
+		return EIO;
+
+	if (p != buf)
+		memcpy(p, buf, (size_t)blk_cnt * bdev->bdif->ph_bsize);
+	md->dirty = true;
+	return EOK;
+}
+
+static void *mmap_dev_bmap(struct ext4_blockdev *bdev, uint64_t blk_id,
+			   uint32_t blk_cnt)
+{
+	return mmap_dev_at(mmap_dev_of(bdev), blk_id, blk_cnt);
+}
+
+static int mmap_dev_flush(struct ext4_blockdev *bdev)
+{
+	struct mmap_dev *md = mmap_dev_of(bdev);
+
+	if (!md->dirty)
+		return EOK;
+
+	if (msync(md->map, md->size, MS_SYNC))
+		return EIO;
+
+	md->dirty = false;
+	return EOK;
+}
+
+static int mmap_dev_discard(struct ext4_blockdev *bdev, uint64_t blk_id,
+			    uint64_t blk_cnt)
+{
+	/*The shared mapping reads zeros from the hole*/
+	if (fallocate(mmap_dev_of(bdev)->fd,
+		      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      blk_id * bdev->bdif->ph_bsize,
+		      blk_cnt * bdev->bdif->ph_bsize))
+		return EIO;
+
+	return EOK;
+}
+
+static int mmap_dev_close(struct ext4_blockdev *bdev)
+{
+	int r = EOK;
+	struct mmap_dev *md = mmap_dev_of(bdev);
+
+	if (md->map) {
+		r = mmap_dev_flush(bdev);
+		munmap(md->map, md->size);
+		md->map = NULL;
+	}
+
+	close(md->fd);
+	md->fd = -1;
+	return r;
+}
+
+/******************************************************************************/
+struct ext4_blockdev *mmap_dev_create(const char *fname, uint32_t flags)
+{
+	size_t len = strlen(fname) + 1;
+	struct mmap_dev *md;
+
+	if (flags & ~MMAP_DEV_RDONLY)
+		return NULL;
+
+	md = calloc(1, sizeof(struct mmap_dev) + len);
+	if (!md)
+		return NULL;
+
+	memcpy(md->fname, fname, len);
+	md->fd = -1;
+	md->flags = flags;
+
+	md->bdif.open = mmap_dev_open;
+	md->bdif.bread = mmap_dev_bread;
+	md->bdif.bwrite = mmap_dev_bwrite;
+	md->bdif.close = mmap_dev_close;
+	md->bdif.flush = mmap_dev_flush;
+	/* Zero-copy buffers are modified in place while checksums are
+	 * verified, only a copy-on-write mapping keeps the image intact. */
+	if (flags & MMAP_DEV_RDONLY)
+		md->bdif.bmap = mmap_dev_bmap;
+	else
+		md->bdif.discard = mmap_dev_discard;
+	md->bdif.ph_bsize = MMAP_DEV_BSIZE;
+	md->bdif.ph_bbuf = md->ph_bbuf;
+
+	md->bdev.bdif = &md->bdif;
+	return &md->bdev;
+}
+
+/******************************************************************************/
+void mmap_dev_destroy(struct ext4_blockdev *bdev)
+{
+	struct mmap_dev *md;
+
+	if (!bdev)
+		return;
+
+	md = mmap_dev_of(bdev);
+	if (md->fd >= 0)
+		mmap_dev_close(bdev);
+
+	free(md);
+}
+/******************************************************************************/
+#else
+
+struct ext4_blockdev *mmap_dev_create(const char *fname, uint32_t flags)
+{
+	(void)fname;
+	(void)flags;
+	return NULL;
+}
+
+void mmap_dev_destroy(struct ext4_blockdev *bdev)
+{
+	(void)bdev;
+}
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef MMAP_DEV_H_
+#define MMAP_DEV_H_
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**@brief   Open the image read-only (writes fail with EROFS).*/
+#define MMAP_DEV_RDONLY (1 << 0)
+
+/**@brief   Create a block device for a memory mapped image file.
+ *          Each call creates an independent instance. The image is
+ *          mapped by ext4_block_init (block device open callback).
+ *          With MMAP_DEV_RDONLY its blocks are available to the
+ *          zero-copy block cache mode (ext4_block_cache_zero_copy, used
+ *          by read-only mounts).
+ *          Writes are synced (msync) by the flush callback and when
+ *          the device is closed.
+ * @param   fname file name (copied)
+ * @param   flags MMAP_DEV_* flags
+ * @return  block device, NULL if out of memory or unsupported flags*/
+struct ext4_blockdev *mmap_dev_create(const char *fname, uint32_t flags);
+
+/**@brief   Destroy a block device created by mmap_dev_create.
+ * @param   bdev block device (closed)*/
+void mmap_dev_destroy(struct ext4_blockdev *bdev);
+
+#endif /* MMAP_DEV_H_ */
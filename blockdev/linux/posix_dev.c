@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+#include <ext4_errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "posix_dev.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/**@brief   Image block size.*/
+#define POSIX_DEV_BSIZE 512
+
+/**@brief   Direct I/O alignment used when the kernel does not report
+ *          it (statx STATX_DIOALIGN).*/
+#define POSIX_DEV_DIRECT_ALIGN 4096
+
+/**@brief   Bounce buffer size for unaligned direct transfers.*/
+#define POSIX_DEV_BOUNCE_SIZE (64 * 1024)
+
+/**@brief   Segments passed to one preadv/pwritev call (<= IOV_MAX).*/
+#define POSIX_DEV_IOV_MAX 64
+
+/**@brief   Block device instance.*/
+struct posix_dev {
+	/**@brief   Block device interface (callbacks find the instance
+	 *          through bdev->bdif, shared by partitions)*/
+	struct ext4_blockdev_iface bdif;
+
+	/**@brief   Whole device*/
+	struct ext4_blockdev bdev;
+
+	/**@brief   Physical block buffer*/
+	uint8_t ph_bbuf[POSIX_DEV_BSIZE];
+
+	/**@brief   File descriptor (-1: closed)*/
+	int fd;
+
+	/**@brief   POSIX_DEV_* flags*/
+	uint32_t flags;
+
+	/**@brief   Direct I/O alignment (offset, length and memory)*/
+	uint32_t align;
+
+	/**@brief   Bounce buffer for unaligned direct transfers*/
+	uint8_t *bounce;
+
+	/**@brief   File name*/
+	char fname[];
+};
+
+static struct posix_dev *posix_dev_of(struct ext4_blockdev *bdev)
+{
+	return (struct posix_dev *)bdev->bdif;
+}
+
+/**@brief   Full pread/pwrite (restarted on EINTR and short transfers).*/
+static int posix_dev_io(int fd, void *buf, size_t len, uint64_t off,
+			bool write)
+{
+	ssize_t n;
+	uint8_t *p = buf;
+
+	while (len) {
+		n = write ? pwrite(fd, p, len, (off_t)off) :
+			    pread(fd, p, len, (off_t)off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return EIO;
+
+		p += n;
+		off += n;
+		len -= n;
+	}
+
+	return EOK;
+}
+
+static bool posix_dev_aligned(struct posix_dev *pd, const void *buf,
+			      size_t len, uint64_t off)
+{
+	uint32_t mask = pd->align - 1;
+
+	if (!(pd->flags & POSIX_DEV_DIRECT))
+		return true;
+
+	return !((uintptr_t)buf & mask) && !(len & mask) && !(off & mask);
+}
+
+/**@brief   Unaligned direct transfer: whole aligned chunks go through
+ *          the bounce buffer (read-modify-write for partial writes).*/
+static int posix_dev_bounce(struct posix_dev *pd, void *buf, size_t len,
+			    uint64_t off, bool write)
+{
+	int r;
+	uint8_t *p = buf;
+	uint64_t start, end;
+	size_t skip, n;
+	uint32_t mask = pd->align - 1;
+
+	while (len) {
+		start = off & ~(uint64_t)mask;
+		skip = (size_t)(off - start);
+		end = (off + len + mask) & ~(uint64_t)mask;
+		if (end - start > POSIX_DEV_BOUNCE_SIZE)
+			end = start + POSIX_DEV_BOUNCE_SIZE;
+
+		n = (size_t)(end - start) - skip;
+		if (n > len)
+			n = len;
+
+		if (!write || skip || n != end - start) {
+			r = posix_dev_io(pd->fd, pd->bounce,
+					 (size_t)(end - start), start, false);
+			if (r != EOK)
+				return r;
+		}
+
+		if (write) {
+			memcpy(pd->bounce + skip, p, n);
+			r = posix_dev_io(pd->fd, pd->bounce,
+					 (size_t)(end - start), start, true);
+			if (r != EOK)
+				return r;
+		} else {
+			memcpy(p, pd->bounce + skip, n);
+		}
+
+		p += n;
+		off += n;
+		len -= n;
+	}
+
+	return EOK;
+}
+
+static int posix_dev_rw(struct ext4_blockdev *bdev, void *buf,
+			uint64_t blk_id, uint32_t blk_cnt, bool write)
+{
+	struct posix_dev *pd = posix_dev_of(bdev);
+	size_t len = (size_t)blk_cnt * bdev->bdif->ph_bsize;
+	uint64_t off = blk_id * bdev->bdif->ph_bsize;
+
+	if (posix_dev_aligned(pd, buf, len, off))
+		return posix_dev_io(pd->fd, buf, len, off, write);
+
+	return posix_dev_bounce(pd, buf, len, off, write);
+}
+
+#ifdef STATX_DIOALIGN
+/**@brief   Direct I/O alignment reported by the kernel.*/
+static void posix_dev_dio_align(struct posix_dev *pd)
+{
+	struct statx stx;
+
+	if (statx(pd->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) ||
+	    !(stx.stx_mask & STATX_DIOALIGN) || !stx.stx_dio_offset_align)
+		return;
+
+	pd->align = stx.stx_dio_offset_align;
+	if (pd->align < stx.stx_dio_mem_align)
+		pd->align = stx.stx_dio_mem_align;
+	if (pd->align < POSIX_DEV_BSIZE)
+		pd->align = POSIX_DEV_BSIZE;
+}
+#endif
+
+/**********************BLOCKDEV INTERFACE**************************************/
+static int posix_dev_open(struct ext4_blockdev *bdev)
+{
+	struct posix_dev *pd = posix_dev_of(bdev);
+	int oflags = O_RDWR;
+	off_t size;
+
+	if (pd->flags & POSIX_DEV_DIRECT)
+		oflags |= O_DIRECT;
+
+	pd->fd = open(pd->fname, oflags);
+	if (pd->fd < 0)
+		return EIO;
+
+	size = lseek(pd->fd, 0, SEEK_END);
+	if (size < 0) {
+		close(pd->fd);
+		pd->fd = -1;
+		return EFAULT;
+	}
+
+	if (pd->flags & POSIX_DEV_DIRECT) {
+		pd->align = POSIX_DEV_DIRECT_ALIGN;
+#ifdef STATX_DIOALIGN
+		posix_dev_dio_align(pd);
+#endif
+		if (pd->align > POSIX_DEV_BOUNCE_SIZE ||
+		    posix_memalign((void **)&pd->bounce, pd->align,
+				   POSIX_DEV_BOUNCE_SIZE)) {
+			close(pd->fd);
+			pd->fd = -1;
+			return ENOMEM;
+		}
+
+		/* A tail shorter than the alignment is not accessible. */
+		size &= ~(off_t)(pd->align - 1);
+	}
+
+	pd->bdev.part_offset = 0;
+	pd->bdev.part_size = size;
+	pd->bdif.ph_bcnt = size / pd->bdif.ph_bsize;
+
+	return EOK;
+}
+
+static int posix_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt)
+{
+	return posix_dev_rw(bdev, buf, blk_id, blk_cnt, false);
+}
+
+static int posix_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			    uint64_t blk_id, uint32_t blk_cnt)
+{
+	return posix_dev_rw(bdev, (void *)buf, blk_id, blk_cnt, true);
+}
+
+/**@brief   Transfer segments with one preadv/pwritev call per run of
+ *          adjacent (and, in direct mode, aligned) segments.*/
+static int posix_dev_rwv(struct ext4_blockdev *bdev,
+			 const struct ext4_blockdev_iovec *iov,
+			 uint32_t iovcnt, bool write)
+{
+	struct posix_dev *pd = posix_dev_of(bdev);
+	struct iovec v[POSIX_DEV_IOV_MAX];
+	uint32_t bsize = bdev->bdif->ph_bsize;
+	uint32_t i = 0, n;
+	uint64_t next, off;
+	ssize_t len, done;
+	int r;
+
+	while (i < iovcnt) {
+		off = iov[i].blk_id * bsize;
+		len = 0;
+		n = 0;
+		next = iov[i].blk_id;
+		while (i < iovcnt && n < POSIX_DEV_IOV_MAX &&
+		       iov[i].blk_id == next &&
+		       posix_dev_aligned(pd, iov[i].buf,
+					 (size_t)iov[i].blk_cnt * bsize,
+					 iov[i].blk_id * bsize)) {
+			v[n].iov_base = iov[i].buf;
+			v[n].iov_len = (size_t)iov[i].blk_cnt * bsize;
+			len += v[n].iov_len;
+			next += iov[i].blk_cnt;
+			n++;
+			i++;
+		}
+
+		if (!n) {
+			r = posix_dev_rw(bdev, iov[i].buf, iov[i].blk_id,
+					 iov[i].blk_cnt, write);
+			if (r != EOK)
+				return r;
+			i++;
+			continue;
+		}
+
+		do {
+			done = write ? pwritev(pd->fd, v, n, (off_t)off) :
+				       preadv(pd->fd, v, n, (off_t)off);
+		} while (done < 0 && errno == EINTR);
+
+		if (done != len)
+			return EIO;
+	}
+
+	return EOK;
+}
+
+static int posix_dev_breadv(struct ext4_blockdev *bdev,
+			    const struct ext4_blockdev_iovec *iov,
+			    uint32_t iovcnt)
+{
+	return posix_dev_rwv(bdev, iov, iovcnt, false);
+}
+
+static int posix_dev_bwritev(struct ext4_blockdev *bdev,
+			     const struct ext4_blockdev_iovec *iov,
+			     uint32_t iovcnt)
+{
+	return posix_dev_rwv(bdev, iov, iovcnt, true);
+}
+
+/**@brief   Durable write: one RWF_DSYNC write where supported, instead
+ *          of a write followed by fdatasync.*/
+static int posix_dev_bwrite_fua(struct ext4_blockdev *bdev, const void *buf,
+				uint64_t blk_id, uint32_t blk_cnt)
+{
+	int r;
+	struct posix_dev *pd = posix_dev_of(bdev);
+	size_t len = (size_t)blk_cnt * bdev->bdif->ph_bsize;
+	uint64_t off = blk_id * bdev->bdif->ph_bsize;
+
+#ifdef RWF_DSYNC
+	if (posix_dev_aligned(pd, buf, len, off)) {
+		struct iovec v = {.iov_base = (void *)buf, .iov_len = len};
+		ssize_t n;
+
+		do {
+			n = pwritev2(pd->fd, &v, 1, (off_t)off, RWF_DSYNC);
+		} while (n < 0 && errno == EINTR);
+
+		if (n >= 0 || errno != EOPNOTSUPP)
+			return n == (ssize_t)len ? EOK : EIO;
+	}
+#endif
+
+	r = posix_dev_rw(bdev, (void *)buf, blk_id, blk_cnt, true);
+	if (r != EOK)
+		return r;
+
+	return fdatasync(pd->fd) ? EIO : EOK;
+}
+
+static int posix_dev_flush(struct ext4_blockdev *bdev)
+{
+	return fdatasync(posix_dev_of(bdev)->fd) ? EIO : EOK;
+}
+
+static int posix_dev_discard(struct ext4_blockdev *bdev, uint64_t blk_id,
+			     uint64_t blk_cnt)
+{
+	/*Punch a hole in an image file, discard on a block device*/
+	if (fallocate(posix_dev_of(bdev)->fd,
+		      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      blk_id * bdev->bdif->ph_bsize,
+		      blk_cnt * bdev->bdif->ph_bsize))
+		return EIO;
+
+	return EOK;
+}
+
+static int posix_dev_close(struct ext4_blockdev *bdev)
+{
+	struct posix_dev *pd = posix_dev_of(bdev);
+
+	free(pd->bounce);
+	pd->bounce = NULL;
+	close(pd->fd);
+	pd->fd = -1;
+	return EOK;
+}
+
+/******************************************************************************/
+struct ext4_blockdev *posix_dev_create(const char *fname, uint32_t flags)
+{
+	size_t len = strlen(fname) + 1;
+	struct posix_dev *pd;
+
+	if (flags & ~POSIX_DEV_DIRECT)
+		return NULL;
+
+	pd = calloc(1, sizeof(struct posix_dev) + len);
+	if (!pd)
+		return NULL;
+
+	memcpy(pd->fname, fname, len);
+	pd->fd = -1;
+	pd->flags = flags;
+
+	pd->bdif.open = posix_dev_open;
+	pd->bdif.bread = posix_dev_bread;
+	pd->bdif.bwrite = posix_dev_bwrite;
+	pd->bdif.close = posix_dev_close;
+	pd->bdif.breadv = posix_dev_breadv;
+	pd->bdif.bwritev = posix_dev_bwritev;
+	pd->bdif.bwrite_fua = posix_dev_bwrite_fua;
+	pd->bdif.flush = posix_dev_flush;
+	pd->bdif.discard = posix_dev_discard;
+	pd->bdif.ph_bsize = POSIX_DEV_BSIZE;
+	pd->bdif.ph_bbuf = pd->ph_bbuf;
+
+	pd->bdev.bdif = &pd->bdif;
+	return &pd->bdev;
+}
+
+/******************************************************************************/
+void posix_dev_destroy(struct ext4_blockdev *bdev)
+{
+	struct posix_dev *pd;
+
+	if (!bdev)
+		return;
+
+	pd = posix_dev_of(bdev);
+	if (pd->fd >= 0)
+		posix_dev_close(bdev);
+
+	free(pd);
+}
+/******************************************************************************/
+#else
+
+struct ext4_blockdev *posix_dev_create(const char *fname, uint32_t flags)
+{
+	(void)fname;
+	(void)flags;
+	return NULL;
+}
+
+void posix_dev_destroy(struct ext4_blockdev *bdev)
+{
+	(void)bdev;
+}
+#endif
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+#include <ext4_errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ram_dev.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+
+/**@brief   Huge page size used to round the mapping length.*/
+#define RAM_DEV_HUGEPAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+/**@brief   Disk block size.*/
+#define RAM_DEV_BSIZE 512
+
+/**@brief   Block device instance.*/
+struct ram_dev {
+	/**@brief   Block device interface (callbacks find the instance
+	 *          through bdev->bdif, shared by partitions)*/
+	struct ext4_blockdev_iface bdif;
+
+	/**@brief   Whole device*/
+	struct ext4_blockdev bdev;
+
+	/**@brief   Physical block buffer*/
+	uint8_t ph_bbuf[RAM_DEV_BSIZE];
+
+	/**@brief   RAM_DEV_* flags*/
+	uint32_t flags;
+
+	/**@brief   Disk memory*/
+	uint8_t *mem;
+
+	/**@brief   Disk size*/
+	size_t size;
+
+	/**@brief   Allocated length (mapping length)*/
+	size_t alloc;
+};
+
+static struct ram_dev *ram_dev_of(struct ext4_blockdev *bdev)
+{
+	return (struct ram_dev *)bdev->bdif;
+}
+
+/**@brief   Disk bytes of blocks (NULL if out of range).*/
+static uint8_t *ram_dev_at(struct ram_dev *rd, uint64_t blk_id,
+			   uint64_t blk_cnt)
+{
+	uint64_t off = blk_id * rd->bdif.ph_bsize;
+	uint64_t len = blk_cnt * rd->bdif.ph_bsize;
+
+	if (off > rd->size || len > rd->size - off)
+		return NULL;
+
+	return rd->mem + off;
+}
+
+/**********************BLOCKDEV INTERFACE**************************************/
+static int ram_dev_open(struct ext4_blockdev *bdev)
+{
+	struct ram_dev *rd = ram_dev_of(bdev);
+
+	rd->bdev.part_offset = 0;
+	rd->bdev.part_size = rd->size;
+	rd->bdif.ph_bcnt = rd->size / rd->bdif.ph_bsize;
+	return EOK;
+}
+
+static int ram_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			 uint64_t blk_id, uint32_t blk_cnt)
+{
+	uint8_t *p = ram_dev_at(ram_dev_of(bdev), blk_id, blk_cnt);
+
+	if (!p)
+		return EIO;
+
+	/* Zero-copy buffers are read in place. */
+	if (p != buf)
+		memcpy(buf, p, (size_t)blk_cnt * bdev->bdif->ph_bsize);
+	return EOK;
+}
+
+static int ram_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt)
+{
+	uint8_t *p = ram_dev_at(ram_dev_of(bdev), blk_id, blk_cnt);
+
+	if (!p)
+		return EIO;
+
+	if (p != buf)
+		memcpy(p, buf, (size_t)blk_cnt * bdev->bdif->ph_bsize);
+	return EOK;
+}
+
+static void *ram_dev_bmap(struct ext4_blockdev *bdev, uint64_t blk_id,
+			  uint32_t blk_cnt)
+{
+	return ram_dev_at(ram_dev_of(bdev), blk_id, blk_cnt);
+}
+
+static int ram_dev_discard(struct ext4_blockdev *bdev, uint64_t blk_id,
+			   uint64_t blk_cnt)
+{
+	uint8_t *p = ram_dev_at(ram_dev_of(bdev), blk_id, blk_cnt);
+
+	if (!p)
+		return EIO;
+
+	memset(p, 0, (size_t)blk_cnt * bdev->bdif->ph_bsize);
+	return EOK;
+}
+
+static int ram_dev_close(struct ext4_blockdev *bdev)
+{
+	(void)bdev;
+	return EOK;
+}
+
+/******************************************************************************/
+/**@brief   Allocate zero filled disk memory.*/
+static int ram_dev_alloc(struct ram_dev *rd)
+{
+#ifdef __linux__
+	void *mem = MAP_FAILED;
+
+	rd->alloc = rd->size;
+	if (rd->flags & RAM_DEV_HUGEPAGE) {
+		rd->alloc = (rd->size + RAM_DEV_HUGEPAGE_SIZE - 1) &
+			    ~(size_t)(RAM_DEV_HUGEPAGE_SIZE - 1);
+		mem = mmap(NULL, rd->alloc, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, rd->alloc, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			return ENOMEM;
+
+		/* No reserved huge pages, ask for transparent ones. */
+		if (rd->flags & RAM_DEV_HUGEPAGE)
+			madvise(mem, rd->alloc, MADV_HUGEPAGE);
+	}
+
+	rd->mem = mem;
+#else
+	rd->alloc = rd->size;
+	rd->mem = calloc(1, rd->size);
+	if (!rd->mem)
+		return ENOMEM;
+#endif
+	return EOK;
+}
+
+struct ext4_blockdev *ram_dev_create(uint64_t size, uint32_t flags)
+{
+	struct ram_dev *rd;
+
+	if ((flags & ~RAM_DEV_HUGEPAGE) || !size || size > SIZE_MAX ||
+	    size % RAM_DEV_BSIZE)
+		return NULL;
+
+	rd = calloc(1, sizeof(struct ram_dev));
+	if (!rd)
+		return NULL;
+
+	rd->flags = flags;
+	rd->size = (size_t)size;
+	if (ram_dev_alloc(rd) != EOK) {
+		free(rd);
+		return NULL;
+	}
+
+	rd->bdif.open = ram_dev_open;
+	rd->bdif.bread = ram_dev_bread;
+	rd->bdif.bwrite = ram_dev_bwrite;
+	rd->bdif.close = ram_dev_close;
+	rd->bdif.bmap = ram_dev_bmap;
+	rd->bdif.discard = ram_dev_discard;
+	rd->bdif.ph_bsize = RAM_DEV_BSIZE;
+	rd->bdif.ph_bcnt = rd->size / RAM_DEV_BSIZE;
+	rd->bdif.ph_bbuf = rd->ph_bbuf;
+
+	rd->bdev.bdif = &rd->bdif;
+	rd->bdev.part_size = rd->size;
+	return &rd->bdev;
+}
+
+/******************************************************************************/
+int ram_dev_load(struct ext4_blockdev *bdev, const char *fname)
+{
+	struct ram_dev *rd = ram_dev_of(bdev);
+	FILE *f = fopen(fname, "rb");
+	size_t n;
+	int r = EOK;
+
+	if (!f)
+		return ENOENT;
+
+	n = fread(rd->mem, 1, rd->size, f);
+	if (ferror(f))
+		r = EIO;
+	else if (n == rd->size && fgetc(f) != EOF)
+		r = EFBIG;
+
+	fclose(f);
+	return r;
+}
+
+/******************************************************************************/
+int ram_dev_dump(struct ext4_blockdev *bdev, const char *fname)
+{
+	struct ram_dev *rd = ram_dev_of(bdev);
+	FILE *f = fopen(fname, "wb");
+	int r = EOK;
+
+	if (!f)
+		return EIO;
+
+	if (fwrite(rd->mem, 1, rd->size, f) != rd->size)
+		r = EIO;
+
+	if (fclose(f))
+		r = EIO;
+
+	return r;
+}
+
+/******************************************************************************/
+void ram_dev_destroy(struct ext4_blockdev *bdev)
+{
+	struct ram_dev *rd;
+
+	if (!bdev)
+		return;
+
+	rd = ram_dev_of(bdev);
+#ifdef __linux__
+	munmap(rd->mem, rd->alloc);
+#else
+	free(rd->mem);
+#endif
+	free(rd);
+}
+/******************************************************************************/
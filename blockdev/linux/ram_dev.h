@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef RAM_DEV_H_
+#define RAM_DEV_H_
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**@brief   Back the disk with huge pages (hugetlbfs pages, transparent
+ *          huge pages if none are reserved).*/
+#define RAM_DEV_HUGEPAGE (1 << 0)
+
+/**@brief   Create a RAM disk block device (zero filled). Each call
+ *          creates an independent instance. The memory lives until
+ *          ram_dev_destroy, so the disk keeps its content across
+ *          mounts. Blocks are available to the zero-copy block cache
+ *          mode (ext4_block_cache_zero_copy).
+ * @param   size disk size in bytes (multiple of 512)
+ * @param   flags RAM_DEV_* flags
+ * @return  block device, NULL if out of memory or invalid arguments*/
+struct ext4_blockdev *ram_dev_create(uint64_t size, uint32_t flags);
+
+/**@brief   Copy an image file to the start of the disk.
+ * @param   bdev RAM disk block device
+ * @param   fname image file name
+ * @return  standard error code (EFBIG if the image does not fit)*/
+int ram_dev_load(struct ext4_blockdev *bdev, const char *fname);
+
+/**@brief   Write the disk content to a file.
+ * @param   bdev RAM disk block device
+ * @param   fname file name (created or truncated)
+ * @return  standard error code*/
+int ram_dev_dump(struct ext4_blockdev *bdev, const char *fname);
+
+/**@brief   Destroy a block device created by ram_dev_create.
+ * @param   bdev block device (closed)*/
+void ram_dev_destroy(struct ext4_blockdev *bdev);
+
+#endif /* RAM_DEV_H_ */
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <ext4_config.h>
+#include <ext4_blockdev.h>
+#include <ext4_errno.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "uring_dev.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_DEV_SUPPORTED 1
+#endif
+#endif
+
+#ifdef URING_DEV_SUPPORTED
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**@brief   Default filename.*/
+static const char *fname = "ext2";
+
+/**@brief   Image block size.*/
+#define EXT4_URINGDEV_BSIZE 512
+
+/**@brief   Submission ring entries.*/
+#define URING_DEV_ENTRIES CONFIG_BLOCK_DEV_AIO_DEPTH
+
+/**@brief   Image file descriptor.*/
+static int dev_fd = -1;
+
+/**@brief   Submission/completion rings (liburing is not required, the
+ *          rings are set up with raw system calls).*/
+static struct {
+	int fd;
+	unsigned entries;
+	unsigned to_submit;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+} ring = {.fd = -1};
+
+/**********************BLOCKDEV INTERFACE**************************************/
+static int uring_dev_open(struct ext4_blockdev *bdev);
+static int uring_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt);
+static int uring_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			    uint64_t blk_id, uint32_t blk_cnt);
+static int uring_dev_close(struct ext4_blockdev *bdev);
+static int uring_dev_submit(struct ext4_blockdev *bdev,
+			    struct ext4_blockdev_req *req);
+static int uring_dev_poll(struct ext4_blockdev *bdev, uint32_t min_done);
+static int uring_dev_flush(struct ext4_blockdev *bdev);
+
+/******************************************************************************/
+EXT4_BLOCKDEV_STATIC_INSTANCE4(uring_dev, EXT4_URINGDEV_BSIZE, 0,
+		uring_dev_open, uring_dev_bread, uring_dev_bwrite,
+		uring_dev_close, 0, 0, 0, 0, uring_dev_submit, uring_dev_poll,
+		0, uring_dev_flush);
+
+/******************************************************************************/
+static int uring_setup(void)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = (int)syscall(__NR_io_uring_setup, URING_DEV_ENTRIES, &p);
+	if (ring.fd < 0)
+		return ENOTSUP;
+
+	ring.entries = p.sq_entries;
+	ring.to_submit = 0;
+	ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_size = p.cq_off.cqes +
+		       p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_size > ring.sq_size)
+			ring.sq_size = ring.cq_size;
+		ring.cq_size = ring.sq_size;
+	}
+
+	ring.sq_ptr = mmap(0, ring.sq_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ring.fd,
+			   IORING_OFF_SQ_RING);
+	if (ring.sq_ptr == MAP_FAILED)
+		goto err_fd;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring.cq_ptr = ring.sq_ptr;
+	} else {
+		ring.cq_ptr = mmap(0, ring.cq_size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ring.fd,
+				   IORING_OFF_CQ_RING);
+		if (ring.cq_ptr == MAP_FAILED)
+			goto err_sq;
+	}
+
+	ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(0, ring.sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		goto err_cq;
+
+	ring.sq_head = (unsigned *)((char *)ring.sq_ptr + p.sq_off.head);
+	ring.sq_tail = (unsigned *)((char *)ring.sq_ptr + p.sq_off.tail);
+	ring.sq_mask = (unsigned *)((char *)ring.sq_ptr + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *)((char *)ring.sq_ptr + p.sq_off.array);
+	ring.cq_head = (unsigned *)((char *)ring.cq_ptr + p.cq_off.head);
+	ring.cq_tail = (unsigned *)((char *)ring.cq_ptr + p.cq_off.tail);
+	ring.cq_mask = (unsigned *)((char *)ring.cq_ptr + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)((char *)ring.cq_ptr +
+					    p.cq_off.cqes);
+	return EOK;
+
+err_cq:
+	if (ring.cq_ptr != ring.sq_ptr)
+		munmap(ring.cq_ptr, ring.cq_size);
+err_sq:
+	munmap(ring.sq_ptr, ring.sq_size);
+err_fd:
+	close(ring.fd);
+	ring.fd = -1;
+	return ENOMEM;
+}
+
+static void uring_teardown(void)
+{
+	munmap(ring.sqes, ring.sqes_size);
+	if (ring.cq_ptr != ring.sq_ptr)
+		munmap(ring.cq_ptr, ring.cq_size);
+	munmap(ring.sq_ptr, ring.sq_size);
+	close(ring.fd);
+	ring.fd = -1;
+}
+
+/**@brief   Pass queued submissions to the kernel, optionally waiting
+ *          for @p min_done completions.*/
+static int uring_enter(uint32_t min_done)
+{
+	int r;
+
+	do {
+		r = (int)syscall(__NR_io_uring_enter, ring.fd, ring.to_submit,
+				 min_done,
+				 min_done ? IORING_ENTER_GETEVENTS : 0, NULL,
+				 0);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0)
+		return EIO;
+
+	ring.to_submit -= (unsigned)r < ring.to_submit ? (unsigned)r :
+							  ring.to_submit;
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_open(struct ext4_blockdev *bdev)
+{
+	off_t size;
+	int r;
+
+	dev_fd = open(fname, O_RDWR);
+	if (dev_fd < 0)
+		return EIO;
+
+	size = lseek(dev_fd, 0, SEEK_END);
+	if (size < 0) {
+		close(dev_fd);
+		return EFAULT;
+	}
+
+	r = uring_setup();
+	if (r != EOK) {
+		close(dev_fd);
+		return r;
+	}
+
+	uring_dev.part_offset = 0;
+	uring_dev.part_size = size;
+	uring_dev.bdif->ph_bcnt = uring_dev.part_size / uring_dev.bdif->ph_bsize;
+
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt)
+{
+	size_t len = (size_t)blk_cnt * bdev->bdif->ph_bsize;
+
+	if (pread(dev_fd, buf, len, blk_id * bdev->bdif->ph_bsize) !=
+	    (ssize_t)len)
+		return EIO;
+
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			    uint64_t blk_id, uint32_t blk_cnt)
+{
+	size_t len = (size_t)blk_cnt * bdev->bdif->ph_bsize;
+
+	if (pwrite(dev_fd, buf, len, blk_id * bdev->bdif->ph_bsize) !=
+	    (ssize_t)len)
+		return EIO;
+
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_submit(struct ext4_blockdev *bdev,
+			    struct ext4_blockdev_req *req)
+{
+	int r;
+	unsigned tail, idx;
+	struct io_uring_sqe *sqe;
+
+	/* Submission ring full: hand the queued entries to the kernel. */
+	tail = *ring.sq_tail;
+	if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >=
+	    ring.entries) {
+		r = uring_enter(0);
+		if (r != EOK)
+			return r;
+	}
+
+	idx = tail & *ring.sq_mask;
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = dev_fd;
+	sqe->off = req->seg.blk_id * bdev->bdif->ph_bsize;
+	sqe->addr = (uint64_t)(uintptr_t)req->seg.buf;
+	sqe->len = req->seg.blk_cnt * bdev->bdif->ph_bsize;
+	sqe->user_data = (uint64_t)(uintptr_t)req;
+
+	ring.sq_array[idx] = idx;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring.to_submit++;
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_poll(struct ext4_blockdev *bdev, uint32_t min_done)
+{
+	int r, res;
+	unsigned head, tail;
+	struct io_uring_cqe *cqe;
+	struct ext4_blockdev_req *req;
+
+	r = uring_enter(min_done);
+	if (r != EOK)
+		return r;
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		req = (struct ext4_blockdev_req *)(uintptr_t)cqe->user_data;
+		res = cqe->res == (int)(req->seg.blk_cnt * bdev->bdif->ph_bsize)
+			  ? EOK : EIO;
+		head++;
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+		ext4_block_aio_complete(req->bdev, req, res);
+	}
+
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_flush(struct ext4_blockdev *bdev)
+{
+	if (fdatasync(dev_fd))
+		return EIO;
+
+	return EOK;
+}
+
+/******************************************************************************/
+static int uring_dev_close(struct ext4_blockdev *bdev)
+{
+	uring_teardown();
+	close(dev_fd);
+	dev_fd = -1;
+	return EOK;
+}
+
+/******************************************************************************/
+struct ext4_blockdev *uring_dev_get(void)
+{
+	return &uring_dev;
+}
+/******************************************************************************/
+void uring_dev_name_set(const char *n)
+{
+	fname = n;
+}
+/******************************************************************************/
+#else
+
+struct ext4_blockdev *uring_dev_get(void)
+{
+	return NULL;
+}
+
+void uring_dev_name_set(const char *n)
+{
+	(void)n;
+}
+#endif
@@ -120,6 +120,78 @@ void test_lwext4_mp_stats(void)
 	printf("********************\n");
 }
 
+static void test_lwext4_cache_stats(void)
+{
+	static const char *cls_name[EXT4_BCACHE_CLASS_COUNT] = {
+		"other", "bitmap", "itable", "dir", "dx", "extent", "journal",
+		"data"
+	};
+	struct ext4_mount_cache_stats stats;
+	uint32_t i;
+
+	if (ext4_mount_point_cache_stats("/mp/", &stats) != EOK)
+		return;
+
+	printf("bcache size: %" PRIu32 " blocks, %" PRIu64 " bytes\n",
+	       stats.cache_size, stats.cache_bytes);
+	if (stats.shared_size)
+		printf("bcache shared: %" PRIu32 " of %" PRIu32 " blocks in use, "
+		       "%" PRIu32 " by this mount\n", stats.shared_blocks,
+		       stats.shared_size, stats.ref_blocks);
+	printf("bcache class    hits  misses   evict  devict flushes ra_hits\n");
+	for (i = 0; i < EXT4_BCACHE_CLASS_COUNT; i++) {
+		const struct ext4_bcache_stats *c = &stats.cls[i];
+		printf("%-8s %9" PRIu32 " %7" PRIu32 " %7" PRIu32 " %7" PRIu32
+		       " %7" PRIu32 " %7" PRIu32 "\n", cls_name[i], c->hits,
+		       c->misses, c->evictions, c->dirty_evictions, c->flushes,
+		       c->ra_hits);
+	}
+}
+
+static void test_lwext4_bdev_hist_stats(void)
+{
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	static const char *op_name[EXT4_BDEV_OP_COUNT] = {
+		"read", "write", "flush", "discard"
+	};
+	struct ext4_blockdev_stats st;
+	const struct ext4_bdev_hist *h;
+	uint32_t i;
+
+	ext4_block_stats_get(bd, &st);
+
+	printf("bdev latency us     calls     avg     p50     p99     max\n");
+	for (i = 0; i < EXT4_BDEV_OP_COUNT + 2; i++) {
+		if (i < EXT4_BDEV_OP_COUNT)
+			h = &st.lat[i];
+		else
+			h = &st.queue[i - EXT4_BDEV_OP_COUNT];
+
+		if (!h->cnt)
+			continue;
+
+		printf("%-8s %-6s %9" PRIu64 " %7" PRIu64 " %7" PRIu64
+		       " %7" PRIu64 " %7" PRIu64 "\n",
+		       i < EXT4_BDEV_OP_COUNT ? op_name[i] :
+				op_name[i - EXT4_BDEV_OP_COUNT],
+		       i < EXT4_BDEV_OP_COUNT ? "" : "async", h->cnt,
+		       h->sum / h->cnt, ext4_block_stats_percentile(h, 500),
+		       ext4_block_stats_percentile(h, 990), h->max);
+	}
+
+	for (i = 0; i < 2; i++) {
+		h = &st.size[i];
+		if (!h->cnt)
+			continue;
+
+		printf("bdev %-5s size avg %" PRIu64 " p50 %" PRIu64
+		       " p99 %" PRIu64 " max %" PRIu64 " bytes\n", op_name[i],
+		       h->sum / h->cnt, ext4_block_stats_percentile(h, 500),
+		       ext4_block_stats_percentile(h, 990), h->max);
+	}
+#endif
+}
+
 void test_lwext4_block_stats(void)
 {
 	if (!bd)
@@ -129,11 +201,22 @@ void test_lwext4_block_stats(void)
 	printf("ext4 blockdev stats\n");
 	printf("bdev->bread_ctr = %" PRIu32 "\n", bd->bdif->bread_ctr);
 	printf("bdev->bwrite_ctr = %" PRIu32 "\n", bd->bdif->bwrite_ctr);
+	printf("bdev->flush_ctr = %" PRIu32 "\n", bd->bdif->flush_ctr);
+	printf("bdev->discard_ctr = %" PRIu32 "\n", bd->bdif->discard_ctr);
+	printf("bdev->ra_reads = %" PRIu32 "\n", bd->ra_reads);
+	printf("bdev->ra_blocks = %" PRIu32 "\n", bd->ra_blocks);
+	printf("bdev->ra_hits = %" PRIu32 "\n", bd->ra_hits);
+	printf("bdev->ra_waste = %" PRIu32 "\n", bd->ra_waste);
 
 	printf("bcache->ref_blocks = %" PRIu32 "\n", bd->bc->ref_blocks);
 	printf("bcache->max_ref_blocks = %" PRIu32 "\n", bd->bc->max_ref_blocks);
 	printf("bcache->lru_ctr = %" PRIu32 "\n", bd->bc->lru_ctr);
+	printf("bcache->pool_allocs = %" PRIu32 "\n", bd->bc->pool_allocs);
+	printf("bcache->heap_allocs = %" PRIu32 "\n", bd->bc->heap_allocs);
+	printf("bcache->maps = %" PRIu32 "\n", bd->bc->maps);
 
+	test_lwext4_cache_stats();
+	test_lwext4_bdev_hist_stats();
 	printf("\n");
 
 	printf("********************\n");
@@ -190,7 +273,8 @@ static int verify_buf(const unsigned char *b, size_t len, unsigned char c)
 	return 0;
 }
 
-bool test_lwext4_file_test(uint8_t *rw_buff, uint32_t rw_size, uint32_t rw_count)
+bool test_lwext4_file_test(uint8_t *rw_buff, uint32_t rw_size, uint32_t rw_count,
+			   bool prealloc)
 {
 	int r;
 	size_t size;
@@ -220,6 +304,15 @@ bool test_lwext4_file_test(uint8_t *rw_buff, uint32_t rw_size, uint32_t rw_count
 		return false;
 	}
 
+	if (prealloc) {
+		r = ext4_fallocate(&f, 0, (uint64_t)rw_size * rw_count,
+				   EXT4_FALLOC_KEEP_SIZE);
+		if (r != EOK) {
+			printf("ext4_fallocate ERROR = %d\n", r);
+			return false;
+		}
+	}
+
 	printf("ext4_write: %" PRIu32 " * %" PRIu32 " ...\n", rw_size,
 	       rw_count);
 	for (i = 0; i < rw_count; ++i) {
@@ -330,6 +423,10 @@ bool test_lwext4_mount(struct ext4_blockdev *bdev, struct ext4_bcache *bcache)
 
 	ext4_dmask_set(DEBUG_ALL);
 
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	ext4_block_stats_clock(bd, tim_get_us);
+#endif
+
 	r = ext4_device_register(bd, "ext4_fs");
 	if (r != EOK) {
 		printf("ext4_device_register: rc = %d\n", r);
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include <ext4.h>
+#include <ext4_bcache.h>
+#include <ext4_blockdev.h>
+
+/**@brief   Benchmark to run.*/
+static char bench_name[32] = "lookup";
+
+/**@brief   Cache item size.*/
+static uint32_t block_size = 1024;
+
+/**@brief   Lookups per measured cache size.*/
+static uint32_t lookup_cnt = 4 * 1024 * 1024;
+
+/**@brief   Cache sizes measured by the lookup benchmark.*/
+static const uint32_t lookup_sizes[] = {1024, 16 * 1024, 256 * 1024};
+
+/**@brief   Cache size used by the policy benchmark.*/
+static uint32_t policy_cache_cnt = 1024;
+
+/**@brief   Block accesses per policy benchmark workload.*/
+static uint32_t policy_access_cnt = 1024 * 1024;
+
+/**@brief   Policy benchmark workloads.*/
+enum bench_workload {
+	/**@brief   Random accesses to a hot set (3/4 of the cache).*/
+	WL_METADATA,
+	/**@brief   Hot set (1/2 of the cache) accesses, interleaved with
+	 *          3 times as many single-use streaming accesses.*/
+	WL_MIXED,
+	/**@brief   Cyclic scan over twice the cache size.*/
+	WL_LOOP,
+	WL_COUNT
+};
+
+static const char *workload_names[WL_COUNT] = {
+    "metadata", "mixed", "loop",
+};
+
+static const char *policy_names[] = {
+    [EXT4_BCACHE_POLICY_LRU] = "lru",
+    [EXT4_BCACHE_POLICY_2Q] = "2q",
+};
+
+static const char *usage = "                                    \n\
+Welcome in lwext4 block cache benchmark.                        \n\
+Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)  \n\
+Usage:                                                          \n\
+[-t] --test     - benchmark: lookup, policy (default = lookup)  \n\
+[-b] --block    - cache item size         (default = 1024)      \n\
+[-n] --lookups  - lookups per cache size  (default = 4194304)   \n\
+[-c] --cache    - policy: cache size      (default = 1024)      \n\
+[-a] --accesses - policy: block accesses  (default = 1048576)   \n\
+\n";
+
+/**********************NULL BLOCKDEV******************************************/
+static int null_dev_open(struct ext4_blockdev *bdev)
+{
+	return EOK;
+}
+
+static int null_dev_bread(struct ext4_blockdev *bdev, void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt)
+{
+	return EOK;
+}
+
+static int null_dev_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			   uint64_t blk_id, uint32_t blk_cnt)
+{
+	return EOK;
+}
+
+static int null_dev_close(struct ext4_blockdev *bdev)
+{
+	return EOK;
+}
+
+EXT4_BLOCKDEV_STATIC_INSTANCE(null_dev, 512, 0, null_dev_open,
+			      null_dev_bread, null_dev_bwrite, null_dev_close,
+			      0, 0);
+
+/******************************************************************************/
+static uint64_t tim_get_us(void)
+{
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return (t.tv_sec * 1000000) + (t.tv_usec);
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/**@brief   Spread cached LBAs like inode table / bitmap blocks of
+ *          consecutive block groups.*/
+static uint64_t lookup_lba(uint32_t i)
+{
+	return 1 + (uint64_t)i * 8;
+}
+
+static bool bench_lookup_one(uint32_t cnt)
+{
+	int r;
+	bool is_new;
+	uint32_t i, rnd = 2463534242u;
+	uint64_t start, stop;
+	struct ext4_bcache bc;
+	struct ext4_block *blocks;
+
+	r = ext4_bcache_init_dynamic(&bc, cnt, block_size);
+	if (r != EOK) {
+		printf("ext4_bcache_init_dynamic: rc = %d\n", r);
+		return false;
+	}
+	ext4_block_bind_bcache(&null_dev, &bc);
+
+	blocks = calloc(cnt, sizeof(struct ext4_block));
+	if (!blocks) {
+		ext4_bcache_fini_dynamic(&bc);
+		return false;
+	}
+
+	/* Keep every buffer referenced, so that only the lookup path
+	 * is measured (no LRU tree updates). */
+	for (i = 0; i < cnt; i++) {
+		blocks[i].lb_id = lookup_lba(i);
+		r = ext4_bcache_alloc(&bc, &blocks[i], &is_new);
+		if (r != EOK) {
+			printf("ext4_bcache_alloc: rc = %d\n", r);
+			return false;
+		}
+		ext4_bcache_set_flag(blocks[i].buf, BC_UPTODATE);
+	}
+
+	start = tim_get_us();
+	for (i = 0; i < lookup_cnt; i++) {
+		struct ext4_block b;
+		uint64_t lba = lookup_lba(xorshift32(&rnd) % cnt);
+		if (!ext4_bcache_find_get(&bc, &b, lba)) {
+			printf("lookup miss: lba = %" PRIu64 "\n", lba);
+			return false;
+		}
+		ext4_bcache_free(&bc, &b);
+	}
+	stop = tim_get_us();
+
+	printf("  %7" PRIu32 " buffers: %8.1f ns/lookup, heap allocs: %"
+	       PRIu32 "\n", cnt, (double)(stop - start) * 1000.0 / lookup_cnt,
+	       bc.heap_allocs);
+
+	for (i = 0; i < cnt; i++)
+		ext4_bcache_free(&bc, &blocks[i]);
+
+	ext4_bcache_cleanup(&bc);
+	ext4_bcache_fini_dynamic(&bc);
+	free(blocks);
+	return true;
+}
+
+static bool bench_lookup(void)
+{
+	size_t i;
+
+	printf("lookup: random hits, block size %" PRIu32 "\n", block_size);
+	for (i = 0; i < sizeof(lookup_sizes) / sizeof(lookup_sizes[0]); i++) {
+		if (!bench_lookup_one(lookup_sizes[i]))
+			return false;
+	}
+	return true;
+}
+
+static uint64_t workload_lba(enum bench_workload wl, uint32_t i,
+			     uint32_t *rnd, bool *meta)
+{
+	/* Streaming blocks are placed far away from the hot set. */
+	const uint64_t stream_base = 1 << 24;
+	uint32_t cnt = policy_cache_cnt;
+
+	switch (wl) {
+	case WL_METADATA:
+		*meta = true;
+		return 1 + xorshift32(rnd) % (cnt * 3 / 4);
+	case WL_MIXED:
+		*meta = (i % 4) == 0;
+		if (*meta)
+			return 1 + xorshift32(rnd) % (cnt / 2);
+
+		return stream_base + i;
+	case WL_LOOP:
+	default:
+		*meta = false;
+		return 1 + i % (cnt * 2);
+	}
+}
+
+static bool bench_policy_one(enum ext4_bcache_policy policy,
+			     enum bench_workload wl)
+{
+	int r;
+	uint32_t i, rnd = 2463534242u;
+	uint32_t hits = 0, meta_hits = 0, meta_cnt = 0;
+	struct ext4_bcache bc;
+
+	r = ext4_bcache_init_dynamic2(&bc, policy_cache_cnt, block_size,
+				      policy);
+	if (r != EOK) {
+		printf("ext4_bcache_init_dynamic2: rc = %d\n", r);
+		return false;
+	}
+
+	ext4_block_bind_bcache(&null_dev, &bc);
+	for (i = 0; i < policy_access_cnt; i++) {
+		bool meta;
+		struct ext4_block b;
+		uint32_t rd = null_dev.bdif->bread_ctr;
+		uint64_t lba = workload_lba(wl, i, &rnd, &meta);
+
+		r = ext4_block_get2(&null_dev, &b, lba,
+				    meta ? EXT4_BCACHE_CLASS_BITMAP
+					 : EXT4_BCACHE_CLASS_DATA);
+		if (r != EOK) {
+			printf("ext4_block_get2: rc = %d\n", r);
+			return false;
+		}
+		ext4_block_set(&null_dev, &b);
+
+		if (rd == null_dev.bdif->bread_ctr) {
+			hits++;
+			meta_hits += meta;
+		}
+		meta_cnt += meta;
+	}
+
+	printf("  %-10s %-6s %7.2f%%", workload_names[wl],
+	       policy_names[policy], 100.0 * hits / policy_access_cnt);
+	if (meta_cnt)
+		printf(" %7.2f%%", 100.0 * meta_hits / meta_cnt);
+	else
+		printf(" %8s", "-");
+	printf(" %6" PRIu32 "\n", bc.heap_allocs);
+
+	ext4_bcache_cleanup(&bc);
+	ext4_bcache_fini_dynamic(&bc);
+	return true;
+}
+
+static bool bench_policy(void)
+{
+	int wl;
+
+	null_dev.part_size = (uint64_t)block_size << 32;
+	if (ext4_block_init(&null_dev) != EOK)
+		return false;
+
+	ext4_block_set_lb_size(&null_dev, block_size);
+
+	printf("policy: cache %" PRIu32 " blocks, %" PRIu32 " accesses\n",
+	       policy_cache_cnt, policy_access_cnt);
+	printf("  %-10s %-6s %8s %8s %6s\n", "workload", "policy", "hits",
+	       "md hits", "heap");
+	for (wl = 0; wl < WL_COUNT; wl++) {
+		if (!bench_policy_one(EXT4_BCACHE_POLICY_LRU, wl))
+			return false;
+		if (!bench_policy_one(EXT4_BCACHE_POLICY_2Q, wl))
+			return false;
+	}
+
+	ext4_block_fini(&null_dev);
+	return true;
+}
+
+static bool parse_opt(int argc, char **argv)
+{
+	int option_index = 0;
+	int c;
+
+	static struct option long_options[] = {
+	    {"test", required_argument, 0, 't'},
+	    {"block", required_argument, 0, 'b'},
+	    {"lookups", required_argument, 0, 'n'},
+	    {"cache", required_argument, 0, 'c'},
+	    {"accesses", required_argument, 0, 'a'},
+	    {0, 0, 0, 0}};
+
+	while (-1 != (c = getopt_long(argc, argv, "t:b:n:c:a:",
+				      long_options, &option_index))) {
+
+		switch (c) {
+		case 't':
+			strncpy(bench_name, optarg, sizeof(bench_name) - 1);
+			break;
+		case 'b':
+			block_size = atoi(optarg);
+			break;
+		case 'n':
+			lookup_cnt = atoi(optarg);
+			break;
+		case 'c':
+			policy_cache_cnt = atoi(optarg);
+			break;
+		case 'a':
+			policy_access_cnt = atoi(optarg);
+			break;
+		default:
+			printf("%s", usage);
+			return false;
+		}
+	}
+
+	if (!block_size || !lookup_cnt || policy_cache_cnt < 4 ||
+	    !policy_access_cnt) {
+		printf("%s", usage);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (!parse_opt(argc, argv))
+		return EXIT_FAILURE;
+
+	if (!strcmp(bench_name, "lookup"))
+		return bench_lookup() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (!strcmp(bench_name, "policy"))
+		return bench_policy() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	printf("%s", usage);
+	return EXIT_FAILURE;
+}
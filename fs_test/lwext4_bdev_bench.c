@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include <ext4_errno.h>
+#include <ext4_blockdev.h>
+
+#include "../blockdev/linux/file_dev.h"
+#include "../blockdev/linux/posix_dev.h"
+
+/**@brief   Image file (contents are overwritten).*/
+static char input_name[128] = "ext2";
+
+/**@brief   Transfer size.*/
+static uint32_t block_size = 4096;
+
+/**@brief   Transfers per workload.*/
+static uint32_t op_cnt = 16384;
+
+static const char *usage = "                                    \n\
+Welcome in lwext4 block device benchmark.                       \n\
+Copyright (c) 2013 Grzegorz Kostka (kostka.grzegorz@gmail.com)  \n\
+Usage:                                                          \n\
+[-i] --input    - image file, overwritten (default = ext2)      \n\
+[-b] --block    - transfer size           (default = 4096)      \n\
+[-n] --ops      - transfers per workload  (default = 16384)     \n\
+\n";
+
+/**@brief   Benchmark workloads.*/
+enum bench_workload {
+	WL_SEQ_WRITE,
+	WL_SEQ_READ,
+	WL_RAND_WRITE,
+	WL_RAND_READ,
+	WL_COUNT
+};
+
+static const char *workload_names[WL_COUNT] = {
+    "seq write", "seq read", "rand write", "rand read",
+};
+
+/******************************************************************************/
+static uint64_t tim_get_us(void)
+{
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return (t.tv_sec * 1000000) + (t.tv_usec);
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static bool bench_workload(struct ext4_blockdev *bd, enum bench_workload wl,
+			   uint8_t *buf, double *us_per_op)
+{
+	int r = EOK;
+	uint32_t i, rnd = 2463534242u;
+	uint64_t lba, start, stop;
+
+	start = tim_get_us();
+	for (i = 0; i < op_cnt && r == EOK; i++) {
+		if (wl == WL_RAND_WRITE || wl == WL_RAND_READ)
+			lba = xorshift32(&rnd) % bd->lg_bcnt;
+		else
+			lba = i % bd->lg_bcnt;
+
+		if (wl == WL_SEQ_WRITE || wl == WL_RAND_WRITE)
+			r = ext4_blocks_set_direct(bd, buf, lba, 1);
+		else
+			r = ext4_blocks_get_direct(bd, buf, lba, 1);
+	}
+	stop = tim_get_us();
+
+	if (r != EOK) {
+		printf("%s: rc = %d\n", workload_names[wl], r);
+		return false;
+	}
+
+	*us_per_op = (double)(stop - start) / op_cnt;
+	return true;
+}
+
+static bool bench_dev(const char *name, struct ext4_blockdev *bd,
+		      uint8_t *buf)
+{
+	int r;
+	double us[WL_COUNT];
+	enum bench_workload wl;
+
+	if (!bd) {
+		printf("%s: no block device\n", name);
+		return false;
+	}
+
+	r = ext4_block_init(bd);
+	if (r != EOK) {
+		printf("%s: ext4_block_init: rc = %d\n", name, r);
+		return false;
+	}
+
+	ext4_block_set_lb_size(bd, block_size);
+	for (wl = 0; wl < WL_COUNT; wl++) {
+		if (!bench_workload(bd, wl, buf, &us[wl])) {
+			ext4_block_fini(bd);
+			return false;
+		}
+	}
+	ext4_block_fini(bd);
+
+	printf("  %-14s", name);
+	for (wl = 0; wl < WL_COUNT; wl++)
+		printf(" %10.2f", us[wl]);
+	printf("\n");
+	return true;
+}
+
+static bool bench(void)
+{
+	bool ok;
+	uint8_t *buf;
+	struct ext4_blockdev *bd;
+	enum bench_workload wl;
+
+	if (posix_memalign((void **)&buf, 4096, block_size))
+		return false;
+	memset(buf, 0xA5, block_size);
+
+	printf("block device benchmark: %s, %" PRIu32 " x %" PRIu32
+	       " bytes, us/transfer\n", input_name, op_cnt, block_size);
+	printf("  %-14s", "device");
+	for (wl = 0; wl < WL_COUNT; wl++)
+		printf(" %10s", workload_names[wl]);
+	printf("\n");
+
+	file_dev_name_set(input_name);
+	ok = bench_dev("file_dev", file_dev_get(), buf);
+
+	bd = posix_dev_create(input_name, 0);
+	ok = ok && bench_dev("posix_dev", bd, buf);
+	posix_dev_destroy(bd);
+
+	bd = posix_dev_create(input_name, POSIX_DEV_DIRECT);
+	ok = ok && bench_dev("posix_dev -o", bd, buf);
+	posix_dev_destroy(bd);
+
+	free(buf);
+	return ok;
+}
+
+static bool parse_opt(int argc, char **argv)
+{
+	int option_index = 0;
+	int c;
+
+	static struct option long_options[] = {
+	    {"input", required_argument, 0, 'i'},
+	    {"block", required_argument, 0, 'b'},
+	    {"ops", required_argument, 0, 'n'},
+	    {0, 0, 0, 0}};
+
+	while (-1 != (c = getopt_long(argc, argv, "i:b:n:",
+				      long_options, &option_index))) {
+
+		switch (c) {
+		case 'i':
+			strncpy(input_name, optarg, sizeof(input_name) - 1);
+			break;
+		case 'b':
+			block_size = atoi(optarg);
+			break;
+		case 'n':
+			op_cnt = atoi(optarg);
+			break;
+		default:
+			printf("%s", usage);
+			return false;
+		}
+	}
+
+	if (!block_size || block_size % 512 || !op_cnt) {
+		printf("%s", usage);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	if (!parse_opt(argc, argv))
+		return EXIT_FAILURE;
+
+	return bench() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -36,9 +36,15 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <pthread.h>
 
 #include <ext4.h>
 #include "../blockdev/linux/file_dev.h"
+#include "../blockdev/linux/uring_dev.h"
+#include "../blockdev/linux/posix_dev.h"
+#include "../blockdev/linux/mmap_dev.h"
+#include "../blockdev/linux/ram_dev.h"
+#include "../blockdev/linux/lat_dev.h"
 #include "../blockdev/windows/file_windows.h"
 #include "common/test_lwext4.h"
 
@@ -70,9 +76,63 @@ static bool sbstat = false;
 /**@brief   Indicates that input is windows partition.*/
 static bool winpart = false;
 
+/**@brief   Indicates that input is opened with io_uring device.*/
+static bool uring = false;
+
+/**@brief   Input opened with the stdio (file_dev) block device.*/
+static bool stdio_dev = false;
+
+/**@brief   Input opened with O_DIRECT.*/
+static bool direct = false;
+
+/**@brief   Input opened with the memory mapped block device.*/
+static bool mmap_input = false;
+
+/**@brief   Input loaded to a RAM disk (written back after the test).*/
+static bool ram_input = false;
+
+/**@brief   RAM disk on huge pages.*/
+static bool hugepage = false;
+
+/**@brief   Discard free blocks before unmount.*/
+static bool trim = false;
+
+/**@brief   Emulated device latency model (-e), NULL - none.*/
+static const struct lat_dev_model *lat_model;
+
+/**@brief   Device latency only advances the device clock.*/
+static bool lat_nosleep = false;
+
+/**@brief   I/O trace of the emulated device, NULL - none.*/
+static FILE *lat_trace;
+
+/**@brief   Block device created by lat_dev_create.*/
+static struct ext4_blockdev *lat_bd;
+
+/**@brief   Block device created by posix_dev_create.*/
+static struct ext4_blockdev *posix_bd;
+
+/**@brief   Block device created by mmap_dev_create.*/
+static struct ext4_blockdev *mmap_bd;
+
+/**@brief   Block device created by ram_dev_create.*/
+static struct ext4_blockdev *ram_bd;
+
 /**@brief   Verbose mode*/
 static bool verbose = 0;
 
+/**@brief   Write-back daemon period (ms), 0 - disabled*/
+static int wbd_period = 0;
+
+/**@brief   Block cache memory budget (bytes), 0 - default size*/
+static long cache_budget = 0;
+
+/**@brief   Delayed allocation budget (bytes), 0 - disabled*/
+static long delalloc_budget = 0;
+
+/**@brief   Preallocate the test file (ext4_fallocate).*/
+static bool prealloc = false;
+
 /**@brief   Block device handle.*/
 static struct ext4_blockdev *bd;
 
@@ -91,8 +151,92 @@ Usage:                                                          \n\
 [-b] --bstat  - block device stats                              \n\
 [-t] --sbstat - superblock stats                                \n\
 [-w] --wpart  - windows partition mode                          \n\
+[-k] --wbd    - write-back daemon period, ms (default = 0: off) \n\
+[-m] --cache  - block cache budget, bytes (default = 0: config)  \n\
+[-z] --delalloc - delayed allocation budget, bytes (default = 0) \n\
+[-j] --prealloc - preallocate the test file (ext4_fallocate)     \n\
+[-u] --uring  - io_uring block device (asynchronous I/O)        \n\
+[-f] --stdio  - stdio block device (fseek/fread/fwrite)         \n\
+[-o] --direct - O_DIRECT, page cache bypass                     \n\
+[-p] --mmap   - memory mapped block device                      \n\
+[-r] --trim   - discard free blocks at the end (ext4_fstrim)    \n\
+[-a] --ram    - RAM disk loaded from input, dumped back at exit \n\
+[-g] --hugepage - RAM disk on huge pages                        \n\
+[-e] --emulate - device latency model: hdd, ssd or net          \n\
+[-n] --nosleep - emulated latency on the device clock only      \n\
+[-y] --trace  - emulated device I/O trace file                  \n\
 \n";
 
+/**@brief   Write-back daemon thresholds.*/
+static const struct ext4_writeback_cfg wbd_cfg = {
+	.dirty_ratio = 25,
+	.max_age_ms = 1000,
+	.max_blocks = 64,
+};
+
+static pthread_mutex_t wbd_mutex;
+static pthread_t wbd_thread;
+static bool wbd_stop;
+
+static void wbd_lock(void)
+{
+	pthread_mutex_lock(&wbd_mutex);
+}
+
+static void wbd_unlock(void)
+{
+	pthread_mutex_unlock(&wbd_mutex);
+}
+
+static const struct ext4_lock wbd_locks = {
+	.lock = wbd_lock,
+	.unlock = wbd_unlock,
+};
+
+static void *wbd_main(void *arg)
+{
+	bool stop = false;
+
+	(void)arg;
+	while (!stop) {
+		int r;
+		usleep(wbd_period * 1000);
+		r = ext4_cache_writeback_step("/mp/", &wbd_cfg, tim_get_ms());
+		if (r != EOK)
+			printf("ext4_cache_writeback_step: rc = %d\n", r);
+
+		wbd_lock();
+		stop = wbd_stop;
+		wbd_unlock();
+	}
+	return NULL;
+}
+
+static bool wbd_start(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&wbd_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	ext4_mount_setup_locks("/mp/", &wbd_locks);
+	if (pthread_create(&wbd_thread, NULL, wbd_main, NULL)) {
+		printf("wbd_start: pthread_create fail\n");
+		return false;
+	}
+	return true;
+}
+
+static void wbd_join(void)
+{
+	wbd_lock();
+	wbd_stop = true;
+	wbd_unlock();
+	pthread_join(wbd_thread, NULL);
+}
+
 void io_timings_clear(void)
 {
 }
@@ -116,10 +260,47 @@ uint64_t tim_get_us(void)
 	return (t.tv_sec * 1000000) + (t.tv_usec);
 }
 
+static bool open_ram(void)
+{
+	FILE *f = fopen(input_name, "rb");
+	long size;
+
+	if (!f || fseek(f, 0, SEEK_END) || (size = ftell(f)) <= 0) {
+		if (f)
+			fclose(f);
+		printf("open_ram: no input image\n");
+		return false;
+	}
+	fclose(f);
+
+	ram_bd = ram_dev_create(size, hugepage ? RAM_DEV_HUGEPAGE : 0);
+	if (!ram_bd || ram_dev_load(ram_bd, input_name) != EOK) {
+		printf("open_ram: fail\n");
+		return false;
+	}
+
+	bd = ram_bd;
+	return true;
+}
+
 static bool open_linux(void)
 {
-	file_dev_name_set(input_name);
-	bd = file_dev_get();
+	if (ram_input) {
+		return open_ram();
+	} else if (uring) {
+		uring_dev_name_set(input_name);
+		bd = uring_dev_get();
+	} else if (mmap_input) {
+		mmap_bd = mmap_dev_create(input_name, 0);
+		bd = mmap_bd;
+	} else if (stdio_dev) {
+		file_dev_name_set(input_name);
+		bd = file_dev_get();
+	} else {
+		posix_bd = posix_dev_create(input_name,
+					    direct ? POSIX_DEV_DIRECT : 0);
+		bd = posix_bd;
+	}
 	if (!bd) {
 		printf("open_filedev: fail\n");
 		return false;
@@ -144,9 +325,26 @@ static bool open_windows(void)
 #endif
 }
 
+static bool open_lat(void)
+{
+	lat_bd = lat_dev_create(bd, lat_model,
+				lat_nosleep ? LAT_DEV_NOSLEEP : 0);
+	if (!lat_bd) {
+		printf("open_lat: fail\n");
+		return false;
+	}
+
+	lat_dev_trace(lat_bd, lat_trace);
+	bd = lat_bd;
+	return true;
+}
+
 static bool open_filedev(void)
 {
-	return winpart ? open_windows() : open_linux();
+	if (!(winpart ? open_windows() : open_linux()))
+		return false;
+
+	return lat_model ? open_lat() : true;
 }
 
 static bool parse_opt(int argc, char **argv)
@@ -165,9 +363,23 @@ static bool parse_opt(int argc, char **argv)
 	    {"wpart", no_argument, 0, 'w'},
 	    {"verbose", no_argument, 0, 'v'},
 	    {"version", no_argument, 0, 'x'},
+	    {"wbd", required_argument, 0, 'k'},
+	    {"cache", required_argument, 0, 'm'},
+	    {"delalloc", required_argument, 0, 'z'},
+	    {"prealloc", no_argument, 0, 'j'},
+	    {"uring", no_argument, 0, 'u'},
+	    {"stdio", no_argument, 0, 'f'},
+	    {"direct", no_argument, 0, 'o'},
+	    {"mmap", no_argument, 0, 'p'},
+	    {"trim", no_argument, 0, 'r'},
+	    {"ram", no_argument, 0, 'a'},
+	    {"hugepage", no_argument, 0, 'g'},
+	    {"emulate", required_argument, 0, 'e'},
+	    {"nosleep", no_argument, 0, 'n'},
+	    {"trace", required_argument, 0, 'y'},
 	    {0, 0, 0, 0}};
 
-	while (-1 != (c = getopt_long(argc, argv, "i:s:c:q:d:lbtwvx",
+	while (-1 != (c = getopt_long(argc, argv, "i:s:c:q:d:k:m:z:e:y:lbtwufopragnjvx",
 				      long_options, &option_index))) {
 
 		switch (c) {
@@ -195,9 +407,59 @@ static bool parse_opt(int argc, char **argv)
 		case 'w':
 			winpart = true;
 			break;
+		case 'u':
+			uring = true;
+			break;
+		case 'f':
+			stdio_dev = true;
+			break;
+		case 'o':
+			direct = true;
+			break;
+		case 'p':
+			mmap_input = true;
+			break;
+		case 'r':
+			trim = true;
+			break;
+		case 'a':
+			ram_input = true;
+			break;
+		case 'g':
+			hugepage = true;
+			break;
+		case 'e':
+			lat_model = lat_dev_model_find(optarg);
+			if (!lat_model) {
+				printf("unknown latency model: %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'n':
+			lat_nosleep = true;
+			break;
+		case 'y':
+			lat_trace = fopen(optarg, "w");
+			if (!lat_trace) {
+				printf("trace open fail: %s\n", optarg);
+				return false;
+			}
+			break;
 		case 'v':
 			verbose = true;
 			break;
+		case 'k':
+			wbd_period = atoi(optarg);
+			break;
+		case 'm':
+			cache_budget = atol(optarg);
+			break;
+		case 'z':
+			delalloc_budget = atol(optarg);
+			break;
+		case 'j':
+			prealloc = true;
+			break;
 		case 'x':
 			puts(VERSION);
 			exit(0);
@@ -232,6 +494,20 @@ int main(int argc, char **argv)
 	if (!test_lwext4_mount(bd, bc))
 		return EXIT_FAILURE;
 
+	if (cache_budget && ext4_cache_resize("/mp/", cache_budget) != EOK) {
+		printf("ext4_cache_resize: fail\n");
+		return EXIT_FAILURE;
+	}
+
+	if (delalloc_budget &&
+	    ext4_cache_delalloc("/mp/", delalloc_budget) != EOK) {
+		printf("ext4_cache_delalloc: fail\n");
+		return EXIT_FAILURE;
+	}
+
+	if (wbd_period && !wbd_start())
+		return EXIT_FAILURE;
+
 	test_lwext4_cleanup();
 
 	if (sbstat)
@@ -248,7 +524,7 @@ int main(int argc, char **argv)
 		free(rw_buff);
 		return EXIT_FAILURE;
 	}
-	if (!test_lwext4_file_test(rw_buff, rw_szie, rw_count)) {
+	if (!test_lwext4_file_test(rw_buff, rw_szie, rw_count, prealloc)) {
 		free(rw_buff);
 		return EXIT_FAILURE;
 	}
@@ -264,12 +540,36 @@ int main(int argc, char **argv)
 	if (cleanup_flag)
 		test_lwext4_cleanup();
 
+	if (trim) {
+		int r = ext4_fstrim("/mp/");
+		if (r != EOK)
+			printf("ext4_fstrim: rc = %d\n", r);
+	}
+
 	if (bstat)
 		test_lwext4_block_stats();
 
+	if (wbd_period)
+		wbd_join();
+
 	if (!test_lwext4_umount())
 		return EXIT_FAILURE;
 
+	if (lat_bd)
+		printf("emulated device time: %" PRIu64 " ms\n",
+		       lat_dev_time(lat_bd) / 1000);
+
+	if (ram_bd && ram_dev_dump(ram_bd, input_name) != EOK) {
+		printf("ram_dev_dump: fail\n");
+		return EXIT_FAILURE;
+	}
+
+	posix_dev_destroy(posix_bd);
+	mmap_dev_destroy(mmap_bd);
+	ram_dev_destroy(ram_bd);
+	lat_dev_destroy(lat_bd);
+	if (lat_trace)
+		fclose(lat_trace);
 	printf("\ntest finished\n");
 	return EXIT_SUCCESS;
 }
@@ -50,6 +50,7 @@
 
 #include <ext4.h>
 #include "../blockdev/linux/file_dev.h"
+#include "../blockdev/linux/ram_dev.h"
 #include "../blockdev/windows/file_windows.h"
 
 
@@ -75,9 +76,15 @@ static bool verbose = false;
 /**@brief   Winpart mode*/
 static bool winpart = false;
 
+/**@brief   RAM disk mode*/
+static bool ram_disk = false;
+
 /**@brief   Blockdev handle*/
 static struct ext4_blockdev *bd;
 
+/**@brief   RAM disk, loaded from the image once*/
+static struct ext4_blockdev *ram_bd;
+
 static bool cache_wb = false;
 
 static char read_buffer[MAX_RW_BUFFER];
@@ -92,6 +99,7 @@ Usage:                                                          \n\
     --verbose   (-v) - verbose mode                             \n\
     --winpart   (-w) - windows_partition mode                   \n\
     --cache_wb  (-c) - cache writeback_mode                     \n\
+    --ram       (-r) - RAM disk loaded from the image           \n\
 \n";
 
 /**@brief   Open file instance descriptor.*/
@@ -302,10 +310,11 @@ static bool parse_opt(int argc, char **argv)
 	    {"verbose", no_argument, 0, 'v'},
 	    {"winpart", no_argument, 0, 'w'},
 	    {"cache_wb", no_argument, 0, 'c'},
+	    {"ram", no_argument, 0, 'r'},
 	    {"version", no_argument, 0, 'x'},
 	    {0, 0, 0, 0}};
 
-	while (-1 != (c = getopt_long(argc, argv, "i:p:vcwx", long_options,
+	while (-1 != (c = getopt_long(argc, argv, "i:p:vcrwx", long_options,
 				      &option_index))) {
 
 		switch (c) {
@@ -324,6 +333,9 @@ static bool parse_opt(int argc, char **argv)
 		case 'w':
 			winpart = true;
 			break;
+		case 'r':
+			ram_disk = true;
+			break;
 		case 'x':
 			puts(VERSION);
 			exit(0);
@@ -380,6 +392,29 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
+static struct ext4_blockdev *ram_disk_open(void)
+{
+	struct ext4_blockdev *rd;
+	FILE *f = fopen(ext4_fname, "rb");
+	long size;
+
+	if (!f)
+		return NULL;
+
+	size = fseek(f, 0, SEEK_END) ? -1 : ftell(f);
+	fclose(f);
+	if (size <= 0)
+		return NULL;
+
+	rd = ram_dev_create(size, 0);
+	if (rd && ram_dev_load(rd, ext4_fname) != EOK) {
+		ram_dev_destroy(rd);
+		rd = NULL;
+	}
+
+	return rd;
+}
+
 static int device_register(const char *p)
 {
 	int dev;
@@ -398,7 +433,13 @@ static int device_register(const char *p)
 
 	} else
 #endif
-	{
+	if (ram_disk) {
+		if (!ram_bd)
+			ram_bd = ram_disk_open();
+		if (!ram_bd)
+			return -1;
+		bd = ram_bd;
+	} else {
 		file_dev_name_set(ext4_fname);
 		bd = file_dev_get();
 	}
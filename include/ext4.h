@@ -84,6 +84,22 @@ typedef struct ext4_file {
 
 	/**@brief   Actual file position.*/
 	uint64_t fpos;
+
+	/**@brief   Delayed allocation: appended data not written yet
+	 *          (@ref ext4_cache_delalloc).*/
+	uint8_t *da_buf;
+
+	/**@brief   Bytes of delayed data.*/
+	size_t da_len;
+
+	/**@brief   Size of the delayed data buffer.*/
+	size_t da_size;
+
+	/**@brief   File offset of the delayed data.*/
+	uint64_t da_off;
+
+	/**@brief   Next file holding delayed data (mount point list).*/
+	struct ext4_file *da_next;
 } ext4_file;
 
 /*****************************DIRECTORY DESCRIPTOR***************************/
@@ -206,6 +222,52 @@ struct ext4_mount_stats {
 int ext4_mount_point_stats(const char *mount_point,
 			   struct ext4_mount_stats *stats);
 
+/**@brief   Block cache stats of a mount point.*/
+struct ext4_mount_cache_stats {
+	/**@brief   Cache size (blocks)*/
+	uint32_t cache_size;
+
+	/**@brief   Capacity of the cache memory pool (bytes,
+	 *          shared caches: pool of all mount points)*/
+	uint64_t cache_bytes;
+
+	/**@brief   Shared cache budget and buffers of all mount points
+	 *          sharing it (blocks, 0 - private cache)*/
+	uint32_t shared_size;
+	uint32_t shared_blocks;
+
+	/**@brief   Buffers in cache, current and maximum*/
+	uint32_t ref_blocks;
+	uint32_t max_ref_blocks;
+
+	/**@brief   Dirty buffers waiting for write-back*/
+	uint32_t dirty_blocks;
+
+	/**@brief   Pinned buffers*/
+	uint32_t pinned_blocks;
+
+	/**@brief   Read-ahead device reads, blocks prefetched
+	 *          and prefetched blocks dropped unused*/
+	uint32_t ra_reads;
+	uint32_t ra_blocks;
+	uint32_t ra_waste;
+
+	/**@brief   Counters per buffer class (@ref ext4_bcache_class)*/
+	struct ext4_bcache_stats cls[EXT4_BCACHE_CLASS_COUNT];
+
+	/**@brief   Counters of all classes summed*/
+	struct ext4_bcache_stats total;
+};
+
+/**@brief   Get mount point block cache stats.
+ *
+ * @param   mount_pount Mount point.
+ * @param   stats Block cache stats.
+ *
+ * @return Standard error code. */
+int ext4_mount_point_cache_stats(const char *mount_point,
+				 struct ext4_mount_cache_stats *stats);
+
 /**@brief   Setup OS lock routines.
  *
  * @param   mount_pount Mount point.
@@ -268,6 +330,109 @@ int ext4_cache_write_back(const char *path, bool on);
  * @return  Standard error code. */
 int ext4_cache_flush(const char *path);
 
+/**@brief   Delayed allocation of appended file data. Appends are held in
+ *          memory buffers of the file descriptors, blocks are allocated
+ *          (as long contiguous runs) when the data is written: on file
+ *          close, cache flush, umount, when the file is read, truncated
+ *          or opened again, or when buffers exceed the budget (the
+ *          largest buffer goes first). Write errors of delayed data are
+ *          returned by the call which writes it.
+ *
+ * @param   path Mount point.
+ * @param   budget Memory of all buffers (bytes), 0 - disabled (delayed
+ *          data is written).
+ *
+ * @return  Standard error code. */
+int ext4_cache_delalloc(const char *path, size_t budget);
+
+/**@brief   Discard (TRIM) all free blocks of the filesystem. Blocks freed
+ *          later are discarded after their transaction commits.
+ *
+ * @param   mount_point Mount point.
+ *
+ * @return  Standard error code (ENOTSUP if the block device has no
+ *          discard function). */
+int ext4_fstrim(const char *mount_point);
+
+/**@brief   Set up a block cache shared by filesystems mounted from
+ *          now on (those with other block size keep a private cache).
+ *          Buffers are evicted from whichever mount point used them
+ *          least recently, but every mount point keeps at least half of
+ *          an equal split of the budget. Mount points sharing the cache
+ *          have to be set up with the same locks
+ *          (@ref ext4_mount_setup_locks).
+ *
+ * @param   budget Cache size in bytes.
+ * @param   block_size Block size of filesystems using the cache.
+ *
+ * @return  Standard error code. */
+int ext4_shared_cache_init(size_t budget, uint32_t block_size);
+
+/**@brief   Release the shared block cache.
+ *
+ * @return  Standard error code (EBUSY - still used by a mount point). */
+int ext4_shared_cache_fini(void);
+
+/**@brief   Resize block cache of a mounted filesystem to a memory
+ *          budget (data and descriptors of cached blocks). Shrinking
+ *          writes back and evicts buffers which do not fit and returns
+ *          memory to the system, buffers in use are released later.
+ *          Shared cache budget is changed for all its mount points.
+ *
+ * @param   mount_pount Mount point.
+ * @param   budget Cache size in bytes.
+ *
+ * @return  Standard error code. */
+int ext4_cache_resize(const char *path, size_t budget);
+
+/**@brief   Background write-back thresholds.*/
+struct ext4_writeback_cfg {
+	/**@brief   Write dirty buffers while more than dirty_ratio
+	 *          percent of the cache is dirty.*/
+	uint32_t dirty_ratio;
+
+	/**@brief   Write buffers dirty for at least max_age_ms
+	 *          (0: no age limit).*/
+	uint32_t max_age_ms;
+
+	/**@brief   Maximum blocks written by one step (0: no limit).*/
+	uint32_t max_blocks;
+};
+
+/**@brief   Pin block group metadata (block bitmap, inode bitmap and
+ *          group descriptor block) in the block cache, until
+ *          @ref ext4_cache_unpin_group or umount.
+ *
+ * @param   mount_pount Mount point.
+ * @param   bgid Block group id.
+ *
+ * @return  Standard error code. */
+int ext4_cache_pin_group(const char *path, uint32_t bgid);
+
+/**@brief   Release block group metadata pinned by
+ *          @ref ext4_cache_pin_group.
+ *
+ * @param   mount_pount Mount point.
+ * @param   bgid Block group id.
+ *
+ * @return  Standard error code. */
+int ext4_cache_unpin_group(const char *path, uint32_t bgid);
+
+/**@brief   One step of background write-back. Intended to be called
+ *          periodically from a separate (daemon) thread while
+ *          write back cache mode is enabled. Operations on the mount
+ *          point are serialized by locks from @ref ext4_mount_setup_locks,
+ *          max_blocks bounds the time the lock is held.
+ *
+ * @param   mount_pount Mount point.
+ * @param   cfg Write-back thresholds.
+ * @param   now_ms Current time (ms, any monotonic origin).
+ *
+ * @return  Standard error code. */
+int ext4_cache_writeback_step(const char *path,
+			      const struct ext4_writeback_cfg *cfg,
+			      uint32_t now_ms);
+
 /********************************FILE OPERATIONS*****************************/
 
 /**@brief   Remove file by path.
@@ -338,6 +503,32 @@ int ext4_fclose(ext4_file *file);
  * @return  Standard error code.*/
 int ext4_ftruncate(ext4_file *file, uint64_t size);
 
+/**@brief   Preallocate file blocks. Holes of the range are allocated as
+ *          unwritten extents: they read zeros and are written later
+ *          without allocator work (extent i-nodes only).
+ *
+ * @param   file File handle.
+ * @param   offset First byte of the range.
+ * @param   len Length of the range (bytes).
+ * @param   flags Preallocation mode:
+ *              @ref EXT4_FALLOC_KEEP_SIZE - file size is not extended
+ *              @ref EXT4_FALLOC_ZERO_RANGE - data of the range is zeroed
+ *
+ * @return  Standard error code, ENOTSUP without extents.*/
+int ext4_fallocate(ext4_file *file, uint64_t offset, uint64_t len,
+		   uint32_t flags);
+
+/**@brief   Punch a hole in the file: blocks of the range are released and
+ *          the range reads zeros (partial blocks are zeroed). The file
+ *          size is not changed, the range is clipped to it.
+ *
+ * @param   file File handle.
+ * @param   offset First byte of the hole.
+ * @param   len Length of the hole (bytes).
+ *
+ * @return  Standard error code.*/
+int ext4_fpunch_hole(ext4_file *file, uint64_t offset, uint64_t len);
+
 /**@brief   Read data from file.
  *
  * @param   file File handle.
@@ -366,8 +557,13 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt);
  *              @ref SEEK_SET
  *              @ref SEEK_CUR
  *              @ref SEEK_END
+ *              @ref SEEK_DATA - next data at or after offset
+ *              @ref SEEK_HOLE - next hole at or after offset (end of
+ *                               file is a hole); unwritten ranges are
+ *                               holes
  *
- * @return  Standard error code.*/
+ * @return  Standard error code, ENXIO for offset past the end of file
+ *          (or no data after it).*/
 int ext4_fseek(ext4_file *file, uint64_t offset, uint32_t origin);
 
 /**@brief   Get file position.
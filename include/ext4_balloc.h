@@ -102,6 +102,18 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 			    ext4_fsblk_t goal,
 			    ext4_fsblk_t *baddr);
 
+/**@brief   Allocate a run of contiguous blocks: the first one like
+ *          ext4_balloc_alloc_block, then the free blocks following it
+ *          (in the same block group).
+ * @param   inode_ref inode reference
+ * @param   goal
+ * @param   baddr first allocated block address
+ * @param   count wanted block count (at least 1), allocated block count
+ * @return  standard error code (nothing allocated on error)*/
+int ext4_balloc_alloc_blocks(struct ext4_inode_ref *inode_ref,
+			     ext4_fsblk_t goal, ext4_fsblk_t *baddr,
+			     uint32_t *count);
+
 /**@brief   Try allocate selected block.
  * @param   inode_ref inode reference
  * @param   baddr block address to allocate
@@ -110,6 +122,25 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
 				ext4_fsblk_t baddr, bool *free);
 
+#if CONFIG_EXT4_DISCARD_RANGES
+/**@brief   Discard blocks freed by committed transactions.
+ * @param   fs filesystem descriptor*/
+void ext4_balloc_discard_issue(struct ext4_fs *fs);
+
+/**@brief   Forget blocks queued for discard (transaction abort).
+ * @param   fs filesystem descriptor*/
+void ext4_balloc_discard_drop(struct ext4_fs *fs);
+#else
+#define ext4_balloc_discard_issue(fs) ((void)(fs))
+#define ext4_balloc_discard_drop(fs) ((void)(fs))
+#endif
+
+/**@brief   Discard all free blocks of the filesystem.
+ * @param   fs filesystem descriptor
+ * @param   trimmed discarded block count (may be NULL)
+ * @return  standard error code*/
+int ext4_balloc_trim(struct ext4_fs *fs, uint64_t *trimmed);
+
 #ifdef __cplusplus
 }
 #endif
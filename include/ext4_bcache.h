@@ -65,6 +65,79 @@ struct ext4_block {
 
 struct ext4_bcache;
 
+/**@brief   Buffer class (what kind of block a buffer holds),
+ *          block cache statistics are kept per class.*/
+enum ext4_bcache_class {
+	/**@brief   Group descriptors, xattr blocks, unclassified*/
+	EXT4_BCACHE_CLASS_OTHER = 0,
+	/**@brief   Block and inode bitmaps*/
+	EXT4_BCACHE_CLASS_BITMAP,
+	/**@brief   Inode table*/
+	EXT4_BCACHE_CLASS_ITABLE,
+	/**@brief   Directory blocks (linear and htree leaves)*/
+	EXT4_BCACHE_CLASS_DIR,
+	/**@brief   Htree index blocks*/
+	EXT4_BCACHE_CLASS_DIR_INDEX,
+	/**@brief   Extent tree and indirect blocks*/
+	EXT4_BCACHE_CLASS_EXTENT,
+	/**@brief   Journal blocks*/
+	EXT4_BCACHE_CLASS_JOURNAL,
+	/**@brief   File data*/
+	EXT4_BCACHE_CLASS_DATA,
+	EXT4_BCACHE_CLASS_COUNT
+};
+
+/**@brief   Retention priorities of unreferenced buffers. A buffer of
+ *          higher priority stays in the cache as if it was accessed
+ *          (cache size / 2) times later per priority level.*/
+#define EXT4_BCACHE_PRIO_LOW	0
+#define EXT4_BCACHE_PRIO_NORMAL	1
+#define EXT4_BCACHE_PRIO_HIGH	2
+
+/**@brief   Block cache counters of one buffer class*/
+struct ext4_bcache_stats {
+	/**@brief   Cached reads served without device access*/
+	uint32_t hits;
+
+	/**@brief   Cached reads that went to the device*/
+	uint32_t misses;
+
+	/**@brief   Buffers evicted by cache shake*/
+	uint32_t evictions;
+
+	/**@brief   Evicted buffers that had to be written first*/
+	uint32_t dirty_evictions;
+
+	/**@brief   Buffers written to the device*/
+	uint32_t flushes;
+
+	/**@brief   Hits on buffers filled by read-ahead*/
+	uint32_t ra_hits;
+};
+
+/**@brief   Memory pool segment: descriptors and data buffers of up to
+ *          CONFIG_BLOCK_DEV_CACHE_SEG_SIZE buffers in one allocation*/
+struct ext4_bcache_seg {
+	/**@brief   Descriptors*/
+	struct ext4_buf *bufs;
+
+	/**@brief   Data buffers (CONFIG_BLOCK_DEV_CACHE_ALIGN aligned)*/
+	uint8_t *data;
+
+	/**@brief   Buffer count*/
+	uint32_t cnt;
+
+	/**@brief   Buffers taken from this segment*/
+	uint32_t used;
+
+	/**@brief   Segment is released once its last buffer is freed,
+	 *          its buffers are not reused.*/
+	bool retired;
+
+	/**@brief   Segment list node*/
+	SLIST_ENTRY(ext4_bcache_seg) node;
+};
+
 /**@brief   Single block descriptor*/
 struct ext4_buf {
 	/**@brief   Flags*/
@@ -76,12 +149,21 @@ struct ext4_buf {
 	/**@brief   Data buffer.*/
 	uint8_t *data;
 
-	/**@brief   LRU priority. (unused) */
+	/**@brief   Memory pool segment (NULL - allocated from heap).*/
+	struct ext4_bcache_seg *seg;
+
+	/**@brief   Retention priority (EXT4_BCACHE_PRIO_*).*/
 	uint32_t lru_prio;
 
 	/**@brief   LRU id.*/
 	uint32_t lru_id;
 
+	/**@brief   Replacement policy queue the buffer belongs to.*/
+	uint8_t lru_queue;
+
+	/**@brief   Buffer class (@ref ext4_bcache_class).*/
+	uint8_t cls;
+
 	/**@brief   Reference count table*/
 	uint32_t refctr;
 
@@ -91,6 +173,9 @@ struct ext4_buf {
 	/**@brief   Whether or not buffer is on dirty list.*/
 	bool on_dirty_list;
 
+	/**@brief   Write-back clock value when buffer became dirty.*/
+	uint32_t dirty_time;
+
 	/**@brief   LBA tree node*/
 	RB_ENTRY(ext4_buf) lba_node;
 
@@ -100,6 +185,9 @@ struct ext4_buf {
 	/**@brief   Dirty list node*/
 	SLIST_ENTRY(ext4_buf) dirty_node;
 
+	/**@brief   Free list node (unused pool buffers)*/
+	SLIST_ENTRY(ext4_buf) free_node;
+
 	/**@brief   Callback routine after a disk-write operation.
 	 * @param   bc block cache descriptor
 	 * @param   buf buffer descriptor
@@ -114,6 +202,55 @@ struct ext4_buf {
 	void *end_write_arg;
 };
 
+/**@brief   Single slot of the LBA hash index*/
+struct ext4_buf_hent {
+	/**@brief   Logical block address (valid only if buf != NULL)*/
+	uint64_t lba;
+
+	/**@brief   Buffer descriptor (NULL - slot is empty)*/
+	struct ext4_buf *buf;
+};
+
+/**@brief   Ghost entry: LBA recently evicted from the 2Q A1in queue*/
+struct ext4_buf_ghost {
+	/**@brief   Logical block address*/
+	uint64_t lba;
+
+	/**@brief   Eviction sequence number (0 - entry is empty)*/
+	uint32_t seq;
+};
+
+/**@brief   Block cache memory pool*/
+struct ext4_bcache_pool {
+	/**@brief   Segments (retired ones included)*/
+	SLIST_HEAD(ext4_bcache_segs, ext4_bcache_seg) segs;
+
+	/**@brief   Buffer count (retired segments excluded)*/
+	uint32_t cnt;
+
+	/**@brief   Data buffer size*/
+	uint32_t itemsize;
+
+	/**@brief   A singly-linked list holding unused buffers
+	 *          (of segments which are not retired)*/
+	SLIST_HEAD(ext4_buf_free, ext4_buf) free_list;
+};
+
+/**@brief   Buffer replacement policy of block cache*/
+enum ext4_bcache_policy {
+	/**@brief   Least recently used buffer is evicted first.*/
+	EXT4_BCACHE_POLICY_LRU = 0,
+
+	/**@brief   2Q: first references age in a FIFO (A1in), a buffer
+	 *          re-referenced shortly after its eviction from the FIFO
+	 *          is moved to the LRU queue (Am). Sequential scans can
+	 *          therefore only push out other once-used buffers.*/
+	EXT4_BCACHE_POLICY_2Q = 1,
+};
+
+struct ext4_bcache_policy_ops;
+struct ext4_bcache_shared;
+
 /**@brief   Block cache descriptor*/
 struct ext4_bcache {
 
@@ -132,20 +269,132 @@ struct ext4_bcache {
 	/**@brief   Maximum referenced datablocks*/
 	uint32_t max_ref_blocks;
 
+	/**@brief   Memory pool buffers are taken from
+	 *          (local_pool or the shared cache one)*/
+	struct ext4_bcache_pool *pool;
+
+	/**@brief   Memory pool of a private block cache*/
+	struct ext4_bcache_pool local_pool;
+
+	/**@brief   Buffers taken from the memory pool*/
+	uint32_t pool_allocs;
+
+	/**@brief   Buffers allocated from heap (memory pool exhausted)*/
+	uint32_t heap_allocs;
+
+	/**@brief   Shared cache this block cache belongs to (NULL - private)*/
+	struct ext4_bcache_shared *shared;
+
+	/**@brief   Shared cache member list node*/
+	SLIST_ENTRY(ext4_bcache) shared_node;
+
+	/**@brief   Raw allocation of flush_buf*/
+	void *flush_mem;
+
+	/**@brief   Write-back and read-ahead staging buffer
+	 *          (flush_max blocks, CONFIG_BLOCK_DEV_CACHE_ALIGN aligned)*/
+	uint8_t *flush_buf;
+
+	/**@brief   Maximum blocks coalesced into one write-back request*/
+	uint32_t flush_max;
+
 	/**@brief   The blockdev binded to this block cache*/
 	struct ext4_blockdev *bdev;
 
 	/**@brief   The cache should not be shaked */
 	bool dont_shake;
 
-	/**@brief   A tree holding all bufs*/
+	/**@brief   Zero-copy mode: missing blocks reference device memory
+	 *          (see ext4_block_cache_zero_copy)*/
+	bool zero_copy;
+
+	/**@brief   Buffers mapped to device memory in zero-copy mode*/
+	uint32_t maps;
+
+	/**@brief   Open-addressing hash index of all bufs (by LBA)*/
+	struct ext4_buf_hent *lba_hash;
+
+	/**@brief   Slot count of lba_hash (power of 2)*/
+	uint32_t lba_hash_size;
+
+	/**@brief   Occupied slots in lba_hash*/
+	uint32_t lba_hash_used;
+
+	/**@brief   A tree holding all bufs (ordered by LBA)*/
 	RB_HEAD(ext4_buf_lba, ext4_buf) lba_root;
 
-	/**@brief   A tree holding unreferenced bufs*/
+	/**@brief   Buffer replacement policy (@ref ext4_bcache_policy)*/
+	enum ext4_bcache_policy policy;
+
+	/**@brief   Buffer replacement policy operations*/
+	const struct ext4_bcache_policy_ops *policy_ops;
+
+	/**@brief   A tree holding unreferenced bufs
+	 *          (LRU: all of them, 2Q: bufs of Am queue)*/
 	RB_HEAD(ext4_buf_lru, ext4_buf) lru_root;
 
+	/**@brief   2Q: a tree holding unreferenced bufs of A1in queue*/
+	RB_HEAD(ext4_buf_fifo, ext4_buf) fifo_root;
+
+	/**@brief   2Q: bufs (referenced or not) in A1in queue*/
+	uint32_t fifo_cnt;
+
+	/**@brief   2Q: A1in queue target size*/
+	uint32_t fifo_max;
+
+	/**@brief   2Q: direct-mapped table of A1out ghost entries*/
+	struct ext4_buf_ghost *ghost;
+
+	/**@brief   2Q: slot count of ghost table (power of 2)*/
+	uint32_t ghost_size;
+
+	/**@brief   2Q: A1in eviction counter*/
+	uint32_t ghost_seq;
+
 	/**@brief   A singly-linked list holding dirty buffers*/
 	SLIST_HEAD(ext4_buf_dirty, ext4_buf) dirty_list;
+
+	/**@brief   Buffers on dirty list*/
+	uint32_t dirty_cnt;
+
+	/**@brief   Write-back clock (ms), advanced by
+	 *          ext4_block_cache_drain*/
+	uint32_t wb_clock;
+
+	/**@brief   Counters per buffer class*/
+	struct ext4_bcache_stats stats[EXT4_BCACHE_CLASS_COUNT];
+
+	/**@brief   Pinned buffers*/
+	uint32_t pinned_cnt;
+};
+
+/**@brief   Block cache shared by several block devices: one memory
+ *          pool and one budget for all member caches (see
+ *          ext4_bcache_init_shared). Buffers are still indexed per
+ *          device (by member caches), eviction order is global: members
+ *          share the LRU clock and the oldest victim among members
+ *          above their fair share is evicted first.
+ *
+ *          Any member may write back and evict buffers of the others,
+ *          so all of them must be serialized by the same lock.*/
+struct ext4_bcache_shared {
+	/**@brief   Budget (buffers of all members)*/
+	uint32_t cnt;
+
+	/**@brief   Buffers of all members*/
+	uint32_t ref_blocks;
+
+	/**@brief   Shared LRU clock*/
+	uint32_t lru_ctr;
+
+	/**@brief   Member count*/
+	uint32_t members;
+
+	/**@brief   Memory pool*/
+	struct ext4_bcache_pool pool;
+
+	/**@brief   Member caches*/
+	SLIST_HEAD(ext4_bcache_members, ext4_bcache) member_list;
 };
 
 /**@brief buffer state bits
@@ -156,12 +405,24 @@ struct ext4_bcache {
  *              when no one references it.
  *  - BC_TMP: Buffer will be dropped once its refctr
  *            reaches zero.
+ *  - BC_PREFETCH: Buffer was filled by read-ahead and
+ *                 has not been requested yet.
+ *  - BC_PINNED: Buffer holds one extra reference and
+ *               is never evicted, until unpinned.
+ *  - BC_MAPPED: Buffer data references device memory
+ *               (zero-copy mode), it must not be modified.
+ *  - BC_FUA: Buffer is written with forced unit access
+ *            (durable once written, e.g. journal commit block).
  */
 enum bcache_state_bits {
 	BC_UPTODATE,
 	BC_DIRTY,
 	BC_FLUSH,
-	BC_TMP
+	BC_TMP,
+	BC_PREFETCH,
+	BC_PINNED,
+	BC_MAPPED,
+	BC_FUA
 };
 
 #define ext4_bcache_set_flag(buf, b)    \
@@ -174,6 +435,9 @@ enum bcache_state_bits {
 	(((buf)->flags & (1 << (b))) >> (b))
 
 static inline void ext4_bcache_set_dirty(struct ext4_buf *buf) {
+	if (!ext4_bcache_test_flag(buf, BC_DIRTY))
+		buf->dirty_time = buf->bc->wb_clock;
+
 	ext4_bcache_set_flag(buf, BC_UPTODATE);
 	ext4_bcache_set_flag(buf, BC_DIRTY);
 }
@@ -197,6 +461,7 @@ ext4_bcache_insert_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
 	if (!buf->on_dirty_list) {
 		SLIST_INSERT_HEAD(&bc->dirty_list, buf, dirty_node);
 		buf->on_dirty_list = true;
+		bc->dirty_cnt++;
 	}
 }
 
@@ -208,11 +473,42 @@ ext4_bcache_remove_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
 	if (buf->on_dirty_list) {
 		SLIST_REMOVE(&bc->dirty_list, buf, ext4_buf, dirty_node);
 		buf->on_dirty_list = false;
+		bc->dirty_cnt--;
 	}
 }
 
+/**@brief   Buffer may be merged into a write-back run
+ *          (on dirty list, dirty and up-to-date).
+ * @param   buf buffer descriptor */
+static inline bool ext4_bcache_buf_flushable(struct ext4_buf *buf) {
+	return buf->on_dirty_list &&
+	       ext4_bcache_test_flag(buf, BC_DIRTY) &&
+	       ext4_bcache_test_flag(buf, BC_UPTODATE);
+}
+
+/**@brief   Buffer can be merged with its neighbours into one write
+ *          (forced unit access buffers are written alone).*/
+static inline bool ext4_bcache_buf_mergeable(struct ext4_buf *buf) {
+	return ext4_bcache_buf_flushable(buf) &&
+	       !ext4_bcache_test_flag(buf, BC_FUA);
+}
+
+/**@brief   Sort dirty cache list by LBA (ascending).
+ * @param   bc block cache descriptor */
+void ext4_bcache_sort_dirty(struct ext4_bcache *bc);
+
+/**@brief   Collect mergeable buffers holding consecutive LBAs
+ *          around given buffer (at most bc->flush_max of them).
+ * @param   bc block cache descriptor
+ * @param   buf mergeable buffer descriptor
+ * @param   run output array, ascending LBA order
+ * @return  buffer count stored in run*/
+uint32_t ext4_bcache_dirty_run(struct ext4_bcache *bc, struct ext4_buf *buf,
+			       struct ext4_buf **run);
 
 /**@brief   Dynamic initialization of block cache.
+ *          Buffer replacement policy is set by
+ *          CONFIG_BLOCK_DEV_CACHE_POLICY.
  * @param   bc block cache descriptor
  * @param   cnt items count in block cache
  * @param   itemsize single item size (in bytes)
@@ -220,6 +516,74 @@ ext4_bcache_remove_dirty_node(struct ext4_bcache *bc, struct ext4_buf *buf) {
 int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
 			     uint32_t itemsize);
 
+/**@brief   Dynamic initialization of block cache with given
+ *          buffer replacement policy.
+ * @param   bc block cache descriptor
+ * @param   cnt items count in block cache
+ * @param   itemsize single item size (in bytes)
+ * @param   policy buffer replacement policy
+ * @return  standard error code*/
+int ext4_bcache_init_dynamic2(struct ext4_bcache *bc, uint32_t cnt,
+			      uint32_t itemsize,
+			      enum ext4_bcache_policy policy);
+
+/**@brief   Initialization of a shared block cache.
+ * @param   sc shared block cache descriptor
+ * @param   cnt budget (buffers of all members)
+ * @param   itemsize single item size (in bytes)
+ * @return  standard error code*/
+int ext4_bcache_shared_init(struct ext4_bcache_shared *sc, uint32_t cnt,
+			    uint32_t itemsize);
+
+/**@brief   De-initialization of a shared block cache.
+ * @param   sc shared block cache descriptor
+ * @return  standard error code (EBUSY - cache has members)*/
+int ext4_bcache_shared_fini(struct ext4_bcache_shared *sc);
+
+/**@brief   Initialization of a block cache taking its buffers from
+ *          a shared cache. It is bound to a block device by
+ *          ext4_block_bind_bcache and released by
+ *          ext4_bcache_fini_dynamic, like private ones.
+ * @param   bc block cache descriptor
+ * @param   sc shared block cache descriptor
+ * @param   policy buffer replacement policy
+ * @return  standard error code*/
+int ext4_bcache_init_shared(struct ext4_bcache *bc,
+			    struct ext4_bcache_shared *sc,
+			    enum ext4_bcache_policy policy);
+
+/**@brief   Reference device memory from a buffer instead of its own
+ *          data (zero-copy mode). The buffer becomes up-to-date and
+ *          gets its own memory back when it is dropped.
+ * @param   bc block cache descriptor
+ * @param   buf buffer
+ * @param   data device memory holding the block*/
+void ext4_bcache_map(struct ext4_bcache *bc, struct ext4_buf *buf,
+		     void *data);
+
+/**@brief   Member cache whose buffer should be evicted next to make
+ *          room in the shared cache of @p bc (@p bc itself if it is
+ *          a private cache).
+ * @param   bc block cache descriptor
+ * @return  block cache descriptor (NULL - no unreferenced buffer)*/
+struct ext4_bcache *ext4_bcache_victim_cache(struct ext4_bcache *bc);
+
+/**@brief   Change block cache capacity. Growing adds memory pool
+ *          segments. Shrinking retires the least used segments: their
+ *          unreferenced buffers are written back (if dirty) and dropped,
+ *          referenced ones release the segment when freed. Buffers above
+ *          the new capacity are left to the caller
+ *          (see ext4_block_cache_resize). Member of a shared cache
+ *          resizes the shared budget.
+ * @param   bc block cache descriptor
+ * @param   cnt new items count in block cache
+ * @return  standard error code*/
+int ext4_bcache_resize(struct ext4_bcache *bc, uint32_t cnt);
+
+/**@brief   Release all pinned buffers.
+ * @param   bc block cache descriptor.*/
+void ext4_bcache_unpin_all(struct ext4_bcache *bc);
+
 /**@brief   Do cleanup works on block cache.
  * @param   bc block cache descriptor.*/
 void ext4_bcache_cleanup(struct ext4_bcache *bc);
@@ -229,9 +593,18 @@ void ext4_bcache_cleanup(struct ext4_bcache *bc);
  * @return  standard error code*/
 int ext4_bcache_fini_dynamic(struct ext4_bcache *bc);
 
-/**@brief   Get a buffer with the lowest LRU counter in bcache.
+/**@brief   Look up the buffer of an LBA. No reference is taken and the
+ *          buffer replacement policy is not updated.
+ * @param   bc block cache descriptor
+ * @param   lba logical block address
+ * @return  buffer (NULL if the block is not cached)*/
+struct ext4_buf *ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba);
+
+/**@brief   Get the unreferenced buffer which should be evicted next,
+ *          according to the buffer replacement policy (with LRU policy
+ *          it is the buffer with the lowest LRU counter).
  * @param   bc block cache descriptor
- * @return  buffer with the lowest LRU counter*/
+ * @return  buffer to evict (NULL if all buffers are referenced)*/
 struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc);
 
 /**@brief   Drop unreferenced buffer from bcache.
@@ -254,9 +627,15 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
 				uint64_t from,
 				uint32_t cnt);
 
+/**@brief   Find the first dirty buffer of a range.
+ * @param   bc block cache descriptor
+ * @param   from starting lba
+ * @param   cnt block count
+ * @return  dirty buffer or NULL*/
+struct ext4_buf *ext4_bcache_find_dirty(struct ext4_bcache *bc,
+					uint64_t from, uint32_t cnt);
+
 /**@brief   Find existing buffer from block cache memory.
- *          Unreferenced block allocation is based on LRU
- *          (Last Recently Used) algorithm.
  * @param   bc block cache descriptor
  * @param   b block to alloc
  * @param   lba logical block address
@@ -266,8 +645,8 @@ ext4_bcache_find_get(struct ext4_bcache *bc, struct ext4_block *b,
 		     uint64_t lba);
 
 /**@brief   Allocate block from block cache memory.
- *          Unreferenced block allocation is based on LRU
- *          (Last Recently Used) algorithm.
+ *          Unreferenced block allocation is based on the buffer
+ *          replacement policy of the cache.
  * @param   bc block cache descriptor
  * @param   b block to alloc
  * @param   is_new block is new (needs to be read)
@@ -46,6 +46,93 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
+/**@brief   Scatter-gather I/O segment*/
+struct ext4_blockdev_iovec {
+	/**@brief   First block id (physical)*/
+	uint64_t blk_id;
+
+	/**@brief   Block count (physical)*/
+	uint32_t blk_cnt;
+
+	/**@brief   Data buffer (blk_cnt * ph_bsize bytes)*/
+	void *buf;
+};
+
+struct ext4_blockdev;
+
+/**@brief   Histogram buckets: bucket i counts values in (2^(i-1), 2^i]
+ *          (bucket 0: up to 1), the last bucket also counts larger
+ *          values.*/
+#define EXT4_BDEV_HIST_BUCKETS 32
+
+/**@brief   Log-bucketed histogram*/
+struct ext4_bdev_hist {
+	/**@brief   Sample count*/
+	uint64_t cnt;
+
+	/**@brief   Sum of samples*/
+	uint64_t sum;
+
+	/**@brief   Largest sample*/
+	uint64_t max;
+
+	/**@brief   Sample count per bucket*/
+	uint64_t bucket[EXT4_BDEV_HIST_BUCKETS];
+};
+
+/**@brief   Block device operations (statistics index)*/
+enum ext4_bdev_op {
+	EXT4_BDEV_OP_READ,
+	EXT4_BDEV_OP_WRITE,
+	EXT4_BDEV_OP_FLUSH,
+	EXT4_BDEV_OP_DISCARD,
+	EXT4_BDEV_OP_COUNT
+};
+
+/**@brief   Block device statistics*/
+struct ext4_blockdev_stats {
+	/**@brief   Device call latency (us) of synchronous operations*/
+	struct ext4_bdev_hist lat[EXT4_BDEV_OP_COUNT];
+
+	/**@brief   Time from submit to completion (us) of asynchronous
+	 *          reads and writes*/
+	struct ext4_bdev_hist queue[2];
+
+	/**@brief   Request size (bytes) of reads and writes*/
+	struct ext4_bdev_hist size[2];
+};
+
+/**@brief   Asynchronous I/O request*/
+struct ext4_blockdev_req {
+	/**@brief   Write (true) or read (false) request*/
+	bool write;
+
+	/**@brief   Transferred blocks (physical)*/
+	struct ext4_blockdev_iovec seg;
+
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	/**@brief   Submit time (us)*/
+	uint64_t stamp;
+#endif
+
+	/**@brief   Completion routine, called from the poll callback
+	 *          (through ext4_block_aio_complete).
+	 * @param   bdev block device
+	 * @param   req request
+	 * @param   res standard error code of the transfer*/
+	void (*end_io)(struct ext4_blockdev *bdev,
+		       struct ext4_blockdev_req *req, int res);
+
+	/**@brief   Argument of end_io*/
+	void *arg;
+
+	/**@brief   Block device which issued the request*/
+	struct ext4_blockdev *bdev;
+
+	/**@brief   Free request list node*/
+	SLIST_ENTRY(ext4_blockdev_req) node;
+};
+
 struct ext4_blockdev_iface {
 	/**@brief   Open device function
 	 * @param   bdev block device.*/
@@ -66,10 +153,81 @@ struct ext4_blockdev_iface {
 	int (*bwrite)(struct ext4_blockdev *bdev, const void *buf,
 		      uint64_t blk_id, uint32_t blk_cnt);
 
+	/**@brief   Block write function with forced unit access: blocks
+	 *          are durable when the function returns. Not mandatory
+	 *          field (bwrite followed by flush).
+	 * @param   buf input buffer
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count*/
+	int (*bwrite_fua)(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t blk_id, uint32_t blk_cnt);
+
+	/**@brief   Make all finished writes durable (write cache flush).
+	 *          Not mandatory field (no volatile write cache).
+	 * @param   bdev block device.*/
+	int (*flush)(struct ext4_blockdev *bdev);
+
+	/**@brief   Discard (TRIM) blocks: the device may drop their content.
+	 *          Not mandatory field (discard requests are ignored).
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count*/
+	int (*discard)(struct ext4_blockdev *bdev, uint64_t blk_id,
+		       uint64_t blk_cnt);
+
 	/**@brief   Close device function.
 	 * @param   bdev block device.*/
 	int (*close)(struct ext4_blockdev *bdev);
 
+	/**@brief   Vectored block read function. Segments are sorted by
+	 *          block id and do not overlap. Not mandatory field
+	 *          (bread is called for each segment).
+	 * @param   bdev block device
+	 * @param   iov segments
+	 * @param   iovcnt segment count*/
+	int (*breadv)(struct ext4_blockdev *bdev,
+		      const struct ext4_blockdev_iovec *iov, uint32_t iovcnt);
+
+	/**@brief   Vectored block write function. Segments are sorted by
+	 *          block id and do not overlap. Not mandatory field
+	 *          (bwrite is called for each segment).
+	 * @param   bdev block device
+	 * @param   iov segments
+	 * @param   iovcnt segment count*/
+	int (*bwritev)(struct ext4_blockdev *bdev,
+		       const struct ext4_blockdev_iovec *iov, uint32_t iovcnt);
+
+	/**@brief   Queue asynchronous request (it may be issued only by
+	 *          the next poll). Not mandatory field (requests are
+	 *          executed synchronously by bread/bwrite), used only with
+	 *          CONFIG_BLOCK_DEV_ENABLE_AIO. At most
+	 *          CONFIG_BLOCK_DEV_AIO_DEPTH requests are in flight.
+	 * @param   bdev block device
+	 * @param   req request*/
+	int (*submit)(struct ext4_blockdev *bdev,
+		      struct ext4_blockdev_req *req);
+
+	/**@brief   Issue queued requests and wait until at least
+	 *          @p min_done of them are finished. Every finished request
+	 *          is passed to ext4_block_aio_complete (of its issuing
+	 *          block device, req->bdev). Mandatory if
+	 *          submit is set.
+	 * @param   bdev block device
+	 * @param   min_done minimum finished requests*/
+	int (*poll)(struct ext4_blockdev *bdev, uint32_t min_done);
+
+	/**@brief   Device memory holding blocks (e.g. a memory mapped
+	 *          image), valid until close. Not mandatory field (enables
+	 *          zero-copy block cache, see ext4_block_cache_zero_copy).
+	 *          The memory is modified temporarily by checksum checks,
+	 *          it must not be shared with the device (e.g. use a
+	 *          copy-on-write mapping).
+	 * @param   bdev block device
+	 * @param   blk_id block id
+	 * @param   blk_cnt block count
+	 * @return  device memory, NULL if the blocks are not mapped*/
+	void *(*bmap)(struct ext4_blockdev *bdev, uint64_t blk_id,
+		      uint32_t blk_cnt);
+
 	/**@brief   Lock block device. Required in multi partition mode
 	 *          operations. Not mandatory field.
 	 * @param   bdev block device.*/
@@ -97,6 +255,24 @@ struct ext4_blockdev_iface {
 
 	/**@brief   Physical write counter*/
 	uint32_t bwrite_ctr;
+
+	/**@brief   Write cache flush counter*/
+	uint32_t flush_ctr;
+
+	/**@brief   Discard request counter*/
+	uint32_t discard_ctr;
+
+	/**@brief   Writes finished since the last write cache flush*/
+	bool flush_pending;
+
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	/**@brief   Microsecond clock, latencies are not measured without.
+	 *          Not mandatory field (see ext4_block_stats_clock).*/
+	uint64_t (*now_us)(void);
+
+	/**@brief   Latency and size histograms*/
+	struct ext4_blockdev_stats stats;
+#endif
 };
 
 /**@brief   Definition of the simple block device.*/
@@ -122,6 +298,39 @@ struct ext4_blockdev {
 	/**@brief   Cache write back mode reference counter*/
 	uint32_t cache_write_back;
 
+	/**@brief   Read-ahead: next LBA of a sequential reader*/
+	uint64_t ra_next;
+
+	/**@brief   Read-ahead: current window (0: random access)*/
+	uint32_t ra_win;
+
+	/**@brief   Read-ahead: device reads issued*/
+	uint32_t ra_reads;
+
+	/**@brief   Read-ahead: blocks prefetched*/
+	uint32_t ra_blocks;
+
+	/**@brief   Read-ahead: prefetched blocks requested later*/
+	uint32_t ra_hits;
+
+	/**@brief   Read-ahead: prefetched blocks dropped unused*/
+	uint32_t ra_waste;
+
+	/**@brief   Asynchronous I/O: requests in flight*/
+	uint32_t aio_inflight;
+
+	/**@brief   Asynchronous I/O: first error since last
+	 *          ext4_block_aio_wait*/
+	int aio_err;
+
+#if CONFIG_BLOCK_DEV_ENABLE_AIO
+	/**@brief   Asynchronous I/O: free requests*/
+	SLIST_HEAD(ext4_blockdev_reqs, ext4_blockdev_req) aio_free;
+
+	/**@brief   Asynchronous I/O: request pool*/
+	struct ext4_blockdev_req aio_reqs[CONFIG_BLOCK_DEV_AIO_DEPTH];
+#endif
+
 	/**@brief   The filesystem this block device belongs to. */
 	struct ext4_fs *fs;
 
@@ -131,12 +340,63 @@ struct ext4_blockdev {
 /**@brief   Static initialization of the block device.*/
 #define EXT4_BLOCKDEV_STATIC_INSTANCE(__name, __bsize, __bcnt, __open, __bread,\
 				      __bwrite, __close, __lock, __unlock)     \
+	EXT4_BLOCKDEV_STATIC_INSTANCE2(__name, __bsize, __bcnt, __open,        \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, 0, 0)
+
+/**@brief   Static initialization of the block device with vectored
+ *          read/write functions.*/
+#define EXT4_BLOCKDEV_STATIC_INSTANCE2(__name, __bsize, __bcnt, __open,       \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev)          \
+	EXT4_BLOCKDEV_STATIC_INSTANCE3(__name, __bsize, __bcnt, __open,        \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev, 0, 0)
+
+/**@brief   Static initialization of the block device with vectored
+ *          and asynchronous functions.*/
+#define EXT4_BLOCKDEV_STATIC_INSTANCE3(__name, __bsize, __bcnt, __open,       \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev,          \
+				       __submit, __poll)                       \
+	EXT4_BLOCKDEV_STATIC_INSTANCE4(__name, __bsize, __bcnt, __open,        \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev,          \
+				       __submit, __poll, 0, 0)
+
+/**@brief   Static initialization of the block device with vectored,
+ *          asynchronous and write cache control functions.*/
+#define EXT4_BLOCKDEV_STATIC_INSTANCE4(__name, __bsize, __bcnt, __open,       \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev,          \
+				       __submit, __poll, __bwrite_fua,         \
+				       __flush)                                \
+	EXT4_BLOCKDEV_STATIC_INSTANCE5(__name, __bsize, __bcnt, __open,        \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev,          \
+				       __submit, __poll, __bwrite_fua,         \
+				       __flush, 0)
+
+/**@brief   Static initialization of the block device with vectored,
+ *          asynchronous, write cache control and discard functions.*/
+#define EXT4_BLOCKDEV_STATIC_INSTANCE5(__name, __bsize, __bcnt, __open,       \
+				       __bread, __bwrite, __close, __lock,     \
+				       __unlock, __breadv, __bwritev,          \
+				       __submit, __poll, __bwrite_fua,         \
+				       __flush, __discard)                     \
 	static uint8_t __name##_ph_bbuf[(__bsize)];                            \
 	static struct ext4_blockdev_iface __name##_iface = {                   \
 		.open = __open,                                                \
 		.bread = __bread,                                              \
 		.bwrite = __bwrite,                                            \
 		.close = __close,                                              \
+		.breadv = __breadv,                                            \
+		.bwritev = __bwritev,                                          \
+		.submit = __submit,                                            \
+		.poll = __poll,                                                \
+		.bwrite_fua = __bwrite_fua,                                    \
+		.flush = __flush,                                              \
+		.discard = __discard,                                          \
 		.lock = __lock,                                                \
 		.unlock = __unlock,                                            \
 		.ph_bsize = __bsize,                                           \
@@ -202,6 +462,40 @@ int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
 		   uint64_t lba);
 
+/**@brief   Block get function (through cache, don't read),
+ *          buffer class given.
+ * @param   bdev block device descriptor
+ * @param   b block descriptor
+ * @param   lba logical block address
+ * @param   cls buffer class (@ref ext4_bcache_class)
+ * @return  standard error code*/
+int ext4_block_get_noread2(struct ext4_blockdev *bdev, struct ext4_block *b,
+			   uint64_t lba, enum ext4_bcache_class cls);
+
+/**@brief   Block get function (through cache), buffer class given.
+ * @param   bdev block device descriptor
+ * @param   b block descriptor
+ * @param   lba logical block address
+ * @param   cls buffer class (@ref ext4_bcache_class)
+ * @return  standard error code*/
+int ext4_block_get2(struct ext4_blockdev *bdev, struct ext4_block *b,
+		    uint64_t lba, enum ext4_bcache_class cls);
+
+/**@brief   Read block into cache and keep it there until
+ *          @ref ext4_block_unpin (or umount).
+ * @param   bdev block device descriptor
+ * @param   lba logical block address
+ * @param   cls buffer class (@ref ext4_bcache_class)
+ * @return  standard error code*/
+int ext4_block_pin(struct ext4_blockdev *bdev, uint64_t lba,
+		   enum ext4_bcache_class cls);
+
+/**@brief   Release block pinned by @ref ext4_block_pin.
+ * @param   bdev block device descriptor
+ * @param   lba logical block address
+ * @return  standard error code*/
+int ext4_block_unpin(struct ext4_blockdev *bdev, uint64_t lba);
+
 /**@brief   Block set procedure (through cache).
  * @param   bdev block device descriptor
  * @param   b block descriptor
@@ -224,6 +518,62 @@ int ext4_blocks_get_direct(struct ext4_blockdev *bdev, void *buf, uint64_t lba,
 int ext4_blocks_set_direct(struct ext4_blockdev *bdev, const void *buf,
 			   uint64_t lba, uint32_t cnt);
 
+/**@brief   Start asynchronous transfer of logical blocks (without
+ *          cache). Waits for a free request when
+ *          CONFIG_BLOCK_DEV_AIO_DEPTH requests are in flight. Devices
+ *          without submit callback (or without
+ *          CONFIG_BLOCK_DEV_ENABLE_AIO) complete the request right
+ *          away.
+ * @param   bdev block device descriptor
+ * @param   write write (true) or read (false)
+ * @param   lba logical block address
+ * @param   cnt block count
+ * @param   buf data buffer (untouched until completion)
+ * @param   end_io completion routine (may be NULL)
+ * @param   arg argument of end_io
+ * @return  standard error code*/
+int ext4_block_aio_submit(struct ext4_blockdev *bdev, bool write,
+			  uint64_t lba, uint32_t cnt, void *buf,
+			  void (*end_io)(struct ext4_blockdev *bdev,
+					 struct ext4_blockdev_req *req,
+					 int res),
+			  void *arg);
+
+/**@brief   Asynchronous block read (without cache), split into
+ *          requests of at most CONFIG_BLOCK_DEV_AIO_CHUNK bytes.
+ *          Finished by @ref ext4_block_aio_wait.
+ * @param   bdev block device descriptor
+ * @param   buf output buffer
+ * @param   lba logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_blocks_get_async(struct ext4_blockdev *bdev, void *buf,
+			  uint64_t lba, uint32_t cnt);
+
+/**@brief   Asynchronous block write (without cache), split into
+ *          requests of at most CONFIG_BLOCK_DEV_AIO_CHUNK bytes.
+ *          Finished by @ref ext4_block_aio_wait.
+ * @param   bdev block device descriptor
+ * @param   buf input buffer
+ * @param   lba logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_blocks_set_async(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t lba, uint32_t cnt);
+
+/**@brief   Wait for all asynchronous requests of block device.
+ * @param   bdev block device descriptor
+ * @return  first error of requests finished since last call*/
+int ext4_block_aio_wait(struct ext4_blockdev *bdev);
+
+/**@brief   Finish asynchronous request, called by the poll callback
+ *          of block device for every finished request.
+ * @param   bdev block device descriptor
+ * @param   req request
+ * @param   res standard error code of the transfer*/
+void ext4_block_aio_complete(struct ext4_blockdev *bdev,
+			     struct ext4_blockdev_req *req, int res);
+
 /**@brief   Write to block device (by direct address).
  * @param   bdev block device descriptor
  * @param   off byte offset in block device
@@ -242,11 +592,117 @@ int ext4_block_writebytes(struct ext4_blockdev *bdev, uint64_t off,
 int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
 			 uint32_t len);
 
+/**@brief   Read part of a logical block through the block cache.
+ * @param   bdev block device descriptor
+ * @param   lba logical block address
+ * @param   off byte offset in the block
+ * @param   buf output buffer
+ * @param   len length (up to the end of the block)
+ * @return  standard error code*/
+int ext4_block_cache_read(struct ext4_blockdev *bdev, uint64_t lba,
+			  uint32_t off, void *buf, uint32_t len);
+
+/**@brief   Write part of a logical block through the block cache (the
+ *          block becomes dirty and is written with the cache).
+ * @param   bdev block device descriptor
+ * @param   lba logical block address
+ * @param   off byte offset in the block
+ * @param   buf input buffer
+ * @param   len length (up to the end of the block)
+ * @param   fresh new block: not read, zero filled around the data
+ * @return  standard error code*/
+int ext4_block_cache_write(struct ext4_blockdev *bdev, uint64_t lba,
+			   uint32_t off, const void *buf, uint32_t len,
+			   bool fresh);
+
+/**@brief   Write dirty cached blocks of a range, so the device holds
+ *          their data before a direct read.
+ * @param   bdev block device descriptor
+ * @param   lba first logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_block_cache_write_range(struct ext4_blockdev *bdev, uint64_t lba,
+				 uint32_t cnt);
+
 /**@brief   Flush all dirty buffers to disk
  * @param   bdev block device descriptor
  * @return  standard error code*/
 int ext4_block_cache_flush(struct ext4_blockdev *bdev);
 
+/**@brief   Partial flush, one step of background write-back. Writes
+ *          (in LBA order) buffers dirty for at least @p max_age and,
+ *          while more than @p dirty_ratio percent of the cache is
+ *          dirty, any other dirty buffers.
+ * @param   bdev block device descriptor
+ * @param   now current time (ms, any monotonic origin)
+ * @param   dirty_ratio dirty buffers threshold (percent of cache size)
+ * @param   max_age dirty buffer age limit (ms, 0: no limit)
+ * @param   max_cnt maximum buffers written (0: no limit)
+ * @return  standard error code*/
+int ext4_block_cache_drain(struct ext4_blockdev *bdev, uint32_t now,
+			   uint32_t dirty_ratio, uint32_t max_age,
+			   uint32_t max_cnt);
+
+/**@brief   Change block cache capacity at runtime. Shrinking writes
+ *          back and evicts buffers above the new capacity (referenced
+ *          buffers stay until they are released) and gives memory pool
+ *          segments back.
+ * @param   bdev block device descriptor
+ * @param   cnt new block cache capacity (in blocks)
+ * @return  standard error code*/
+int ext4_block_cache_resize(struct ext4_blockdev *bdev, uint32_t cnt);
+
+/**@brief   Write barrier: make all finished writes durable (flush
+ *          callback, skipped if nothing was written since the last
+ *          flush).
+ * @param   bdev block device descriptor
+ * @return  standard error code*/
+int ext4_block_dev_flush(struct ext4_blockdev *bdev);
+
+/**@brief   Discard (TRIM) logical blocks (discard callback, no-op if the
+ *          device has none).
+ * @param   bdev block device descriptor
+ * @param   lba first logical block address
+ * @param   cnt block count
+ * @return  standard error code*/
+int ext4_block_discard(struct ext4_blockdev *bdev, uint64_t lba,
+		       uint64_t cnt);
+
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+/**@brief   Set the clock used to measure device latencies.
+ * @param   bdev block device descriptor
+ * @param   now_us microsecond clock (NULL: sizes only)*/
+void ext4_block_stats_clock(struct ext4_blockdev *bdev,
+			    uint64_t (*now_us)(void));
+
+/**@brief   Snapshot of the block device statistics.
+ * @param   bdev block device descriptor
+ * @param   stats output statistics*/
+void ext4_block_stats_get(struct ext4_blockdev *bdev,
+			  struct ext4_blockdev_stats *stats);
+
+/**@brief   Clear the block device statistics.
+ * @param   bdev block device descriptor*/
+void ext4_block_stats_reset(struct ext4_blockdev *bdev);
+
+/**@brief   Histogram percentile: upper bound of the bucket holding it
+ *          (limited by the largest sample).
+ * @param   hist histogram
+ * @param   permille percentile in tenths of percent (990: p99)
+ * @return  percentile value*/
+uint64_t ext4_block_stats_percentile(const struct ext4_bdev_hist *hist,
+				     uint32_t permille);
+#endif
+
+/**@brief   Zero-copy block cache mode: blocks missing in the cache
+ *          reference device memory (bmap callback) instead of being
+ *          read into cache buffers. Cached blocks must not be modified,
+ *          so the mode is meant for read-only mounts.
+ * @param   bdev block device descriptor
+ * @param   on enable/disable
+ * @return  standard error code (ENOTSUP - no bmap callback)*/
+int ext4_block_cache_zero_copy(struct ext4_blockdev *bdev, bool on);
+
 /**@brief   Enable/disable write back cache mode
  * @param   bdev block device descriptor
  * @param   on_off
@@ -123,6 +123,81 @@ extern "C" {
 #define CONFIG_BLOCK_DEV_CACHE_SIZE 8
 #endif
 
+/**@brief   Cache size of block device in bytes (descriptors included),
+ *          overrides CONFIG_BLOCK_DEV_CACHE_SIZE if not 0. Can be
+ *          changed at runtime by ext4_cache_resize.*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_BUDGET
+#define CONFIG_BLOCK_DEV_CACHE_BUDGET 0
+#endif
+
+/**@brief   Buffers per block device cache memory pool segment
+ *          (granularity of memory released by cache shrinking).*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_SEG_SIZE
+#define CONFIG_BLOCK_DEV_CACHE_SEG_SIZE 256
+#endif
+
+/**@brief   Alignment of block device cache memory pool (power of 2).
+ *          Every pool segment and the write-back staging buffer are
+ *          padded by the alignment - 1 bytes; page alignment (direct
+ *          I/O without bounce copies) is set by the generic target.*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_ALIGN
+#define CONFIG_BLOCK_DEV_CACHE_ALIGN sizeof(void *)
+#endif
+
+/**@brief   Zero-copy block cache on read-only mounts of block devices
+ *          with memory mapped blocks (bmap callback).*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_ZERO_COPY
+#define CONFIG_BLOCK_DEV_CACHE_ZERO_COPY 1
+#endif
+
+/**@brief   Merged ranges of freed blocks waiting for a discard request
+ *          (issued after transaction commit). Zero disables discard of
+ *          freed blocks.*/
+#ifndef CONFIG_EXT4_DISCARD_RANGES
+#define CONFIG_EXT4_DISCARD_RANGES 64
+#endif
+
+/**@brief   Buffer replacement policy of block device cache:
+ *          0 - LRU, 1 - 2Q (see ext4_bcache_policy).*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_POLICY
+#define CONFIG_BLOCK_DEV_CACHE_POLICY 0
+#endif
+
+/**@brief   Maximum number of adjacent dirty blocks merged into one
+ *          write-back request (staging buffer is limited to 1/4 of
+ *          cache size). 1 disables coalescing.*/
+#ifndef CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX
+#define CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX 32
+#endif
+
+/**@brief   Maximum read-ahead window of block device cache (in blocks,
+ *          limited by the staging buffer). 0 disables read-ahead.
+ *          Vectored reads keep one request slot per block on the stack,
+ *          the generic target uses a larger window.*/
+#ifndef CONFIG_BLOCK_DEV_READ_AHEAD
+#define CONFIG_BLOCK_DEV_READ_AHEAD 8
+#endif
+
+/**@brief   Asynchronous I/O through submit/poll callbacks of block
+ *          devices (every block device carries a request pool of
+ *          CONFIG_BLOCK_DEV_AIO_DEPTH). Without it, requests are
+ *          executed synchronously by bread/bwrite.*/
+#ifndef CONFIG_BLOCK_DEV_ENABLE_AIO
+#define CONFIG_BLOCK_DEV_ENABLE_AIO 0
+#endif
+
+/**@brief   Asynchronous I/O requests in flight per block device
+ *          (used by devices with submit/poll callbacks).*/
+#ifndef CONFIG_BLOCK_DEV_AIO_DEPTH
+#define CONFIG_BLOCK_DEV_AIO_DEPTH 32
+#endif
+
+/**@brief   Maximum size (bytes) of one asynchronous request issued
+ *          for large file reads/writes.*/
+#ifndef CONFIG_BLOCK_DEV_AIO_CHUNK
+#define CONFIG_BLOCK_DEV_AIO_CHUNK (128 * 1024)
+#endif
+
 
 /**@brief   Maximum block device name*/
 #ifndef CONFIG_EXT4_MAX_BLOCKDEV_NAME
@@ -281,11 +281,48 @@ static inline void ext4_extent_tree_init(struct ext4_inode_ref *inode_ref)
 
 
 
-/**TODO:  */
+/**@brief Map logical blocks of an extent i-node.
+ * @param inode_ref   I-node
+ * @param iblock      First logical block
+ * @param max_blocks  Maximum block count
+ * @param result      Physical address of the first block, 0 for a hole
+ *                    or an unwritten range (without @p create)
+ * @param create      Allocate holes, initialize unwritten ranges
+ * @param blocks_count Mapped run length (contiguous blocks, or hole up
+ *                    to the next extent), at most @p max_blocks
+ * @return Error code
+ */
 int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 			   uint32_t max_blocks, ext4_fsblk_t *result, bool create,
 			   uint32_t *blocks_count);
 
+/**@brief Map logical blocks which the caller overwrites entirely: as
+ *        @ref ext4_extent_get_blocks with create, but unwritten ranges
+ *        are initialized without zeroing them first.
+ * @param inode_ref   I-node
+ * @param iblock      First logical block
+ * @param max_blocks  Maximum block count
+ * @param result      Physical address of the first block
+ * @param blocks_count Mapped run length, at most @p max_blocks
+ * @return Error code
+ */
+int ext4_extent_init_blocks(struct ext4_inode_ref *inode_ref,
+			    ext4_lblk_t iblock, uint32_t max_blocks,
+			    ext4_fsblk_t *result, uint32_t *blocks_count);
+
+/**@brief Preallocate a run of logical blocks: a hole is allocated as an
+ *        unwritten extent, allocated blocks are kept.
+ * @param inode_ref   I-node
+ * @param iblock      First logical block
+ * @param max_blocks  Maximum block count
+ * @param zero        Convert written blocks of the run to unwritten
+ * @param blocks_count Length of the run handled, at most @p max_blocks
+ * @return Error code
+ */
+int ext4_extent_prealloc(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
+			 uint32_t max_blocks, bool zero,
+			 uint32_t *blocks_count);
+
 
 /**@brief Release all data blocks starting from specified logical block.
  * @param inode_ref   I-node to release blocks from
@@ -53,6 +53,11 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+struct ext4_discard_range {
+	ext4_fsblk_t first;
+	ext4_fsblk_t count;
+};
+
 struct ext4_fs {
 	bool read_only;
 
@@ -67,6 +72,13 @@ struct ext4_fs {
 	struct jbd_fs *jbd_fs;
 	struct jbd_journal *jbd_journal;
 	struct jbd_trans *curr_trans;
+
+#if CONFIG_EXT4_DISCARD_RANGES
+	/*Freed blocks to discard once the freeing transaction commits,
+	 * sorted by first block.*/
+	struct ext4_discard_range discard[CONFIG_EXT4_DISCARD_RANGES];
+	uint32_t discard_cnt;
+#endif
 };
 
 struct ext4_block_group_ref {
@@ -207,6 +219,12 @@ int ext4_fs_alloc_inode(struct ext4_fs *fs, struct ext4_inode_ref *inode_ref,
  */
 int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref);
 
+/**@brief Check for data blocks preallocated past the end of file.
+ * @param inode_ref I-node to check
+ * @return True if an extent maps blocks past the end of file
+ */
+bool ext4_fs_blocks_past_eof(struct ext4_inode_ref *inode_ref);
+
 /**@brief Truncate i-node data blocks.
  * @param inode_ref I-node to be truncated
  * @param new_size  New size of inode (must be < current size)
@@ -241,7 +259,39 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 				 ext4_lblk_t iblock, ext4_fsblk_t *fblock,
 				 bool support_unwritten);
 
-/**@brief Initialize a part of unwritten range of the inode.
+/**@brief Map a run of logical blocks to physically contiguous blocks.
+ *        Extent i-nodes are mapped with one extent lookup.
+ * @param inode_ref I-node to read block addresses from
+ * @param iblock    Logical index of the first block
+ * @param max       Maximum block count (at least 1)
+ * @param fblock    Output pointer for the physical address of the first
+ *                  block, 0 for a hole or an unwritten range
+ * @param count     Output pointer for the block count of the run
+ *                  (at least 1): contiguous blocks, or hole
+ * @return Error code
+ */
+int ext4_fs_get_inode_dblk_range(struct ext4_inode_ref *inode_ref,
+				 ext4_lblk_t iblock, uint32_t max,
+				 ext4_fsblk_t *fblock, uint32_t *count);
+
+/**@brief Map a run of logical blocks like ext4_fs_get_inode_dblk_range,
+ *        allocating holes and initializing unwritten ranges of extent
+ *        i-nodes. The caller overwrites the blocks entirely, unwritten
+ *        ranges are not zeroed.
+ * @param inode_ref I-node to proceed on
+ * @param iblock    Logical index of the first block
+ * @param max       Maximum block count (at least 1)
+ * @param fblock    Output pointer for the physical address of the first
+ *                  block
+ * @param count     Output pointer for the block count of the run
+ * @return Error code
+ */
+int ext4_fs_init_inode_dblk_range(struct ext4_inode_ref *inode_ref,
+				  ext4_lblk_t iblock, uint32_t max,
+				  ext4_fsblk_t *fblock, uint32_t *count);
+
+/**@brief Initialize a part of unwritten range of the inode (a hole is
+ *        allocated).
  * @param inode_ref I-node to proceed on.
  * @param iblock    Logical index of block
  * @param fblock    Output pointer for return physical block address
@@ -259,6 +309,42 @@ int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
 			      ext4_fsblk_t *fblock, ext4_lblk_t *iblock);
 
+/**@brief Append a run of physically contiguous blocks to the i-node
+ *        (one allocation, and one extent insert for extent i-nodes).
+ * @param inode_ref I-node to append blocks to
+ * @param fblock    Output physical address of the first block
+ * @param iblock    Output logical number of the first block
+ * @param count     Wanted block count (at least 1), appended block count
+ *                  (fewer if free space is fragmented)
+ * @return Error code
+ */
+int ext4_fs_append_inode_dblks(struct ext4_inode_ref *inode_ref,
+			       ext4_fsblk_t *fblock, ext4_lblk_t *iblock,
+			       uint32_t *count);
+
+/**@brief Release data blocks of a logical range, the range reads as a
+ *        hole afterwards. The i-node size is not changed.
+ * @param inode_ref I-node to release blocks from
+ * @param iblock    Logical index of the first block
+ * @param count     Block count
+ * @return Error code
+ */
+int ext4_fs_punch_inode_dblks(struct ext4_inode_ref *inode_ref,
+			      ext4_lblk_t iblock, uint32_t count);
+
+/**@brief Preallocate data blocks of an extent i-node: holes of the range
+ *        are allocated as unwritten extents (read as zeros, written
+ *        without allocator work). The i-node size is not changed.
+ * @param inode_ref I-node to preallocate blocks for
+ * @param iblock    Logical index of the first block
+ * @param count     Block count
+ * @param zero      Convert written blocks of the range to unwritten too
+ * @return Error code, ENOTSUP for an i-node without extents
+ */
+int ext4_fs_prealloc_inode_dblks(struct ext4_inode_ref *inode_ref,
+				 ext4_lblk_t iblock, uint32_t count,
+				 bool zero);
+
 /**@brief   Increment inode link count.
  * @param   inode none handle
  */
@@ -92,6 +92,24 @@ extern "C" {
  #include <fcntl.h>
 #endif
 
+/*************************FILE SEEK DATA/HOLE FLAGS*************************/
+
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
+
+/*****************************FILE ALLOCATE FLAGS****************************/
+
+/**@brief   Keep the file size (@ref ext4_fallocate).*/
+#define EXT4_FALLOC_KEEP_SIZE 0x01
+
+/**@brief   Read the range as zeros (@ref ext4_fallocate).*/
+#define EXT4_FALLOC_ZERO_RANGE 0x10
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,7 @@ extern "C" {
 
 #include <ext4_config.h>
 #include <ext4_types.h>
+#include <ext4_bcache.h>
 
 
 /**@brief   Mark a buffer dirty and add it to the current transaction.
@@ -56,10 +57,12 @@ int ext4_trans_set_block_dirty(struct ext4_buf *buf);
  * @param   bdev block device descriptor
  * @param   b block descriptor
  * @param   lba logical block address
+ * @param   cls buffer class (@ref ext4_bcache_class)
  * @return  standard error code*/
 int ext4_trans_block_get_noread(struct ext4_blockdev *bdev,
 			  struct ext4_block *b,
-			  uint64_t lba);
+			  uint64_t lba,
+			  enum ext4_bcache_class cls);
 
 /**@brief   Block get function (through cache).
  *          jbd_trans_get_access would be called in order to
@@ -67,10 +70,12 @@ int ext4_trans_block_get_noread(struct ext4_blockdev *bdev,
  * @param   bdev block device descriptor
  * @param   b block descriptor
  * @param   lba logical block address
+ * @param   cls buffer class (@ref ext4_bcache_class)
  * @return  standard error code*/
 int ext4_trans_block_get(struct ext4_blockdev *bdev,
 		   struct ext4_block *b,
-		   uint64_t lba);
+		   uint64_t lba,
+		   enum ext4_bcache_class cls);
 
 /**@brief  Try to add block to be revoked to the current transaction.
  * @param  bdev block device descriptor
@@ -45,6 +45,7 @@
 #include <ext4_trans.h>
 #include <ext4_blockdev.h>
 #include <ext4_fs.h>
+#include <ext4_balloc.h>
 #include <ext4_dir.h>
 #include <ext4_inode.h>
 #include <ext4_super.h>
@@ -94,6 +95,15 @@ struct ext4_mountpoint {
 
 	/**@brief   Block cache.*/
 	struct ext4_bcache bc;
+
+	/**@brief   Delayed allocation budget (bytes), 0 - disabled.*/
+	size_t da_budget;
+
+	/**@brief   Memory held by delayed allocation buffers.*/
+	size_t da_bytes;
+
+	/**@brief   Files holding delayed data.*/
+	ext4_file *da_files;
 };
 
 /**@brief   Block devices descriptor.*/
@@ -112,6 +122,9 @@ static struct ext4_block_devices s_bdevices[CONFIG_EXT4_BLOCKDEVS_COUNT];
 /**@brief   Mountpoints.*/
 static struct ext4_mountpoint s_mp[CONFIG_EXT4_MOUNTPOINTS_COUNT];
 
+/**@brief   Block cache shared by mount points (cnt == 0 - not set up).*/
+static struct ext4_bcache_shared s_shared_bc;
+
 int ext4_device_register(struct ext4_blockdev *bd,
 			 const char *dev_name)
 {
@@ -359,11 +372,18 @@ static int ext4_unlink(struct ext4_mountpoint *mp,
 
 /****************************************************************************/
 
+/**@brief   Block cache capacity fitting into a memory budget.*/
+static uint32_t ext4_cache_budget_cnt(uint64_t budget, uint32_t bsize)
+{
+	uint64_t cnt = budget / (bsize + sizeof(struct ext4_buf));
+	return cnt > UINT32_MAX ? UINT32_MAX : (uint32_t)cnt;
+}
+
 int ext4_mount(const char *dev_name, const char *mount_point,
 	       bool read_only)
 {
 	int r;
-	uint32_t bsize;
+	uint32_t bsize, cnt;
 	struct ext4_bcache *bc;
 	struct ext4_blockdev *bd = 0;
 	struct ext4_mountpoint *mp = 0;
@@ -419,7 +439,18 @@ int ext4_mount(const char *dev_name, const char *mount_point,
 	ext4_block_set_lb_size(bd, bsize);
 	bc = &mp->bc;
 
-	r = ext4_bcache_init_dynamic(bc, CONFIG_BLOCK_DEV_CACHE_SIZE, bsize);
+	cnt = CONFIG_BLOCK_DEV_CACHE_SIZE;
+	if (CONFIG_BLOCK_DEV_CACHE_BUDGET)
+		cnt = ext4_cache_budget_cnt(CONFIG_BLOCK_DEV_CACHE_BUDGET,
+					    bsize);
+	if (!cnt)
+		cnt = 1;
+
+	if (s_shared_bc.cnt && s_shared_bc.pool.itemsize == bsize)
+		r = ext4_bcache_init_shared(bc, &s_shared_bc,
+					    CONFIG_BLOCK_DEV_CACHE_POLICY);
+	else
+		r = ext4_bcache_init_dynamic(bc, cnt, bsize);
 	if (r != EOK) {
 		ext4_block_fini(bd);
 		return r;
@@ -438,10 +469,19 @@ int ext4_mount(const char *dev_name, const char *mount_point,
 	}
 
 	bd->fs = &mp->fs;
+
+	/*Cached blocks are not modified on read-only mounts*/
+	if (CONFIG_BLOCK_DEV_CACHE_ZERO_COPY && mp->fs.read_only &&
+	    bd->bdif->bmap)
+		r = ext4_block_cache_zero_copy(bd, true);
+
 	return r;
 }
 
 
+static int ext4_delalloc_sync(struct ext4_mountpoint *mp, uint32_t inode,
+			      ext4_file *except);
+
 int ext4_umount(const char *mount_point)
 {
 	int i;
@@ -458,6 +498,13 @@ int ext4_umount(const char *mount_point)
 	if (!mp)
 		return ENODEV;
 
+	/*Delayed data is written, descriptors stay valid*/
+	r = ext4_delalloc_sync(mp, 0, NULL);
+	if (r != EOK)
+		return r;
+
+	mp->da_budget = 0;
+	ext4_bcache_unpin_all(mp->fs.bdev->bc);
 	r = ext4_fs_fini(&mp->fs);
 	if (r != EOK)
 		goto Finish;
@@ -467,6 +514,15 @@ int ext4_umount(const char *mount_point)
 	ext4_bcache_cleanup(mp->fs.bdev->bc);
 	ext4_bcache_fini_dynamic(mp->fs.bdev->bc);
 
+	/*Make the final superblock and cache writes durable*/
+	r = ext4_block_dev_flush(mp->fs.bdev);
+	if (r != EOK) {
+		ext4_balloc_discard_drop(&mp->fs);
+		ext4_block_fini(mp->fs.bdev);
+		goto Finish;
+	}
+
+	ext4_balloc_discard_issue(&mp->fs);
 	r = ext4_block_fini(mp->fs.bdev);
 Finish:
 	mp->fs.bdev->fs = NULL;
@@ -693,20 +749,206 @@ static int ext4_trans_start(struct ext4_mountpoint *mp __unused)
 	return r;
 }
 
-static int ext4_trans_stop(struct ext4_mountpoint *mp __unused)
+static int ext4_trans_stop(struct ext4_mountpoint *mp)
 {
 	int r = EOK;
 #if CONFIG_JOURNALING_ENABLE
 	r = __ext4_trans_stop(mp);
 #endif
+	/*Freed blocks may be discarded once the transaction is committed,
+	 * a failed commit leaves them referenced on disk*/
+	if (r == EOK)
+		ext4_balloc_discard_issue(&mp->fs);
+	else
+		ext4_balloc_discard_drop(&mp->fs);
+
 	return r;
 }
 
-static void ext4_trans_abort(struct ext4_mountpoint *mp __unused)
+static void ext4_trans_abort(struct ext4_mountpoint *mp)
 {
 #if CONFIG_JOURNALING_ENABLE
 	__ext4_trans_abort(mp);
 #endif
+	ext4_balloc_discard_drop(&mp->fs);
+}
+
+static int ext4_fwrite_no_lock(ext4_file *file, const void *buf, size_t size,
+			       size_t *wcnt);
+
+/**@brief   Free the delayed allocation buffer of a file.*/
+static void ext4_delalloc_drop(ext4_file *f)
+{
+	struct ext4_mountpoint *mp = f->mp;
+	ext4_file **p;
+
+	if (!f->da_buf)
+		return;
+
+	for (p = &mp->da_files; *p; p = &(*p)->da_next) {
+		if (*p == f) {
+			*p = f->da_next;
+			break;
+		}
+	}
+
+	mp->da_bytes -= f->da_size;
+	ext4_free(f->da_buf);
+	f->da_buf = NULL;
+	f->da_next = NULL;
+	f->da_len = 0;
+	f->da_size = 0;
+}
+
+/**@brief   Write the delayed data of a file, allocating its blocks. Runs
+ *          in the current transaction (its own if there is none).*/
+static int ext4_delalloc_flush(ext4_file *f)
+{
+	struct ext4_mountpoint *mp = f->mp;
+	bool trans = !mp->fs.curr_trans;
+	uint64_t fpos = f->fpos;
+	size_t wcnt;
+	int r = EOK;
+
+	if (f->da_len) {
+		if (trans)
+			ext4_trans_start(mp);
+
+		f->fpos = f->da_off;
+		r = ext4_fwrite_no_lock(f, f->da_buf, f->da_len, &wcnt);
+		if (r == EOK && wcnt != f->da_len)
+			r = ENOSPC;
+		f->fpos = fpos;
+
+		if (trans) {
+			if (r != EOK)
+				ext4_trans_abort(mp);
+			else
+				ext4_trans_stop(mp);
+		}
+	}
+
+	ext4_delalloc_drop(f);
+	return r;
+}
+
+/**@brief   Write the delayed data of an inode (0 - all inodes) held by
+ *          other files than @p except.*/
+static int ext4_delalloc_sync(struct ext4_mountpoint *mp, uint32_t inode,
+			      ext4_file *except)
+{
+	ext4_file *f = mp->da_files;
+	ext4_file *next;
+	int r, ret = EOK;
+
+	while (f) {
+		next = f->da_next;
+		if (f != except && (!inode || f->inode == inode)) {
+			r = ext4_delalloc_flush(f);
+			if (ret == EOK)
+				ret = r;
+		}
+		f = next;
+	}
+
+	return ret;
+}
+
+/**@brief   Drop the delayed data of an inode (it is truncated).*/
+static void ext4_delalloc_forget(struct ext4_mountpoint *mp, uint32_t inode)
+{
+	ext4_file *f = mp->da_files;
+	ext4_file *next;
+
+	while (f) {
+		next = f->da_next;
+		if (f->inode == inode)
+			ext4_delalloc_drop(f);
+		f = next;
+	}
+}
+
+/**@brief   Delayed data may be appended: the write continues the
+ *          delayed data at the end of file, and the filesystem has
+ *          room for all delayed data (plus metadata headroom).*/
+static bool ext4_delalloc_fits(ext4_file *f, size_t size)
+{
+	struct ext4_mountpoint *mp = f->mp;
+	uint32_t block_size = ext4_sb_get_block_size(&mp->fs.sb);
+	uint64_t blocks;
+
+	if (!mp->da_budget || size > mp->da_budget / 2)
+		return false;
+
+	if (f->fpos != f->fsize)
+		return false;
+
+	if (f->da_len && f->da_off + f->da_len != f->fpos)
+		return false;
+
+	blocks = (mp->da_bytes + size) / block_size + 1;
+	blocks += blocks / 32 + 64;
+	return blocks <= ext4_sb_get_free_blocks_cnt(&mp->fs.sb);
+}
+
+/**@brief   Append to the delayed data of a file, making room in the
+ *          budget by writing the largest buffers.*/
+static int ext4_delalloc_add(ext4_file *f, const void *buf, size_t size)
+{
+	struct ext4_mountpoint *mp = f->mp;
+	ext4_file *big, *it;
+	size_t need, grow;
+	uint8_t *p;
+	int r;
+
+	/*Runs are at most one budget long*/
+	if (f->da_len + size > mp->da_budget) {
+		r = ext4_delalloc_flush(f);
+		if (r != EOK)
+			return r;
+	}
+
+	while ((need = f->da_len + size) > f->da_size) {
+		grow = f->da_size ? f->da_size * 2 : 64 * 1024;
+		if (grow < need)
+			grow = need;
+		if (grow > mp->da_budget)
+			grow = mp->da_budget;
+
+		if (mp->da_bytes - f->da_size + grow <= mp->da_budget) {
+			p = ext4_realloc(f->da_buf, grow);
+			if (!p)
+				return ENOMEM;
+
+			if (!f->da_buf) {
+				f->da_next = mp->da_files;
+				mp->da_files = f;
+			}
+
+			mp->da_bytes += grow - f->da_size;
+			f->da_buf = p;
+			f->da_size = grow;
+			break;
+		}
+
+		big = mp->da_files;
+		for (it = big; it; it = it->da_next)
+			if (it->da_size > big->da_size)
+				big = it;
+
+		r = ext4_delalloc_flush(big);
+		if (r != EOK)
+			return r;
+	}
+
+	if (!f->da_len)
+		f->da_off = f->fpos;
+
+	memcpy(f->da_buf + f->da_len, buf, size);
+	f->da_len += size;
+	f->fpos += size;
+	f->fsize = f->fpos;
+	return EOK;
 }
 
 
@@ -735,6 +977,49 @@ int ext4_mount_point_stats(const char *mount_point,
 	return EOK;
 }
 
+int ext4_mount_point_cache_stats(const char *mount_point,
+				 struct ext4_mount_cache_stats *stats)
+{
+	uint32_t i;
+	struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+	struct ext4_bcache *bc;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	bc = mp->fs.bdev->bc;
+	memset(stats, 0, sizeof(struct ext4_mount_cache_stats));
+	stats->cache_size = bc->cnt;
+	stats->cache_bytes = (uint64_t)bc->pool->cnt *
+			     (bc->itemsize + sizeof(struct ext4_buf));
+	if (bc->shared) {
+		stats->shared_size = bc->shared->cnt;
+		stats->shared_blocks = bc->shared->ref_blocks;
+	}
+	stats->ref_blocks = bc->ref_blocks;
+	stats->max_ref_blocks = bc->max_ref_blocks;
+	stats->dirty_blocks = bc->dirty_cnt;
+	stats->pinned_blocks = bc->pinned_cnt;
+	stats->ra_reads = mp->fs.bdev->ra_reads;
+	stats->ra_blocks = mp->fs.bdev->ra_blocks;
+	stats->ra_waste = mp->fs.bdev->ra_waste;
+
+	for (i = 0; i < EXT4_BCACHE_CLASS_COUNT; i++) {
+		const struct ext4_bcache_stats *c = &bc->stats[i];
+		stats->cls[i] = *c;
+		stats->total.hits += c->hits;
+		stats->total.misses += c->misses;
+		stats->total.evictions += c->evictions;
+		stats->total.dirty_evictions += c->dirty_evictions;
+		stats->total.flushes += c->flushes;
+		stats->total.ra_hits += c->ra_hits;
+	}
+	EXT4_MP_UNLOCK(mp);
+
+	return EOK;
+}
+
 int ext4_mount_setup_locks(const char *mount_point,
 			   const struct ext4_lock *locks)
 {
@@ -824,12 +1109,15 @@ static int ext4_trunc_inode(struct ext4_mountpoint *mp,
 	struct ext4_fs *const fs = &mp->fs;
 	struct ext4_inode_ref inode_ref;
 	uint64_t inode_size;
+	bool past_eof;
 	bool has_trans = mp->fs.jbd_journal && mp->fs.curr_trans;
 	r = ext4_fs_get_inode_ref(fs, index, &inode_ref);
 	if (r != EOK)
 		return r;
 
 	inode_size = ext4_inode_get_size(&fs->sb, inode_ref.inode);
+	past_eof = inode_size == new_size &&
+		   ext4_fs_blocks_past_eof(&inode_ref);
 	ext4_fs_put_inode_ref(&inode_ref);
 	if (has_trans)
 		ext4_trans_stop(mp);
@@ -857,7 +1145,8 @@ static int ext4_trunc_inode(struct ext4_mountpoint *mp,
 			ext4_trans_stop(mp);
 	}
 
-	if (inode_size > new_size) {
+	/*Same size: only release blocks preallocated past the end*/
+	if (inode_size > new_size || past_eof) {
 
 		inode_size = new_size;
 
@@ -940,6 +1229,10 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 	struct ext4_inode_ref ref;
 
 	f->mp = 0;
+	f->da_buf = NULL;
+	f->da_len = 0;
+	f->da_size = 0;
+	f->da_next = NULL;
 
 	if (!mp)
 		return ENOENT;
@@ -1079,6 +1372,17 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 
 	if (is_goal) {
 
+		/*Delayed data of other descriptors becomes visible*/
+		if ((f->flags & O_TRUNC) && (imode == EXT4_INODE_MODE_FILE)) {
+			ext4_delalloc_forget(mp, ref.index);
+		} else {
+			r = ext4_delalloc_sync(mp, ref.index, NULL);
+			if (r != EOK) {
+				ext4_fs_put_inode_ref(&ref);
+				return r;
+			}
+		}
+
 		if ((f->flags & O_TRUNC) && (imode == EXT4_INODE_MODE_FILE)) {
 			r = ext4_trunc_inode(mp, ref.index, 0);
 			if (r != EOK) {
@@ -1427,7 +1731,170 @@ int ext4_cache_flush(const char *path)
 		return ENOENT;
 
 	EXT4_MP_LOCK(mp);
-	ret = ext4_block_cache_flush(mp->fs.bdev);
+	ret = ext4_delalloc_sync(mp, 0, NULL);
+	if (ret == EOK)
+		ret = ext4_block_cache_flush(mp->fs.bdev);
+	EXT4_MP_UNLOCK(mp);
+	return ret;
+}
+
+int ext4_cache_delalloc(const char *path, size_t budget)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(path);
+	int ret = EOK;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	if (budget < mp->da_bytes)
+		ret = ext4_delalloc_sync(mp, 0, NULL);
+	mp->da_budget = budget;
+	EXT4_MP_UNLOCK(mp);
+	return ret;
+}
+
+int ext4_fstrim(const char *mount_point)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(mount_point);
+	int r;
+
+	if (!mp)
+		return ENOENT;
+
+	if (mp->fs.read_only)
+		return EROFS;
+
+	if (!mp->fs.bdev->bdif->discard)
+		return ENOTSUP;
+
+	EXT4_MP_LOCK(mp);
+	ext4_trans_start(mp);
+
+	/*Getting a group reference may initialize its bitmap*/
+	r = ext4_balloc_trim(&mp->fs, NULL);
+	if (r != EOK)
+		ext4_trans_abort(mp);
+	else
+		r = ext4_trans_stop(mp);
+
+	EXT4_MP_UNLOCK(mp);
+	return r;
+}
+
+int ext4_shared_cache_init(size_t budget, uint32_t block_size)
+{
+	uint32_t cnt;
+
+	if (s_shared_bc.cnt)
+		return EEXIST;
+
+	cnt = ext4_cache_budget_cnt(budget, block_size);
+	if (!cnt)
+		return EINVAL;
+
+	return ext4_bcache_shared_init(&s_shared_bc, cnt, block_size);
+}
+
+int ext4_shared_cache_fini(void)
+{
+	if (!s_shared_bc.cnt)
+		return EOK;
+
+	return ext4_bcache_shared_fini(&s_shared_bc);
+}
+
+int ext4_cache_resize(const char *path, size_t budget)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(path);
+	uint32_t cnt;
+	int ret;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	cnt = ext4_cache_budget_cnt(budget, mp->fs.bdev->bc->itemsize);
+	ret = ext4_block_cache_resize(mp->fs.bdev, cnt);
+	EXT4_MP_UNLOCK(mp);
+	return ret;
+}
+
+static int ext4_cache_pin_group_blocks(struct ext4_fs *fs, uint32_t bgid,
+				       bool pin)
+{
+	int r, r2;
+	uint64_t blk[3];
+	uint32_t i;
+	struct ext4_block_group_ref bg_ref;
+
+	if (bgid >= ext4_block_group_cnt(&fs->sb))
+		return EINVAL;
+
+	r = ext4_fs_get_block_group_ref(fs, bgid, &bg_ref);
+	if (r != EOK)
+		return r;
+
+	blk[0] = ext4_bg_get_block_bitmap(bg_ref.block_group, &fs->sb);
+	blk[1] = ext4_bg_get_inode_bitmap(bg_ref.block_group, &fs->sb);
+	blk[2] = bg_ref.block.lb_id;
+
+	for (i = 0; i < 3; i++) {
+		if (pin)
+			r = ext4_block_pin(fs->bdev, blk[i],
+					   i < 2 ? EXT4_BCACHE_CLASS_BITMAP
+						 : EXT4_BCACHE_CLASS_OTHER);
+		else
+			r = ext4_block_unpin(fs->bdev, blk[i]);
+		if (r != EOK)
+			break;
+	}
+
+	r2 = ext4_fs_put_block_group_ref(&bg_ref);
+	return r != EOK ? r : r2;
+}
+
+int ext4_cache_pin_group(const char *path, uint32_t bgid)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(path);
+	int ret;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	ret = ext4_cache_pin_group_blocks(&mp->fs, bgid, true);
+	EXT4_MP_UNLOCK(mp);
+	return ret;
+}
+
+int ext4_cache_unpin_group(const char *path, uint32_t bgid)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(path);
+	int ret;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	ret = ext4_cache_pin_group_blocks(&mp->fs, bgid, false);
+	EXT4_MP_UNLOCK(mp);
+	return ret;
+}
+
+int ext4_cache_writeback_step(const char *path,
+			      const struct ext4_writeback_cfg *cfg,
+			      uint32_t now_ms)
+{
+	struct ext4_mountpoint *mp = ext4_get_mount(path);
+	int ret;
+
+	if (!mp)
+		return ENOENT;
+
+	EXT4_MP_LOCK(mp);
+	ret = ext4_block_cache_drain(mp->fs.bdev, now_ms, cfg->dirty_ratio,
+				     cfg->max_age_ms, cfg->max_blocks);
 	EXT4_MP_UNLOCK(mp);
 	return ret;
 }
@@ -1574,14 +2041,22 @@ int ext4_fopen2(ext4_file *file, const char *path, int flags)
 
 int ext4_fclose(ext4_file *file)
 {
+	int r = EOK;
+
 	ext4_assert(file && file->mp);
 
+	if (file->da_buf) {
+		EXT4_MP_LOCK(file->mp);
+		r = ext4_delalloc_flush(file);
+		EXT4_MP_UNLOCK(file->mp);
+	}
+
 	file->mp = 0;
 	file->flags = 0;
 	file->inode = 0;
 	file->fpos = file->fsize = 0;
 
-	return EOK;
+	return r;
 }
 
 static int ext4_ftruncate_no_lock(ext4_file *file, uint64_t size)
@@ -1598,7 +2073,8 @@ static int ext4_ftruncate_no_lock(ext4_file *file, uint64_t size)
 
 	/*Sync file size*/
 	file->fsize = ext4_inode_get_size(&file->mp->fs.sb, ref.inode);
-	if (file->fsize <= size) {
+	if (file->fsize < size ||
+	    (file->fsize == size && !ext4_fs_blocks_past_eof(&ref))) {
 		r = EOK;
 		goto Finish;
 	}
@@ -1642,7 +2118,9 @@ int ext4_ftruncate(ext4_file *f, uint64_t size)
 	EXT4_MP_LOCK(f->mp);
 
 	ext4_trans_start(f->mp);
-	r = ext4_ftruncate_no_lock(f, size);
+	r = ext4_delalloc_sync(f->mp, f->inode, NULL);
+	if (r == EOK)
+		r = ext4_ftruncate_no_lock(f, size);
 	if (r != EOK)
 		ext4_trans_abort(f->mp);
 	else
@@ -1652,37 +2130,314 @@ int ext4_ftruncate(ext4_file *f, uint64_t size)
 	return r;
 }
 
-int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
+/**@brief   Zero bytes of one data block of the file (holes and unwritten
+ *          blocks read zeros already).*/
+static int ext4_fzero_block(struct ext4_inode_ref *ref, uint64_t off,
+			    uint32_t len)
 {
-	uint32_t unalg;
-	uint32_t iblock_idx;
-	uint32_t iblock_last;
-	uint32_t block_size;
-
+	struct ext4_fs *fs = ref->fs;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
 	ext4_fsblk_t fblock;
-	ext4_fsblk_t fblock_start;
-	uint32_t fblock_count;
-
-	uint8_t *u8_buf = buf;
+	uint8_t *zeros;
 	int r;
-	struct ext4_inode_ref ref;
-
-	ext4_assert(file && file->mp);
 
-	if (file->flags & O_WRONLY)
-		return EPERM;
+	r = ext4_fs_get_inode_dblk_idx(ref, (ext4_lblk_t)(off / block_size),
+				       &fblock, true);
+	if (r != EOK || !fblock)
+		return r;
 
-	if (!size)
-		return EOK;
+	zeros = ext4_calloc(1, len);
+	if (!zeros)
+		return ENOMEM;
 
-	EXT4_MP_LOCK(file->mp);
+	r = ext4_block_cache_write(fs->bdev, fblock, off % block_size, zeros,
+				   len, false);
+	ext4_free(zeros);
+	return r;
+}
 
-	struct ext4_fs *const fs = &file->mp->fs;
+static int ext4_fallocate_no_lock(ext4_file *file, uint64_t offset,
+				  uint64_t len, uint32_t flags)
+{
+	struct ext4_inode_ref ref;
+	struct ext4_sblock *const sb = &file->mp->fs.sb;
+	uint32_t block_size = ext4_sb_get_block_size(sb);
+	uint64_t end = offset + len;
+	uint64_t size;
+	ext4_lblk_t first, last;
+	uint32_t head, tail;
+	int r;
+
+	/*Block range of the request, full blocks of it*/
+	if ((end + block_size - 1) / block_size >= EXT_MAX_BLOCKS)
+		return EFBIG;
+
+	first = (ext4_lblk_t)(offset / block_size);
+	last = (ext4_lblk_t)((end + block_size - 1) / block_size);
+	head = offset % block_size;
+	tail = end % block_size;
+
+	r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &ref);
+	if (r != EOK)
+		return r;
+
+	r = ext4_fs_prealloc_inode_dblks(&ref, first, last - first, false);
+	if (r != EOK)
+		goto Finish;
+
+	if (flags & EXT4_FALLOC_ZERO_RANGE) {
+		/*Partial blocks at the edges are zeroed in place*/
+		if (head) {
+			uint64_t n = block_size - head;
+			r = ext4_fzero_block(&ref, offset, n < len ? n : len);
+			if (r != EOK)
+				goto Finish;
+		}
+
+		if (tail && (!head || end / block_size != first)) {
+			r = ext4_fzero_block(&ref, end - tail, tail);
+			if (r != EOK)
+				goto Finish;
+		}
+
+		/*Written full blocks are converted to unwritten ones*/
+		if (head)
+			first++;
+		if (tail)
+			last--;
+
+		if (last > first) {
+			r = ext4_fs_prealloc_inode_dblks(&ref, first,
+							 last - first, true);
+			if (r != EOK)
+				goto Finish;
+		}
+	}
+
+	size = ext4_inode_get_size(sb, ref.inode);
+	if (!(flags & EXT4_FALLOC_KEEP_SIZE) && end > size) {
+		/*Bytes of the last block past the old end of file get
+		 * visible*/
+		if (size % block_size) {
+			r = ext4_fzero_block(&ref, size,
+					     block_size - size % block_size);
+			if (r != EOK)
+				goto Finish;
+		}
+
+		ext4_inode_set_size(ref.inode, end);
+		ref.dirty = true;
+		file->fsize = end;
+	}
+
+Finish:
+	if (r != EOK) {
+		ext4_fs_put_inode_ref(&ref);
+		return r;
+	}
+
+	return ext4_fs_put_inode_ref(&ref);
+}
+
+int ext4_fallocate(ext4_file *file, uint64_t offset, uint64_t len,
+		   uint32_t flags)
+{
+	int r;
+	ext4_assert(file && file->mp);
+
+	if (file->mp->fs.read_only)
+		return EROFS;
+
+	if (file->flags & O_RDONLY)
+		return EPERM;
+
+	if (!len || offset + len < offset ||
+	    (flags & ~(EXT4_FALLOC_KEEP_SIZE | EXT4_FALLOC_ZERO_RANGE)))
+		return EINVAL;
+
+	EXT4_MP_LOCK(file->mp);
+
+	ext4_trans_start(file->mp);
+	r = ext4_delalloc_sync(file->mp, file->inode, NULL);
+	if (r == EOK)
+		r = ext4_fallocate_no_lock(file, offset, len, flags);
+	if (r != EOK)
+		ext4_trans_abort(file->mp);
+	else
+		ext4_trans_stop(file->mp);
+
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+static int ext4_punch_inode(struct ext4_mountpoint *mp, uint32_t index,
+			    ext4_lblk_t from, ext4_lblk_t to)
+{
+	int r = EOK;
+	struct ext4_fs *const fs = &mp->fs;
+	struct ext4_inode_ref inode_ref;
+	uint32_t chunk = CONFIG_MAX_TRUNCATE_SIZE /
+			 ext4_sb_get_block_size(&fs->sb);
+	bool has_trans = mp->fs.jbd_journal && mp->fs.curr_trans;
+
+	if (!chunk)
+		chunk = 1;
+
+	if (has_trans)
+		ext4_trans_stop(mp);
+
+	while (from < to) {
+		uint32_t n = to - from > chunk ? chunk : to - from;
+
+		ext4_trans_start(mp);
+		r = ext4_fs_get_inode_ref(fs, index, &inode_ref);
+		if (r != EOK) {
+			ext4_trans_abort(mp);
+			break;
+		}
+		r = ext4_fs_punch_inode_dblks(&inode_ref, from, n);
+		if (r != EOK)
+			ext4_fs_put_inode_ref(&inode_ref);
+		else
+			r = ext4_fs_put_inode_ref(&inode_ref);
+
+		if (r != EOK) {
+			ext4_trans_abort(mp);
+			break;
+		} else
+			ext4_trans_stop(mp);
+
+		from += n;
+	}
+
+	if (has_trans)
+		ext4_trans_start(mp);
+
+	return r;
+}
+
+static int ext4_fpunch_hole_no_lock(ext4_file *file, uint64_t offset,
+				    uint64_t len)
+{
+	struct ext4_inode_ref ref;
+	struct ext4_sblock *const sb = &file->mp->fs.sb;
+	uint32_t block_size = ext4_sb_get_block_size(sb);
+	uint64_t end = offset + len;
+	ext4_lblk_t first, last;
+	uint32_t head, tail;
+	int r;
+
+	r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &ref);
+	if (r != EOK)
+		return r;
+
+	/*Sync file size*/
+	file->fsize = ext4_inode_get_size(sb, ref.inode);
+	if (offset >= file->fsize)
+		return ext4_fs_put_inode_ref(&ref);
+
+	/*The last block of the file is released as a whole*/
+	if (end >= file->fsize)
+		end = (file->fsize + block_size - 1) / block_size * block_size;
+
+	first = (ext4_lblk_t)((offset + block_size - 1) / block_size);
+	last = (ext4_lblk_t)(end / block_size);
+	head = offset % block_size;
+	tail = end % block_size;
+
+	/*Partial blocks at the edges are zeroed in place*/
+	if (head) {
+		uint64_t n = block_size - head;
+		r = ext4_fzero_block(&ref, offset,
+				     n < end - offset ? n : end - offset);
+		if (r != EOK)
+			goto Finish;
+	}
+
+	if (tail && (!head || end / block_size != offset / block_size)) {
+		r = ext4_fzero_block(&ref, end - tail, tail);
+		if (r != EOK)
+			goto Finish;
+	}
+
+Finish:
+	if (r != EOK) {
+		ext4_fs_put_inode_ref(&ref);
+		return r;
+	}
+
+	r = ext4_fs_put_inode_ref(&ref);
+	if (r != EOK || last <= first)
+		return r;
+
+	return ext4_punch_inode(file->mp, file->inode, first, last);
+}
+
+int ext4_fpunch_hole(ext4_file *file, uint64_t offset, uint64_t len)
+{
+	int r;
+	ext4_assert(file && file->mp);
+
+	if (file->mp->fs.read_only)
+		return EROFS;
+
+	if (file->flags & O_RDONLY)
+		return EPERM;
+
+	if (!len || offset + len < offset)
+		return EINVAL;
+
+	EXT4_MP_LOCK(file->mp);
+
+	ext4_trans_start(file->mp);
+	r = ext4_delalloc_sync(file->mp, file->inode, NULL);
+	if (r == EOK)
+		r = ext4_fpunch_hole_no_lock(file, offset, len);
+	if (r != EOK)
+		ext4_trans_abort(file->mp);
+	else
+		ext4_trans_stop(file->mp);
+
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
+int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
+{
+	uint32_t unalg;
+	uint32_t iblock_idx;
+	uint32_t block_size;
+
+	ext4_fsblk_t fblock;
+	uint32_t fblock_count;
+
+	uint8_t *u8_buf = buf;
+	int r, rr;
+	struct ext4_inode_ref ref;
+
+	ext4_assert(file && file->mp);
+
+	if (file->flags & O_WRONLY)
+		return EPERM;
+
+	if (!size)
+		return EOK;
+
+	EXT4_MP_LOCK(file->mp);
+
+	struct ext4_fs *const fs = &file->mp->fs;
 	struct ext4_sblock *const sb = &file->mp->fs.sb;
 
 	if (rcnt)
 		*rcnt = 0;
 
+	/*Delayed data is read from the disk*/
+	r = ext4_delalloc_sync(file->mp, file->inode, NULL);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
 	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
 	if (r != EOK) {
 		EXT4_MP_UNLOCK(file->mp);
@@ -1697,7 +2452,6 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 		? ((size_t)(file->fsize - file->fpos)) : size;
 
 	iblock_idx = (uint32_t)((file->fpos) / block_size);
-	iblock_last = (uint32_t)((file->fpos + size) / block_size);
 	unalg = (file->fpos) % block_size;
 
 	/*If the size of symlink is smaller than 60 bytes*/
@@ -1732,8 +2486,8 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 
 		/* Do we get an unwritten range? */
 		if (fblock != 0) {
-			uint64_t off = fblock * block_size + unalg;
-			r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, len);
+			r = ext4_block_cache_read(file->mp->fs.bdev, fblock,
+						  unalg, u8_buf, len);
 			if (r != EOK)
 				goto Finish;
 
@@ -1752,52 +2506,54 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 		iblock_idx++;
 	}
 
-	fblock_start = 0;
-	fblock_count = 0;
 	while (size >= block_size) {
-		while (iblock_idx < iblock_last) {
-			r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx,
-						       &fblock, true);
-			if (r != EOK)
-				goto Finish;
-
-			iblock_idx++;
+		fblock_count = (size / block_size) > UINT32_MAX
+				   ? UINT32_MAX : (uint32_t)(size / block_size);
 
-			if (!fblock_start)
-				fblock_start = fblock;
+		/*One lookup per extent (or hole)*/
+		r = ext4_fs_get_inode_dblk_range(&ref, iblock_idx, fblock_count,
+						 &fblock, &fblock_count);
+		if (r != EOK)
+			goto Finish;
 
-			if ((fblock_start + fblock_count) != fblock)
-				break;
+		if (fblock != 0) {
+			/*Partial writes may have left newer data in the cache*/
+			r = ext4_block_cache_write_range(file->mp->fs.bdev,
+							 fblock, fblock_count);
+			if (r != EOK)
+				goto Finish;
 
-			fblock_count++;
+			r = ext4_blocks_get_async(file->mp->fs.bdev, u8_buf,
+						  fblock, fblock_count);
+			if (r != EOK)
+				goto Finish;
+		} else {
+			memset(u8_buf, 0, (size_t)block_size * fblock_count);
 		}
 
-		r = ext4_blocks_get_direct(file->mp->fs.bdev, u8_buf, fblock_start,
-					   fblock_count);
-		if (r != EOK)
-			goto Finish;
-
-		size -= block_size * fblock_count;
-		u8_buf += block_size * fblock_count;
-		file->fpos += block_size * fblock_count;
+		size -= (size_t)block_size * fblock_count;
+		u8_buf += (size_t)block_size * fblock_count;
+		file->fpos += (uint64_t)block_size * fblock_count;
 
 		if (rcnt)
-			*rcnt += block_size * fblock_count;
+			*rcnt += (size_t)block_size * fblock_count;
 
-		fblock_start = fblock;
-		fblock_count = 1;
+		iblock_idx += fblock_count;
 	}
 
 	if (size) {
-		uint64_t off;
 		r = ext4_fs_get_inode_dblk_idx(&ref, iblock_idx, &fblock, true);
 		if (r != EOK)
 			goto Finish;
 
-		off = fblock * block_size;
-		r = ext4_block_readbytes(file->mp->fs.bdev, off, u8_buf, size);
-		if (r != EOK)
-			goto Finish;
+		if (fblock != 0) {
+			r = ext4_block_cache_read(file->mp->fs.bdev, fblock, 0,
+						  u8_buf, size);
+			if (r != EOK)
+				goto Finish;
+		} else {
+			memset(u8_buf, 0, size);
+		}
 
 		file->fpos += size;
 
@@ -1806,40 +2562,45 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 	}
 
 Finish:
+	/* Wait for the bulk reads of the file blocks. */
+	rr = ext4_block_aio_wait(file->mp->fs.bdev);
+	if (r == EOK)
+		r = rr;
+
 	ext4_fs_put_inode_ref(&ref);
 	EXT4_MP_UNLOCK(file->mp);
 	return r;
 }
 
-int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
+/**@brief   Map a partially written block inside the file, a hole (or an
+ *          unwritten range) is fresh: it reads zeros around the data.*/
+static int ext4_fwrite_init_block(struct ext4_inode_ref *ref,
+				  uint32_t iblk_idx, ext4_fsblk_t *fblk,
+				  bool *fresh)
+{
+	int r = ext4_fs_get_inode_dblk_idx(ref, iblk_idx, fblk, true);
+	if (r != EOK)
+		return r;
+
+	*fresh = !*fblk;
+	return ext4_fs_init_inode_dblk_idx(ref, iblk_idx, fblk);
+}
+
+static int ext4_fwrite_no_lock(ext4_file *file, const void *buf, size_t size,
+			       size_t *wcnt)
 {
 	uint32_t unalg;
 	uint32_t iblk_idx;
-	uint32_t iblock_last;
 	uint32_t ifile_blocks;
 	uint32_t block_size;
 
 	uint32_t fblock_count;
 	ext4_fsblk_t fblk;
-	ext4_fsblk_t fblock_start;
+	bool fresh = true;
 
 	struct ext4_inode_ref ref;
 	const uint8_t *u8_buf = buf;
-	int r, rr = EOK;
-
-	ext4_assert(file && file->mp);
-
-	if (file->mp->fs.read_only)
-		return EROFS;
-
-	if (file->flags & O_RDONLY)
-		return EPERM;
-
-	if (!size)
-		return EOK;
-
-	EXT4_MP_LOCK(file->mp);
-	ext4_trans_start(file->mp);
+	int r, r2, rr = EOK;
 
 	struct ext4_fs *const fs = &file->mp->fs;
 	struct ext4_sblock *const sb = &file->mp->fs.sb;
@@ -1848,17 +2609,13 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 		*wcnt = 0;
 
 	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
-	if (r != EOK) {
-		ext4_trans_abort(file->mp);
-		EXT4_MP_UNLOCK(file->mp);
+	if (r != EOK)
 		return r;
-	}
 
 	/*Sync file size*/
 	file->fsize = ext4_inode_get_size(sb, ref.inode);
 	block_size = ext4_sb_get_block_size(sb);
 
-	iblock_last = (uint32_t)((file->fpos + size) / block_size);
 	iblk_idx = (uint32_t)(file->fpos / block_size);
 	ifile_blocks = (uint32_t)((file->fsize + block_size - 1) / block_size);
 
@@ -1866,16 +2623,20 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 
 	if (unalg) {
 		size_t len =  size;
-		uint64_t off;
 		if (size > (block_size - unalg))
 			len = block_size - unalg;
 
-		r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
+		if (iblk_idx < ifile_blocks)
+			r = ext4_fwrite_init_block(&ref, iblk_idx, &fblk,
+						   &fresh);
+		else
+			r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
 		if (r != EOK)
 			goto Finish;
 
-		off = fblk * block_size + unalg;
-		r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, len);
+		/*Blocks past the end of file hold no data yet*/
+		r = ext4_block_cache_write(file->mp->fs.bdev, fblk, unalg,
+					   u8_buf, len, fresh);
 		if (r != EOK)
 			goto Finish;
 
@@ -1894,84 +2655,84 @@ int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
 	if (r != EOK)
 		goto Finish;
 
-	fblock_start = 0;
-	fblock_count = 0;
 	while (size >= block_size) {
+		fblock_count = (size / block_size) > UINT32_MAX
+				   ? UINT32_MAX : (uint32_t)(size / block_size);
 
-		while (iblk_idx < iblock_last) {
-			if (iblk_idx < ifile_blocks) {
-				r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx,
-								&fblk);
-				if (r != EOK)
-					goto Finish;
-			} else {
-				rr = ext4_fs_append_inode_dblk(&ref, &fblk,
-							       &iblk_idx);
-				if (rr != EOK) {
-					/* Unable to append more blocks. But
-					 * some block might be allocated already
-					 * */
-					break;
-				}
-			}
-
-			iblk_idx++;
-
-			if (!fblock_start) {
-				fblock_start = fblk;
-			}
+		if (iblk_idx < ifile_blocks) {
+			if (fblock_count > ifile_blocks - iblk_idx)
+				fblock_count = ifile_blocks - iblk_idx;
 
-			if ((fblock_start + fblock_count) != fblk)
+			r = ext4_fs_init_inode_dblk_range(&ref, iblk_idx,
+							  fblock_count, &fblk,
+							  &fblock_count);
+			if (r != EOK)
 				break;
-
-			fblock_count++;
+		} else {
+			/*One allocation for the whole appended run*/
+			rr = ext4_fs_append_inode_dblks(&ref, &fblk, &iblk_idx,
+							&fblock_count);
+			if (rr != EOK) {
+				/* Unable to append more blocks. But
+				 * some block might be allocated already
+				 * */
+				break;
+			}
 		}
 
-		r = ext4_blocks_set_direct(file->mp->fs.bdev, u8_buf, fblock_start,
+		/*Cached copies of the blocks are overwritten*/
+		ext4_bcache_invalidate_lba(file->mp->fs.bdev->bc, fblk,
 					   fblock_count);
+		r = ext4_blocks_set_async(file->mp->fs.bdev, u8_buf, fblk,
+					  fblock_count);
 		if (r != EOK)
 			break;
 
-		size -= block_size * fblock_count;
-		u8_buf += block_size * fblock_count;
-		file->fpos += block_size * fblock_count;
+		size -= (size_t)block_size * fblock_count;
+		u8_buf += (size_t)block_size * fblock_count;
+		file->fpos += (uint64_t)block_size * fblock_count;
 
 		if (wcnt)
-			*wcnt += block_size * fblock_count;
-
-		fblock_start = fblk;
-		fblock_count = 1;
+			*wcnt += (size_t)block_size * fblock_count;
 
-		if (rr != EOK) {
-			/*ext4_fs_append_inode_block has failed and no
-			 * more blocks might be written. But node size
-			 * should be updated.*/
-			r = rr;
-			goto out_fsize;
-		}
+		iblk_idx += fblock_count;
 	}
 
+	/*Wait for the bulk writes of the file blocks*/
+	r2 = ext4_block_aio_wait(file->mp->fs.bdev);
+	if (r == EOK)
+		r = r2;
+
 	/*Stop write back cache mode*/
 	ext4_block_cache_write_back(file->mp->fs.bdev, 0);
 
 	if (r != EOK)
 		goto Finish;
 
+	if (rr != EOK) {
+		/*ext4_fs_append_inode_dblks has failed and no
+		 * more blocks might be written. But node size
+		 * should be updated.*/
+		r = rr;
+		goto out_fsize;
+	}
+
 	if (size) {
-		uint64_t off;
 		if (iblk_idx < ifile_blocks) {
-			r = ext4_fs_init_inode_dblk_idx(&ref, iblk_idx, &fblk);
+			r = ext4_fwrite_init_block(&ref, iblk_idx, &fblk,
+						   &fresh);
 			if (r != EOK)
 				goto Finish;
 		} else {
+			fresh = true;
 			r = ext4_fs_append_inode_dblk(&ref, &fblk, &iblk_idx);
 			if (r != EOK)
 				/*Node size sholud be updated.*/
 				goto out_fsize;
 		}
 
-		off = fblk * block_size;
-		r = ext4_block_writebytes(file->mp->fs.bdev, off, u8_buf, size);
+		r = ext4_block_cache_write(file->mp->fs.bdev, fblk, 0, u8_buf,
+					   size, fresh);
 		if (r != EOK)
 			goto Finish;
 
@@ -1989,8 +2750,51 @@ out_fsize:
 	}
 
 Finish:
-	r = ext4_fs_put_inode_ref(&ref);
+	/*Requests left in flight by an error above*/
+	ext4_block_aio_wait(file->mp->fs.bdev);
+	return ext4_fs_put_inode_ref(&ref);
+}
+
+int ext4_fwrite(ext4_file *file, const void *buf, size_t size, size_t *wcnt)
+{
+	int r;
+
+	ext4_assert(file && file->mp);
+
+	if (file->mp->fs.read_only)
+		return EROFS;
+
+	if (file->flags & O_RDONLY)
+		return EPERM;
+
+	if (!size)
+		return EOK;
 
+	EXT4_MP_LOCK(file->mp);
+	ext4_trans_start(file->mp);
+
+	if (wcnt)
+		*wcnt = 0;
+
+	/*Other descriptors of the file write their delayed data first*/
+	r = ext4_delalloc_sync(file->mp, file->inode, file);
+	if (r != EOK)
+		goto Finish;
+
+	if (ext4_delalloc_fits(file, size)) {
+		r = ext4_delalloc_add(file, buf, size);
+		if (r == EOK && wcnt)
+			*wcnt = size;
+		goto Finish;
+	}
+
+	r = ext4_delalloc_flush(file);
+	if (r != EOK)
+		goto Finish;
+
+	r = ext4_fwrite_no_lock(file, buf, size, wcnt);
+
+Finish:
 	if (r != EOK)
 		ext4_trans_abort(file->mp);
 	else
@@ -2000,6 +2804,74 @@ Finish:
 	return r;
 }
 
+/**@brief   Seek to the next data (or hole) of the file, unwritten
+ *          ranges read zeros and count as holes.*/
+static int ext4_fseek_data(ext4_file *file, uint64_t offset, bool hole)
+{
+	struct ext4_inode_ref ref;
+	struct ext4_sblock *const sb = &file->mp->fs.sb;
+	uint32_t block_size = ext4_sb_get_block_size(sb);
+	ext4_lblk_t iblock, end;
+	ext4_fsblk_t fblock;
+	uint32_t count;
+	uint64_t pos;
+	int r;
+
+	EXT4_MP_LOCK(file->mp);
+
+	/*Delayed data is mapped first*/
+	r = ext4_delalloc_sync(file->mp, file->inode, NULL);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	r = ext4_fs_get_inode_ref(&file->mp->fs, file->inode, &ref);
+	if (r != EOK) {
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+
+	/*Sync file size*/
+	file->fsize = ext4_inode_get_size(sb, ref.inode);
+	if (offset >= file->fsize) {
+		r = ENXIO;
+		goto Finish;
+	}
+
+	/*The end of file is a hole, there is no data past it*/
+	pos = file->fsize;
+	iblock = (ext4_lblk_t)(offset / block_size);
+	end = (ext4_lblk_t)((file->fsize + block_size - 1) / block_size);
+
+	/*One mapped run (or hole) at a time*/
+	while (iblock < end) {
+		r = ext4_fs_get_inode_dblk_range(&ref, iblock, end - iblock,
+						 &fblock, &count);
+		if (r != EOK)
+			goto Finish;
+
+		if (!fblock == hole) {
+			pos = (uint64_t)iblock * block_size;
+			if (pos < offset)
+				pos = offset;
+			break;
+		}
+
+		iblock += count;
+	}
+
+	if (iblock >= end && !hole)
+		r = ENXIO;
+	else
+		file->fpos = pos;
+
+Finish:
+	ext4_fs_put_inode_ref(&ref);
+	EXT4_MP_UNLOCK(file->mp);
+	return r;
+}
+
 int ext4_fseek(ext4_file *file, uint64_t offset, uint32_t origin)
 {
 	switch (origin) {
@@ -2021,6 +2893,10 @@ int ext4_fseek(ext4_file *file, uint64_t offset, uint32_t origin)
 
 		file->fpos = file->fsize - offset;
 		return EOK;
+	case SEEK_DATA:
+		return ext4_fseek_data(file, offset, false);
+	case SEEK_HOLE:
+		return ext4_fseek_data(file, offset, true);
 	}
 	return EINVAL;
 }
@@ -2462,7 +3338,8 @@ static int ext4_fsymlink_set(ext4_file *f, const void *buf, uint32_t size)
 		if (r != EOK)
 			goto Finish;
 
-		r = ext4_block_writebytes(f->mp->fs.bdev, 0, buf, size);
+		r = ext4_block_cache_write(f->mp->fs.bdev, fblock, 0, buf,
+					   size, true);
 		if (r != EOK)
 			goto Finish;
 
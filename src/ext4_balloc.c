@@ -53,6 +53,8 @@
 #include <ext4_bitmap.h>
 #include <ext4_inode.h>
 
+#include <string.h>
+
 /**@brief Compute number of block group from block address.
  * @param sb superblock pointer.
  * @param baddr Absolute address of block.
@@ -149,6 +151,116 @@ ext4_balloc_verify_bitmap_csum(struct ext4_sblock *sb,
 #define ext4_balloc_verify_bitmap_csum(...) true
 #endif
 
+#if CONFIG_EXT4_DISCARD_RANGES
+/**@brief Queue freed blocks for discard, merged with adjacent ranges.
+ *        Blocks are dropped (left to ext4_fstrim) if there is no room.*/
+static void ext4_balloc_discard_add(struct ext4_fs *fs, ext4_fsblk_t first,
+				    ext4_fsblk_t count)
+{
+	struct ext4_discard_range *d = fs->discard;
+	ext4_fsblk_t end = first + count;
+	uint32_t i, n;
+
+	if (!fs->bdev->bdif->discard || !count)
+		return;
+
+	/*First range which ends at or after the freed blocks*/
+	for (i = 0; i < fs->discard_cnt; i++)
+		if (d[i].first + d[i].count >= first)
+			break;
+
+	if (i < fs->discard_cnt && d[i].first <= end) {
+		/*Merge, also with following ranges that now touch*/
+		if (d[i].first < first)
+			first = d[i].first;
+
+		for (n = i; n < fs->discard_cnt && d[n].first <= end; n++)
+			if (d[n].first + d[n].count > end)
+				end = d[n].first + d[n].count;
+
+		d[i].first = first;
+		d[i].count = end - first;
+		memmove(d + i + 1, d + n, (fs->discard_cnt - n) * sizeof(*d));
+		fs->discard_cnt -= n - i - 1;
+		return;
+	}
+
+	if (fs->discard_cnt == CONFIG_EXT4_DISCARD_RANGES)
+		return;
+
+	memmove(d + i + 1, d + i, (fs->discard_cnt - i) * sizeof(*d));
+	d[i].first = first;
+	d[i].count = count;
+	fs->discard_cnt++;
+}
+
+/**@brief Allocated blocks must not be discarded any more.*/
+static void ext4_balloc_discard_cancel(struct ext4_fs *fs, ext4_fsblk_t first,
+				       ext4_fsblk_t count)
+{
+	struct ext4_discard_range *d = fs->discard;
+	ext4_fsblk_t end = first + count;
+	ext4_fsblk_t left, right;
+	uint32_t i;
+
+	for (i = 0; i < fs->discard_cnt; i++) {
+		if (d[i].first >= end)
+			break;
+
+		if (d[i].first + d[i].count <= first)
+			continue;
+
+		left = d[i].first < first ? first - d[i].first : 0;
+		right = d[i].first + d[i].count > end ?
+			d[i].first + d[i].count - end : 0;
+
+		if (left && right &&
+		    fs->discard_cnt < CONFIG_EXT4_DISCARD_RANGES) {
+			/*Split*/
+			memmove(d + i + 2, d + i + 1,
+				(fs->discard_cnt - i - 1) * sizeof(*d));
+			d[i].count = left;
+			d[i + 1].first = end;
+			d[i + 1].count = right;
+			fs->discard_cnt++;
+			break;
+		}
+
+		if (left > right) {
+			d[i].count = left;
+		} else if (right) {
+			d[i].first = end;
+			d[i].count = right;
+		} else {
+			memmove(d + i, d + i + 1,
+				(fs->discard_cnt - i - 1) * sizeof(*d));
+			fs->discard_cnt--;
+			i--;
+		}
+	}
+}
+
+void ext4_balloc_discard_issue(struct ext4_fs *fs)
+{
+	uint32_t i;
+
+	/*Discard is a hint, errors are not reported*/
+	for (i = 0; i < fs->discard_cnt; i++)
+		ext4_block_discard(fs->bdev, fs->discard[i].first,
+				   fs->discard[i].count);
+
+	fs->discard_cnt = 0;
+}
+
+void ext4_balloc_discard_drop(struct ext4_fs *fs)
+{
+	fs->discard_cnt = 0;
+}
+#else
+#define ext4_balloc_discard_add(fs, first, count) ((void)(fs))
+#define ext4_balloc_discard_cancel(fs, first, count) ((void)(fs))
+#endif
+
 int ext4_balloc_free_block(struct ext4_inode_ref *inode_ref, ext4_fsblk_t baddr)
 {
 	struct ext4_fs *fs = inode_ref->fs;
@@ -171,7 +283,8 @@ int ext4_balloc_free_block(struct ext4_inode_ref *inode_ref, ext4_fsblk_t baddr)
 
 	struct ext4_block bitmap_block;
 
-	rc = ext4_trans_block_get(fs->bdev, &bitmap_block, bitmap_block_addr);
+	rc = ext4_trans_block_get(fs->bdev, &bitmap_block, bitmap_block_addr,
+				  EXT4_BCACHE_CLASS_BITMAP);
 	if (rc != EOK) {
 		ext4_fs_put_block_group_ref(&bg_ref);
 		return rc;
@@ -224,6 +337,7 @@ int ext4_balloc_free_block(struct ext4_inode_ref *inode_ref, ext4_fsblk_t baddr)
 		return rc;
 	}
 	ext4_bcache_invalidate_lba(fs->bdev->bc, baddr, 1);
+	ext4_balloc_discard_add(fs, baddr, 1);
 	/* Release block group reference */
 	rc = ext4_fs_put_block_group_ref(&bg_ref);
 
@@ -235,6 +349,7 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
 {
 	int rc = EOK;
 	uint32_t blk_cnt = count;
+	ext4_fsblk_t start = first;
 	struct ext4_fs *fs = inode_ref->fs;
 	struct ext4_sblock *sb = &fs->sb;
 
@@ -271,7 +386,8 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
 		ext4_fsblk_t bitmap_blk = ext4_bg_get_block_bitmap(bg, sb);
 
 		struct ext4_block blk;
-		rc = ext4_trans_block_get(fs->bdev, &blk, bitmap_blk);
+		rc = ext4_trans_block_get(fs->bdev, &blk, bitmap_blk,
+					  EXT4_BCACHE_CLASS_BITMAP);
 		if (rc != EOK) {
 			ext4_fs_put_block_group_ref(&bg_ref);
 			return rc;
@@ -335,13 +451,14 @@ int ext4_balloc_free_blocks(struct ext4_inode_ref *inode_ref,
 
 	uint32_t i;
 	for (i = 0;i < blk_cnt;i++) {
-		rc = ext4_trans_try_revoke_block(fs->bdev, first + i);
+		rc = ext4_trans_try_revoke_block(fs->bdev, start + i);
 		if (rc != EOK)
 			return rc;
 
 	}
 
-	ext4_bcache_invalidate_lba(fs->bdev->bc, first, count);
+	ext4_bcache_invalidate_lba(fs->bdev->bc, start, blk_cnt);
+	ext4_balloc_discard_add(fs, start, blk_cnt);
 	/*All blocks should be released*/
 	ext4_assert(count == 0);
 
@@ -392,7 +509,8 @@ int ext4_balloc_alloc_block(struct ext4_inode_ref *inode_ref,
 	/* Load block with bitmap */
 	bmp_blk_adr = ext4_bg_get_block_bitmap(bg_ref.block_group, sb);
 
-	r = ext4_trans_block_get(inode_ref->fs->bdev, &b, bmp_blk_adr);
+	r = ext4_trans_block_get(inode_ref->fs->bdev, &b, bmp_blk_adr,
+				 EXT4_BCACHE_CLASS_BITMAP);
 	if (r != EOK) {
 		ext4_fs_put_block_group_ref(&bg_ref);
 		return r;
@@ -490,7 +608,8 @@ goal_failed:
 
 		/* Load block with bitmap */
 		bmp_blk_adr = ext4_bg_get_block_bitmap(bg, sb);
-		r = ext4_trans_block_get(inode_ref->fs->bdev, &b, bmp_blk_adr);
+		r = ext4_trans_block_get(inode_ref->fs->bdev, &b, bmp_blk_adr,
+					 EXT4_BCACHE_CLASS_BITMAP);
 		if (r != EOK) {
 			ext4_fs_put_block_group_ref(&bg_ref);
 			return r;
@@ -573,10 +692,105 @@ success:
 	bg_ref.dirty = true;
 	r = ext4_fs_put_block_group_ref(&bg_ref);
 
+	ext4_balloc_discard_cancel(inode_ref->fs, alloc, 1);
 	*fblock = alloc;
 	return r;
 }
 
+int ext4_balloc_alloc_blocks(struct ext4_inode_ref *inode_ref,
+			     ext4_fsblk_t goal, ext4_fsblk_t *baddr,
+			     uint32_t *count)
+{
+	struct ext4_fs *fs = inode_ref->fs;
+	struct ext4_sblock *sb = &fs->sb;
+	struct ext4_block_group_ref bg_ref;
+	struct ext4_block b;
+	uint32_t bg_id, idx, end, n;
+	int r;
+
+	ext4_assert(*count);
+
+	r = ext4_balloc_alloc_block(inode_ref, goal, baddr);
+	if (r != EOK) {
+		*count = 0;
+		return r;
+	}
+
+	/* Extend the run with the free blocks following the first one */
+	bg_id = ext4_balloc_get_bgid_of_block(sb, *baddr);
+	idx = ext4_fs_addr_to_idx_bg(sb, *baddr) + 1;
+	end = ext4_blocks_in_group_cnt(sb, bg_id);
+	if (end - idx > *count - 1)
+		end = idx + *count - 1;
+
+	*count = 1;
+	if (idx >= end)
+		return EOK;
+
+	r = ext4_fs_get_block_group_ref(fs, bg_id, &bg_ref);
+	if (r != EOK)
+		goto fail;
+
+	struct ext4_bgroup *bg = bg_ref.block_group;
+
+	r = ext4_trans_block_get(fs->bdev, &b, ext4_bg_get_block_bitmap(bg, sb),
+				 EXT4_BCACHE_CLASS_BITMAP);
+	if (r != EOK) {
+		ext4_fs_put_block_group_ref(&bg_ref);
+		goto fail;
+	}
+
+	for (n = idx; n < end && ext4_bmap_is_bit_clr(b.data, n); n++)
+		ext4_bmap_bit_set(b.data, n);
+
+	n -= idx;
+	if (n) {
+		ext4_balloc_set_bitmap_csum(sb, bg, b.data);
+		ext4_trans_set_block_dirty(b.buf);
+	}
+
+	r = ext4_block_set(fs->bdev, &b);
+	if (r != EOK) {
+		ext4_fs_put_block_group_ref(&bg_ref);
+		goto fail;
+	}
+
+	if (n) {
+		uint32_t block_size = ext4_sb_get_block_size(sb);
+
+		/* Update superblock free blocks count */
+		uint64_t sb_free_blocks = ext4_sb_get_free_blocks_cnt(sb);
+		ext4_sb_set_free_blocks_cnt(sb, sb_free_blocks - n);
+
+		/* Update inode blocks (different block size!) count */
+		uint64_t ino_blocks;
+		ino_blocks = ext4_inode_get_blocks_count(sb, inode_ref->inode);
+		ino_blocks += (uint64_t)n * (block_size / EXT4_INODE_BLOCK_SIZE);
+		ext4_inode_set_blocks_count(sb, inode_ref->inode, ino_blocks);
+		inode_ref->dirty = true;
+
+		/* Update block group free blocks count */
+		uint32_t fb_cnt = ext4_bg_get_free_blocks_count(bg, sb);
+		ext4_bg_set_free_blocks_count(bg, sb, fb_cnt - n);
+		bg_ref.dirty = true;
+	}
+
+	r = ext4_fs_put_block_group_ref(&bg_ref);
+	if (r != EOK)
+		return r;
+
+	if (n)
+		ext4_balloc_discard_cancel(fs, *baddr + 1, n);
+
+	*count = 1 + n;
+	return EOK;
+
+fail:
+	ext4_balloc_free_block(inode_ref, *baddr);
+	*count = 0;
+	return r;
+}
+
 int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
 				ext4_fsblk_t baddr, bool *free)
 {
@@ -600,7 +814,8 @@ int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
 	bmp_blk_addr = ext4_bg_get_block_bitmap(bg_ref.block_group, sb);
 
 	struct ext4_block b;
-	rc = ext4_trans_block_get(fs->bdev, &b, bmp_blk_addr);
+	rc = ext4_trans_block_get(fs->bdev, &b, bmp_blk_addr,
+				  EXT4_BCACHE_CLASS_BITMAP);
 	if (rc != EOK) {
 		ext4_fs_put_block_group_ref(&bg_ref);
 		return rc;
@@ -654,11 +869,74 @@ int ext4_balloc_try_alloc_block(struct ext4_inode_ref *inode_ref,
 	ext4_bg_set_free_blocks_count(bg_ref.block_group, sb, fb_cnt);
 
 	bg_ref.dirty = true;
+	ext4_balloc_discard_cancel(fs, baddr, 1);
 
 terminate:
 	return ext4_fs_put_block_group_ref(&bg_ref);
 }
 
+int ext4_balloc_trim(struct ext4_fs *fs, uint64_t *trimmed)
+{
+	int rc = EOK;
+	struct ext4_sblock *sb = &fs->sb;
+	uint32_t bg_count = ext4_block_group_cnt(sb);
+	uint32_t bgid, idx, start, blk_in_bg;
+
+	for (bgid = 0; bgid < bg_count && rc == EOK; bgid++) {
+		struct ext4_block_group_ref bg_ref;
+		rc = ext4_fs_get_block_group_ref(fs, bgid, &bg_ref);
+		if (rc != EOK)
+			return rc;
+
+		struct ext4_bgroup *bg = bg_ref.block_group;
+		if (ext4_bg_get_free_blocks_count(bg, sb) == 0) {
+			rc = ext4_fs_put_block_group_ref(&bg_ref);
+			continue;
+		}
+
+		/* Load block with bitmap */
+		ext4_fsblk_t bmp_blk_addr = ext4_bg_get_block_bitmap(bg, sb);
+
+		struct ext4_block b;
+		rc = ext4_trans_block_get(fs->bdev, &b, bmp_blk_addr,
+					  EXT4_BCACHE_CLASS_BITMAP);
+		if (rc != EOK) {
+			ext4_fs_put_block_group_ref(&bg_ref);
+			return rc;
+		}
+
+		/* Discard runs of free blocks */
+		blk_in_bg = ext4_blocks_in_group_cnt(sb, bgid);
+		idx = 0;
+		while (rc == EOK && idx < blk_in_bg) {
+			if (ext4_bmap_bit_find_clr(b.data, idx, blk_in_bg,
+						   &start) != EOK)
+				break;
+
+			idx = start;
+			while (idx < blk_in_bg &&
+			       ext4_bmap_is_bit_clr(b.data, idx))
+				idx++;
+
+			rc = ext4_block_discard(fs->bdev,
+					ext4_fs_bg_idx_to_addr(sb, start, bgid),
+					idx - start);
+			if (rc == EOK && trimmed)
+				*trimmed += idx - start;
+		}
+
+		int r = ext4_block_set(fs->bdev, &b);
+		if (rc == EOK)
+			rc = r;
+
+		r = ext4_fs_put_block_group_ref(&bg_ref);
+		if (rc == EOK)
+			rc = r;
+	}
+
+	return rc;
+}
+
 /**
  * @}
  */
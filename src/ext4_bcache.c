@@ -36,6 +36,7 @@
 
 #include <ext4_config.h>
 #include <ext4_types.h>
+#include <ext4_misc.h>
 #include <ext4_bcache.h>
 #include <ext4_blockdev.h>
 #include <ext4_debug.h>
@@ -59,29 +60,903 @@ static int ext4_bcache_lru_compare(struct ext4_buf *a, struct ext4_buf *b)
 		return 1;
 	else if (a->lru_id < b->lru_id)
 		return -1;
-	return 0;
+
+	/* Priority boost makes lru_id values collide. */
+	return ext4_bcache_lba_compare(a, b);
 }
 
 RB_GENERATE_INTERNAL(ext4_buf_lba, ext4_buf, lba_node,
 		     ext4_bcache_lba_compare, static inline)
 RB_GENERATE_INTERNAL(ext4_buf_lru, ext4_buf, lru_node,
 		     ext4_bcache_lru_compare, static inline)
+RB_GENERATE_INTERNAL(ext4_buf_fifo, ext4_buf, lru_node,
+		     ext4_bcache_lru_compare, static inline)
 
-int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
-			     uint32_t itemsize)
+/**@brief   Multiplier of the LBA hash (64-bit golden ratio).*/
+#define EXT4_BCACHE_HASH_MUL 0x9E3779B97F4A7C15ull
+
+/**@brief   Minimum slot count of the LBA hash index.*/
+#define EXT4_BCACHE_HASH_MIN 16
+
+static inline uint32_t ext4_bcache_hash(uint64_t lba, uint32_t size)
 {
-	ext4_assert(bc && cnt && itemsize);
+	return (uint32_t)((lba * EXT4_BCACHE_HASH_MUL) >> 32) & (size - 1);
+}
 
-	memset(bc, 0, sizeof(struct ext4_bcache));
+/**@brief   Smallest power of 2 which keeps the load factor of @cnt
+ *          entries at or below 1/2.*/
+static uint32_t ext4_bcache_hash_size(uint32_t cnt)
+{
+	uint32_t size = EXT4_BCACHE_HASH_MIN;
+	while (size < cnt && size < (UINT32_C(1) << 30))
+		size <<= 1;
+
+	return size << 1;
+}
+
+static void ext4_bcache_hash_place(struct ext4_buf_hent *tab, uint32_t size,
+				   struct ext4_buf *buf)
+{
+	uint32_t i = ext4_bcache_hash(buf->lba, size);
+	while (tab[i].buf)
+		i = (i + 1) & (size - 1);
+
+	tab[i].lba = buf->lba;
+	tab[i].buf = buf;
+}
+
+static int ext4_bcache_hash_resize(struct ext4_bcache *bc, uint32_t size)
+{
+	uint32_t i;
+	struct ext4_buf_hent *tab;
+
+	tab = ext4_calloc(size, sizeof(struct ext4_buf_hent));
+	if (!tab)
+		return ENOMEM;
+
+	for (i = 0; i < bc->lba_hash_size; i++) {
+		if (bc->lba_hash[i].buf)
+			ext4_bcache_hash_place(tab, size, bc->lba_hash[i].buf);
+	}
+
+	ext4_free(bc->lba_hash);
+	bc->lba_hash = tab;
+	bc->lba_hash_size = size;
+	return EOK;
+}
+
+static int ext4_bcache_hash_insert(struct ext4_bcache *bc,
+				   struct ext4_buf *buf)
+{
+	/* Referenced buffers may push the cache above bc->cnt,
+	 * so keep the load factor below 3/4 by growing the index. */
+	if (4 * (uint64_t)(bc->lba_hash_used + 1) >
+	    3 * (uint64_t)bc->lba_hash_size) {
+		int r = ext4_bcache_hash_resize(bc, bc->lba_hash_size << 1);
+		if (r != EOK)
+			return r;
+	}
+
+	ext4_bcache_hash_place(bc->lba_hash, bc->lba_hash_size, buf);
+	bc->lba_hash_used++;
+	return EOK;
+}
+
+static void ext4_bcache_hash_remove(struct ext4_bcache *bc,
+				    struct ext4_buf *buf)
+{
+	struct ext4_buf_hent *tab = bc->lba_hash;
+	uint32_t mask = bc->lba_hash_size - 1;
+	uint32_t i, j, k;
+
+	i = ext4_bcache_hash(buf->lba, bc->lba_hash_size);
+	while (tab[i].buf != buf) {
+		ext4_assert(tab[i].buf);
+		i = (i + 1) & mask;
+	}
+
+	/* Backward shift deletion: move every following entry of the
+	 * cluster which may legally live in the hole, so that probe
+	 * sequences stay unbroken without tombstones. */
+	for (j = (i + 1) & mask; tab[j].buf; j = (j + 1) & mask) {
+		k = ext4_bcache_hash(tab[j].lba, bc->lba_hash_size);
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			tab[i] = tab[j];
+			i = j;
+		}
+	}
+
+	tab[i].buf = NULL;
+	bc->lba_hash_used--;
+}
+
+/**@brief   Buffer replacement policy operations.
+ *
+ *  The policy only deals with unreferenced buffers: it is told when a
+ *  buffer enters the cache, when it gains its first reference, when it
+ *  loses its last one and when it leaves the cache.*/
+struct ext4_bcache_policy_ops {
+	/**@brief   Policy specific initialization.*/
+	int (*init)(struct ext4_bcache *bc);
+
+	/**@brief   Policy specific de-initialization.*/
+	void (*fini)(struct ext4_bcache *bc);
+
+	/**@brief   Cache capacity (bc->cnt) was changed.*/
+	int (*resize)(struct ext4_bcache *bc);
+
+	/**@brief   A new (referenced) buffer was added to the cache.*/
+	void (*alloc)(struct ext4_bcache *bc, struct ext4_buf *buf);
+
+	/**@brief   An unreferenced buffer is referenced again.*/
+	void (*get)(struct ext4_bcache *bc, struct ext4_buf *buf);
+
+	/**@brief   The last reference of a buffer was dropped.*/
+	void (*put)(struct ext4_bcache *bc, struct ext4_buf *buf);
+
+	/**@brief   A buffer is going to be removed from the cache.*/
+	void (*drop)(struct ext4_bcache *bc, struct ext4_buf *buf);
+
+	/**@brief   Unreferenced buffer which should be evicted next.*/
+	struct ext4_buf *(*victim)(struct ext4_bcache *bc);
+};
+
+/**@brief   Advance LRU clock (shared by all members of a shared cache,
+ *          so that their eviction orders can be compared).*/
+static inline uint32_t ext4_bcache_tick(struct ext4_bcache *bc)
+{
+	if (bc->shared)
+		return ++bc->shared->lru_ctr;
+
+	return ++bc->lru_ctr;
+}
+
+/**@brief   Move the buffer forward in eviction order according to its
+ *          retention priority (called right before it is inserted to
+ *          an eviction queue).*/
+static inline void ext4_bcache_prio_boost(struct ext4_bcache *bc,
+					  struct ext4_buf *buf)
+{
+	buf->lru_id += buf->lru_prio * (bc->cnt / 2);
+}
+
+/**********************************LRU**************************************/
+
+static int ext4_bcache_lru_init(struct ext4_bcache *bc __unused)
+{
+	return EOK;
+}
+
+static void ext4_bcache_lru_fini(struct ext4_bcache *bc __unused)
+{
+}
+
+static int ext4_bcache_lru_resize(struct ext4_bcache *bc __unused)
+{
+	return EOK;
+}
+
+static void ext4_bcache_lru_alloc(struct ext4_bcache *bc,
+				  struct ext4_buf *buf)
+{
+	/* Assign new value to LRU id and increment LRU counter
+	 * by 1*/
+	buf->lru_id = ext4_bcache_tick(bc);
+}
+
+static void ext4_bcache_lru_get(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	buf->lru_id = ext4_bcache_tick(bc);
+	RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+}
+
+static void ext4_bcache_lru_put(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	ext4_bcache_prio_boost(bc, buf);
+	RB_INSERT(ext4_buf_lru, &bc->lru_root, buf);
+}
+
+static void ext4_bcache_lru_drop(struct ext4_bcache *bc,
+				 struct ext4_buf *buf)
+{
+	if (!buf->refctr)
+		RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+}
+
+static struct ext4_buf *ext4_bcache_lru_victim(struct ext4_bcache *bc)
+{
+	return RB_MIN(ext4_buf_lru, &bc->lru_root);
+}
+
+static const struct ext4_bcache_policy_ops ext4_bcache_lru_ops = {
+	.init = ext4_bcache_lru_init,
+	.fini = ext4_bcache_lru_fini,
+	.resize = ext4_bcache_lru_resize,
+	.alloc = ext4_bcache_lru_alloc,
+	.get = ext4_bcache_lru_get,
+	.put = ext4_bcache_lru_put,
+	.drop = ext4_bcache_lru_drop,
+	.victim = ext4_bcache_lru_victim,
+};
+
+/**********************************2Q***************************************/
+
+/**@brief   2Q queues (ext4_buf::lru_queue).*/
+#define EXT4_BCACHE_2Q_AM   0
+#define EXT4_BCACHE_2Q_A1IN 1
+
+/**@brief   A ghost is remembered for (ghost_size / 2) A1in evictions.*/
+static inline bool ext4_bcache_2q_ghost_hit(struct ext4_bcache *bc,
+					    uint64_t lba)
+{
+	uint32_t age;
+	struct ext4_buf_ghost *g;
+
+	g = &bc->ghost[ext4_bcache_hash(lba, bc->ghost_size)];
+	if (!g->seq || g->lba != lba)
+		return false;
+
+	age = bc->ghost_seq - g->seq;
+	g->seq = 0;
+	return age < bc->ghost_size / 2;
+}
+
+static int ext4_bcache_2q_init(struct ext4_bcache *bc)
+{
+	/* Recommended sizes: Kin = 25%, Kout = 50% of the cache. */
+	bc->fifo_max = bc->cnt / 4 ? bc->cnt / 4 : 1;
+	bc->ghost_size = ext4_bcache_hash_size(bc->cnt / 2);
+	bc->ghost = ext4_calloc(bc->ghost_size, sizeof(struct ext4_buf_ghost));
+	if (!bc->ghost)
+		return ENOMEM;
+
+	return EOK;
+}
+
+static void ext4_bcache_2q_fini(struct ext4_bcache *bc)
+{
+	ext4_free(bc->ghost);
+	bc->ghost = NULL;
+}
+
+static int ext4_bcache_2q_resize(struct ext4_bcache *bc)
+{
+	uint32_t size = ext4_bcache_hash_size(bc->cnt / 2);
+	struct ext4_buf_ghost *ghost;
+
+	bc->fifo_max = bc->cnt / 4 ? bc->cnt / 4 : 1;
+	if (size == bc->ghost_size)
+		return EOK;
+
+	/* Ghost history is lost, it only guides admission to Am. */
+	ghost = ext4_calloc(size, sizeof(struct ext4_buf_ghost));
+	if (!ghost)
+		return ENOMEM;
+
+	ext4_free(bc->ghost);
+	bc->ghost = ghost;
+	bc->ghost_size = size;
+	return EOK;
+}
+
+static void ext4_bcache_2q_alloc(struct ext4_bcache *bc,
+				 struct ext4_buf *buf)
+{
+	buf->lru_id = ext4_bcache_tick(bc);
+	if (ext4_bcache_2q_ghost_hit(bc, buf->lba)) {
+		buf->lru_queue = EXT4_BCACHE_2Q_AM;
+	} else {
+		buf->lru_queue = EXT4_BCACHE_2Q_A1IN;
+		bc->fifo_cnt++;
+	}
+}
+
+static void ext4_bcache_2q_get(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	/* References of a buffer in A1in are considered correlated:
+	 * its position in the FIFO does not change. */
+	if (buf->lru_queue == EXT4_BCACHE_2Q_A1IN) {
+		RB_REMOVE(ext4_buf_fifo, &bc->fifo_root, buf);
+		return;
+	}
+
+	buf->lru_id = ext4_bcache_tick(bc);
+	RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+}
+
+static void ext4_bcache_2q_put(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	/* High priority buffers skip the A1in probation. */
+	if (buf->lru_queue == EXT4_BCACHE_2Q_A1IN &&
+	    buf->lru_prio >= EXT4_BCACHE_PRIO_HIGH) {
+		buf->lru_queue = EXT4_BCACHE_2Q_AM;
+		bc->fifo_cnt--;
+	}
+
+	if (buf->lru_queue == EXT4_BCACHE_2Q_A1IN) {
+		RB_INSERT(ext4_buf_fifo, &bc->fifo_root, buf);
+		return;
+	}
+
+	ext4_bcache_prio_boost(bc, buf);
+	RB_INSERT(ext4_buf_lru, &bc->lru_root, buf);
+}
+
+static void ext4_bcache_2q_drop(struct ext4_bcache *bc, struct ext4_buf *buf)
+{
+	struct ext4_buf_ghost *g;
+
+	if (buf->lru_queue != EXT4_BCACHE_2Q_A1IN) {
+		if (!buf->refctr)
+			RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+		return;
+	}
+
+	if (!buf->refctr)
+		RB_REMOVE(ext4_buf_fifo, &bc->fifo_root, buf);
+
+	bc->fifo_cnt--;
+
+	/* Only remember valid data, invalidated and temporary
+	 * buffers are not going to be referenced again. */
+	if (!ext4_bcache_test_flag(buf, BC_UPTODATE) ||
+	    ext4_bcache_test_flag(buf, BC_TMP))
+		return;
+
+	if (!++bc->ghost_seq)
+		++bc->ghost_seq;
+
+	g = &bc->ghost[ext4_bcache_hash(buf->lba, bc->ghost_size)];
+	g->lba = buf->lba;
+	g->seq = bc->ghost_seq;
+}
+
+static struct ext4_buf *ext4_bcache_2q_victim(struct ext4_bcache *bc)
+{
+	struct ext4_buf *buf = NULL;
+
+	if (bc->fifo_cnt > bc->fifo_max)
+		buf = RB_MIN(ext4_buf_fifo, &bc->fifo_root);
+
+	if (!buf)
+		buf = RB_MIN(ext4_buf_lru, &bc->lru_root);
+
+	if (!buf)
+		buf = RB_MIN(ext4_buf_fifo, &bc->fifo_root);
+
+	return buf;
+}
+
+static const struct ext4_bcache_policy_ops ext4_bcache_2q_ops = {
+	.init = ext4_bcache_2q_init,
+	.fini = ext4_bcache_2q_fini,
+	.resize = ext4_bcache_2q_resize,
+	.alloc = ext4_bcache_2q_alloc,
+	.get = ext4_bcache_2q_get,
+	.put = ext4_bcache_2q_put,
+	.drop = ext4_bcache_2q_drop,
+	.victim = ext4_bcache_2q_victim,
+};
+
+/***************************************************************************/
+
+/**@brief   Allocate one memory pool segment of @p cnt buffers:
+ *          descriptors and data buffers are carved out of a single
+ *          allocation, so that a cache miss never goes to the heap.*/
+static struct ext4_bcache_seg *
+ext4_bcache_seg_alloc(struct ext4_bcache_pool *pool, uint32_t cnt)
+{
+	uint32_t i;
+	uintptr_t base;
+	const uintptr_t align = CONFIG_BLOCK_DEV_CACHE_ALIGN;
+	size_t desc_size = sizeof(struct ext4_bcache_seg) +
+			   (size_t)cnt * sizeof(struct ext4_buf);
+	struct ext4_bcache_seg *seg;
+
+	seg = ext4_malloc(desc_size + (size_t)cnt * pool->itemsize +
+			  align - 1);
+	if (!seg)
+		return NULL;
+
+	base = ((uintptr_t)seg + desc_size + align - 1) & ~(align - 1);
+	seg->bufs = (struct ext4_buf *)(seg + 1);
+	seg->data = (uint8_t *)base;
+	seg->cnt = cnt;
+	seg->used = 0;
+	seg->retired = false;
+
+	for (i = 0; i < cnt; i++) {
+		seg->bufs[i].seg = seg;
+		seg->bufs[i].data = seg->data + (size_t)i * pool->itemsize;
+	}
+
+	return seg;
+}
+
+/**@brief   Make unused buffers of segment available for allocation.*/
+static void ext4_bcache_seg_add(struct ext4_bcache_pool *pool,
+				struct ext4_bcache_seg *seg)
+{
+	uint32_t i;
+
+	for (i = seg->cnt; i > 0; i--)
+		SLIST_INSERT_HEAD(&pool->free_list, &seg->bufs[i - 1],
+				  free_node);
+
+	SLIST_INSERT_HEAD(&pool->segs, seg, node);
+	pool->cnt += seg->cnt;
+}
+
+static void ext4_bcache_pool_init(struct ext4_bcache_pool *pool,
+				  uint32_t itemsize)
+{
+	SLIST_INIT(&pool->segs);
+	SLIST_INIT(&pool->free_list);
+	pool->cnt = 0;
+	pool->itemsize = itemsize;
+}
+
+/**@brief   Add segments until the memory pool holds @p cnt buffers.
+ *          Nothing is added on failure.*/
+static int ext4_bcache_pool_grow(struct ext4_bcache_pool *pool,
+				 uint32_t cnt)
+{
+	uint32_t n, total = pool->cnt;
+	struct ext4_bcache_seg *seg;
+	struct ext4_bcache_segs segs = SLIST_HEAD_INITIALIZER(segs);
+
+	while (total < cnt) {
+		n = cnt - total;
+		if (n > CONFIG_BLOCK_DEV_CACHE_SEG_SIZE)
+			n = CONFIG_BLOCK_DEV_CACHE_SEG_SIZE;
+
+		seg = ext4_bcache_seg_alloc(pool, n);
+		if (!seg) {
+			while ((seg = SLIST_FIRST(&segs))) {
+				SLIST_REMOVE_HEAD(&segs, node);
+				ext4_free(seg);
+			}
+			return ENOMEM;
+		}
+
+		SLIST_INSERT_HEAD(&segs, seg, node);
+		total += n;
+	}
+
+	while ((seg = SLIST_FIRST(&segs))) {
+		SLIST_REMOVE_HEAD(&segs, node);
+		ext4_bcache_seg_add(pool, seg);
+	}
+
+	return EOK;
+}
+
+/**@brief   Retire the least used segments, as long as the rest of the
+ *          memory pool still holds @p cnt buffers.
+ * @return  true if any segment was retired*/
+static bool ext4_bcache_pool_retire(struct ext4_bcache_pool *pool,
+				    uint32_t cnt)
+{
+	bool retired = false;
+	struct ext4_buf *buf;
+	struct ext4_bcache_seg *seg, *min;
+	struct ext4_buf_free keep = SLIST_HEAD_INITIALIZER(keep);
+
+	for (;;) {
+		min = NULL;
+		SLIST_FOREACH(seg, &pool->segs, node) {
+			if (seg->retired || pool->cnt - seg->cnt < cnt)
+				continue;
+			if (!min || seg->used < min->used)
+				min = seg;
+		}
+
+		if (!min)
+			break;
+
+		min->retired = true;
+		pool->cnt -= min->cnt;
+		retired = true;
+	}
+
+	if (!retired)
+		return false;
+
+	/* Unused buffers of retired segments leave the free list. */
+	while ((buf = SLIST_FIRST(&pool->free_list))) {
+		SLIST_REMOVE_HEAD(&pool->free_list, free_node);
+		if (!buf->seg->retired)
+			SLIST_INSERT_HEAD(&keep, buf, free_node);
+	}
+	pool->free_list = keep;
+	return true;
+}
+
+/**@brief   Release retired segments with no buffer in use.*/
+static void ext4_bcache_pool_release(struct ext4_bcache_pool *pool)
+{
+	struct ext4_bcache_seg *seg, *tmp;
+
+	SLIST_FOREACH_SAFE(seg, &pool->segs, node, tmp) {
+		if (seg->retired && !seg->used) {
+			SLIST_REMOVE(&pool->segs, seg, ext4_bcache_seg, node);
+			ext4_free(seg);
+		}
+	}
+}
+
+/**@brief   Release all segments of the memory pool.*/
+static void ext4_bcache_pool_fini(struct ext4_bcache_pool *pool)
+{
+	struct ext4_bcache_seg *seg;
+
+	while ((seg = SLIST_FIRST(&pool->segs))) {
+		SLIST_REMOVE_HEAD(&pool->segs, node);
+		ext4_free(seg);
+	}
+
+	SLIST_INIT(&pool->free_list);
+	pool->cnt = 0;
+}
+
+/**@brief   (Re)allocate write-back staging buffer for the current
+ *          cache capacity, never more than 1/4 of the cache.*/
+static int ext4_bcache_flush_buf_init(struct ext4_bcache *bc)
+{
+	void *mem = NULL;
+	uint8_t *flush_buf = NULL;
+	const uintptr_t align = CONFIG_BLOCK_DEV_CACHE_ALIGN;
+	uint32_t flush_max = bc->cnt / 4;
+
+	if (flush_max > CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX)
+		flush_max = CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX;
+	if (flush_max < 2)
+		flush_max = 1;
 
+	if (flush_max == bc->flush_max && (flush_max == 1 || bc->flush_buf))
+		return EOK;
+
+	if (flush_max > 1) {
+		mem = ext4_malloc((size_t)flush_max * bc->itemsize +
+				  align - 1);
+		if (!mem)
+			return ENOMEM;
+
+		flush_buf = (uint8_t *)(((uintptr_t)mem + align - 1) &
+					~(align - 1));
+	}
+
+	ext4_free(bc->flush_mem);
+	bc->flush_mem = mem;
+	bc->flush_buf = flush_buf;
+	bc->flush_max = flush_max;
+	return EOK;
+}
+
+/**@brief   Common part of private and shared block cache
+ *          initialization (memory pool is set up by caller).*/
+static int ext4_bcache_setup(struct ext4_bcache *bc, uint32_t cnt,
+			     uint32_t itemsize, uint32_t hash_cnt,
+			     enum ext4_bcache_policy policy)
+{
+	int r;
+
+	switch (policy) {
+	case EXT4_BCACHE_POLICY_LRU:
+		bc->policy_ops = &ext4_bcache_lru_ops;
+		break;
+	case EXT4_BCACHE_POLICY_2Q:
+		bc->policy_ops = &ext4_bcache_2q_ops;
+		break;
+	default:
+		return EINVAL;
+	}
+
+	bc->lba_hash_size = ext4_bcache_hash_size(hash_cnt);
+	bc->lba_hash = ext4_calloc(bc->lba_hash_size,
+				   sizeof(struct ext4_buf_hent));
+	if (!bc->lba_hash)
+		return ENOMEM;
+
+	bc->policy = policy;
 	bc->cnt = cnt;
 	bc->itemsize = itemsize;
 	bc->ref_blocks = 0;
 	bc->max_ref_blocks = 0;
 
+	r = ext4_bcache_flush_buf_init(bc);
+	if (r == EOK)
+		r = bc->policy_ops->init(bc);
+
+	if (r != EOK) {
+		ext4_free(bc->flush_mem);
+		ext4_free(bc->lba_hash);
+		bc->flush_mem = NULL;
+		bc->flush_buf = NULL;
+		bc->lba_hash = NULL;
+	}
+
+	return r;
+}
+
+int ext4_bcache_init_dynamic(struct ext4_bcache *bc, uint32_t cnt,
+			     uint32_t itemsize)
+{
+	return ext4_bcache_init_dynamic2(bc, cnt, itemsize,
+					 CONFIG_BLOCK_DEV_CACHE_POLICY);
+}
+
+int ext4_bcache_init_dynamic2(struct ext4_bcache *bc, uint32_t cnt,
+			      uint32_t itemsize,
+			      enum ext4_bcache_policy policy)
+{
+	int r;
+	ext4_assert(bc && cnt && itemsize);
+
+	memset(bc, 0, sizeof(struct ext4_bcache));
+
+	bc->pool = &bc->local_pool;
+	ext4_bcache_pool_init(bc->pool, itemsize);
+	r = ext4_bcache_pool_grow(bc->pool, cnt);
+	if (r != EOK)
+		return r;
+
+	r = ext4_bcache_setup(bc, cnt, itemsize, cnt, policy);
+	if (r != EOK)
+		ext4_bcache_pool_fini(bc->pool);
+
+	return r;
+}
+
+int ext4_bcache_shared_init(struct ext4_bcache_shared *sc, uint32_t cnt,
+			    uint32_t itemsize)
+{
+	int r;
+	ext4_assert(sc && cnt && itemsize);
+
+	memset(sc, 0, sizeof(struct ext4_bcache_shared));
+	SLIST_INIT(&sc->member_list);
+	ext4_bcache_pool_init(&sc->pool, itemsize);
+
+	r = ext4_bcache_pool_grow(&sc->pool, cnt);
+	if (r != EOK)
+		return r;
+
+	sc->cnt = cnt;
+	return EOK;
+}
+
+int ext4_bcache_shared_fini(struct ext4_bcache_shared *sc)
+{
+	if (sc->members)
+		return EBUSY;
+
+	ext4_bcache_pool_fini(&sc->pool);
+	memset(sc, 0, sizeof(struct ext4_bcache_shared));
 	return EOK;
 }
 
+int ext4_bcache_init_shared(struct ext4_bcache *bc,
+			    struct ext4_bcache_shared *sc,
+			    enum ext4_bcache_policy policy)
+{
+	int r;
+	ext4_assert(bc && sc && sc->cnt);
+
+	memset(bc, 0, sizeof(struct ext4_bcache));
+
+	/* A member may use the whole budget, its index starts small
+	 * and grows with the buffers it actually holds. */
+	bc->pool = &sc->pool;
+	r = ext4_bcache_setup(bc, sc->cnt, sc->pool.itemsize,
+			      CONFIG_BLOCK_DEV_CACHE_SIZE, policy);
+	if (r != EOK)
+		return r;
+
+	bc->shared = sc;
+	SLIST_INSERT_HEAD(&sc->member_list, bc, shared_node);
+	sc->members++;
+	return EOK;
+}
+
+struct ext4_bcache *ext4_bcache_victim_cache(struct ext4_bcache *bc)
+{
+	struct ext4_bcache_shared *sc = bc->shared;
+	struct ext4_bcache *m, *best = NULL;
+	struct ext4_buf *buf, *best_buf = NULL;
+	uint32_t share;
+
+	if (!sc || bc->ref_blocks + 1 > bc->cnt)
+		return bc;
+
+	/* Members holding at most half of an equal split of the budget
+	 * are left alone, unless nobody else has anything to give. */
+	share = sc->cnt / (2 * sc->members);
+	SLIST_FOREACH(m, &sc->member_list, shared_node) {
+		if (m->ref_blocks <= share)
+			continue;
+
+		buf = m->policy_ops->victim(m);
+		if (buf && (!best_buf || buf->lru_id < best_buf->lru_id)) {
+			best = m;
+			best_buf = buf;
+		}
+	}
+
+	if (best)
+		return best;
+
+	if (bc->policy_ops->victim(bc))
+		return bc;
+
+	SLIST_FOREACH(m, &sc->member_list, shared_node) {
+		if (m->policy_ops->victim(m))
+			return m;
+	}
+
+	return NULL;
+}
+
+/**@brief   Write back and drop unreferenced buffers of retired
+ *          memory pool segments.*/
+static int ext4_bcache_drop_retired(struct ext4_bcache *bc)
+{
+	int r = EOK;
+	struct ext4_buf *buf, *next;
+
+	/* The next buffer is looked up only after the write,
+	 * end_write callbacks may touch the cache. */
+	buf = RB_MIN(ext4_buf_lba, &bc->lba_root);
+	while (buf) {
+		if (buf->refctr || !buf->seg || !buf->seg->retired) {
+			buf = RB_NEXT(ext4_buf_lba, &bc->lba_root, buf);
+			continue;
+		}
+
+		if (ext4_bcache_test_flag(buf, BC_DIRTY)) {
+			r = ext4_block_flush_buf(bc->bdev, buf);
+			if (r != EOK)
+				break;
+
+			bc->stats[buf->cls].dirty_evictions++;
+		}
+
+		bc->stats[buf->cls].evictions++;
+		next = RB_NEXT(ext4_buf_lba, &bc->lba_root, buf);
+		ext4_bcache_drop_buf(bc, buf);
+		buf = next;
+	}
+
+	return r;
+}
+
+/**@brief   Apply new capacity to staging buffer and policy.*/
+static int ext4_bcache_set_cnt(struct ext4_bcache *bc, uint32_t cnt)
+{
+	int r;
+	uint32_t old_cnt = bc->cnt;
+
+	bc->cnt = cnt;
+	r = ext4_bcache_flush_buf_init(bc);
+	if (r == EOK)
+		r = bc->policy_ops->resize(bc);
+	if (r != EOK) {
+		bc->cnt = old_cnt;
+		ext4_bcache_flush_buf_init(bc);
+		bc->policy_ops->resize(bc);
+	}
+
+	return r;
+}
+
+/**@brief   Resize the budget of a shared cache (and all members).*/
+static int ext4_bcache_shared_resize(struct ext4_bcache_shared *sc,
+				     uint32_t cnt)
+{
+	int r = EOK, rr;
+	struct ext4_bcache *m, *n;
+
+	if (cnt > sc->pool.cnt) {
+		r = ext4_bcache_pool_grow(&sc->pool, cnt);
+		if (r != EOK)
+			return r;
+	}
+
+	SLIST_FOREACH(m, &sc->member_list, shared_node) {
+		r = ext4_bcache_set_cnt(m, cnt);
+		if (r != EOK)
+			break;
+	}
+
+	if (r == EOK) {
+		sc->cnt = cnt;
+	} else {
+		/* Restore the members resized already (m restored itself) */
+		SLIST_FOREACH(n, &sc->member_list, shared_node) {
+			if (n == m)
+				break;
+			ext4_bcache_set_cnt(n, sc->cnt);
+		}
+	}
+
+	/* Retire segments beyond the budget (those grown above on failure) */
+	if (ext4_bcache_pool_retire(&sc->pool, sc->cnt)) {
+		SLIST_FOREACH(n, &sc->member_list, shared_node) {
+			rr = ext4_bcache_drop_retired(n);
+			if (rr != EOK) {
+				if (r == EOK)
+					r = rr;
+				break;
+			}
+		}
+
+		ext4_bcache_pool_release(&sc->pool);
+	}
+
+	return r;
+}
+
+int ext4_bcache_resize(struct ext4_bcache *bc, uint32_t cnt)
+{
+	int r;
+	uint32_t size;
+
+	ext4_assert(cnt);
+
+	if (bc->shared)
+		return ext4_bcache_shared_resize(bc->shared, cnt);
+
+	if (cnt > bc->pool->cnt) {
+		r = ext4_bcache_pool_grow(bc->pool, cnt);
+		if (r != EOK)
+			return r;
+	}
+
+	r = ext4_bcache_set_cnt(bc, cnt);
+	if (r != EOK) {
+		/* Give back the segments grown above */
+		if (ext4_bcache_pool_retire(bc->pool, bc->cnt)) {
+			ext4_bcache_drop_retired(bc);
+			ext4_bcache_pool_release(bc->pool);
+		}
+		return r;
+	}
+
+	if (ext4_bcache_pool_retire(bc->pool, cnt)) {
+		r = ext4_bcache_drop_retired(bc);
+		ext4_bcache_pool_release(bc->pool);
+	}
+
+	/* Shrink the index too, unless referenced buffers need it. */
+	size = ext4_bcache_hash_size(cnt > bc->ref_blocks ?
+				     cnt : bc->ref_blocks);
+	if (size > bc->lba_hash_size ||
+	    (size < bc->lba_hash_size &&
+	     4 * (uint64_t)bc->lba_hash_used < 3 * (uint64_t)size))
+		ext4_bcache_hash_resize(bc, size);
+
+	return r;
+}
+
+void ext4_bcache_unpin_all(struct ext4_bcache *bc)
+{
+	struct ext4_buf *buf, *tmp;
+	RB_FOREACH_SAFE(buf, ext4_buf_lba, &bc->lba_root, tmp) {
+		struct ext4_block b = {
+			.lb_id = buf->lba,
+			.buf = buf,
+			.data = buf->data
+		};
+
+		if (!ext4_bcache_test_flag(buf, BC_PINNED))
+			continue;
+
+		ext4_bcache_clear_flag(buf, BC_PINNED);
+		bc->pinned_cnt--;
+		ext4_bcache_free(bc, &b);
+	}
+}
+
 void ext4_bcache_cleanup(struct ext4_bcache *bc)
 {
 	struct ext4_buf *buf, *tmp;
@@ -93,6 +968,19 @@ void ext4_bcache_cleanup(struct ext4_bcache *bc)
 
 int ext4_bcache_fini_dynamic(struct ext4_bcache *bc)
 {
+	if (bc->policy_ops)
+		bc->policy_ops->fini(bc);
+
+	if (bc->shared) {
+		SLIST_REMOVE(&bc->shared->member_list, bc, ext4_bcache,
+			     shared_node);
+		bc->shared->members--;
+	} else if (bc->pool) {
+		ext4_bcache_pool_fini(bc->pool);
+	}
+
+	ext4_free(bc->flush_mem);
+	ext4_free(bc->lba_hash);
 	memset(bc, 0, sizeof(struct ext4_bcache));
 	return EOK;
 }
@@ -101,61 +989,130 @@ int ext4_bcache_fini_dynamic(struct ext4_bcache *bc)
  *
  *  This is ext4_bcache, the module handling basic buffer-cache stuff.
  *
- *  Buffers in a bcache are sorted by their LBA and stored in a
- *  RB-Tree(lba_root).
+ *  Descriptors and data buffers of the first bc->cnt buffers come from
+ *  a memory pool preallocated by ext4_bcache_init_dynamic, and go back
+ *  to its free_list when dropped. Only when all of them are referenced
+ *  a buffer is allocated from heap (counted in heap_allocs).
+ *
+ *  The pool is made of segments, so that ext4_bcache_resize can grow it
+ *  and give memory back when shrinking. Buffers of a retired segment are
+ *  not reused, the segment is freed with its last buffer. Member caches
+ *  of a shared cache (ext4_bcache_shared) take their buffers from its
+ *  pool instead of a private one.
  *
- *  Bcache also maintains another RB-Tree(lru_root) right now, where
- *  buffers are sorted by their LRU id.
+ *  Buffers in a bcache are indexed by their LBA in an open-addressing
+ *  hash table(lba_hash), which serves all point lookups. They are
+ *  also sorted by their LBA in a RB-Tree(lba_root), which is only
+ *  used by range operations.
+ *
+ *  Unreferenced buffers are handed over to the buffer replacement
+ *  policy (policy_ops), which picks the buffer to evict when the cache
+ *  is full. The LRU policy keeps them in another RB-Tree(lru_root),
+ *  where buffers are sorted by their LRU id. The 2Q policy splits them
+ *  between a FIFO(fifo_root, first references) and lru_root
+ *  (re-referenced buffers).
  *
  *  A singly-linked list is used to track those dirty buffers which are
  *  ready to be flushed. (Those buffers which are dirty but also referenced
  *  are not considered ready to be flushed.)
  *
- *  When a buffer is not referenced, it will be stored in both lba_root
- *  and lru_root, while it will only be stored in lba_root when it is
- *  referenced.
+ *  When a buffer is not referenced, it will be stored in lba_hash,
+ *  lba_root and the policy structures, while it will only be stored in
+ *  lba_hash and lba_root when it is referenced.
  */
 
 static struct ext4_buf *
 ext4_buf_alloc(struct ext4_bcache *bc, uint64_t lba)
 {
 	void *data;
-	struct ext4_buf *buf;
-	data = ext4_malloc(bc->itemsize);
-	if (!data)
-		return NULL;
+	struct ext4_bcache_seg *seg = NULL;
+	struct ext4_buf *buf = SLIST_FIRST(&bc->pool->free_list);
 
-	buf = ext4_calloc(1, sizeof(struct ext4_buf));
-	if (!buf) {
-		ext4_free(data);
-		return NULL;
+	if (buf) {
+		SLIST_REMOVE_HEAD(&bc->pool->free_list, free_node);
+		data = buf->data;
+		seg = buf->seg;
+		memset(buf, 0, sizeof(struct ext4_buf));
+		seg->used++;
+		bc->pool_allocs++;
+	} else {
+		/* Every pool buffer is referenced. */
+		data = ext4_malloc(bc->itemsize);
+		if (!data)
+			return NULL;
+
+		buf = ext4_calloc(1, sizeof(struct ext4_buf));
+		if (!buf) {
+			ext4_free(data);
+			return NULL;
+		}
+		bc->heap_allocs++;
 	}
 
 	buf->lba = lba;
 	buf->data = data;
+	buf->seg = seg;
 	buf->bc = bc;
 	return buf;
 }
 
-static void ext4_buf_free(struct ext4_buf *buf)
+static void ext4_buf_free(struct ext4_bcache *bc, struct ext4_buf *buf)
 {
+	struct ext4_bcache_seg *seg = buf->seg;
+
+	/* Mapped buffer: give the pool memory back to it. */
+	if (ext4_bcache_test_flag(buf, BC_MAPPED))
+		buf->data = seg ? seg->data + (size_t)(buf - seg->bufs) *
+					      bc->pool->itemsize : NULL;
+
+	if (seg) {
+		seg->used--;
+		if (!seg->retired) {
+			SLIST_INSERT_HEAD(&bc->pool->free_list, buf, free_node);
+		} else if (!seg->used) {
+			SLIST_REMOVE(&bc->pool->segs, seg, ext4_bcache_seg,
+				     node);
+			ext4_free(seg);
+		}
+		return;
+	}
+
 	ext4_free(buf->data);
 	ext4_free(buf);
 }
 
-static struct ext4_buf *
-ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba)
+void ext4_bcache_map(struct ext4_bcache *bc, struct ext4_buf *buf,
+		     void *data)
 {
-	struct ext4_buf tmp = {
-		.lba = lba
-	};
+	ext4_assert(!ext4_bcache_test_flag(buf, BC_DIRTY));
+
+	/* Heap buffer memory is not needed anymore. */
+	if (!ext4_bcache_test_flag(buf, BC_MAPPED) && !buf->seg)
+		ext4_free(buf->data);
+
+	buf->data = data;
+	ext4_bcache_set_flag(buf, BC_MAPPED);
+	ext4_bcache_set_flag(buf, BC_UPTODATE);
+	bc->maps++;
+}
 
-	return RB_FIND(ext4_buf_lba, &bc->lba_root, &tmp);
+struct ext4_buf *ext4_buf_lookup(struct ext4_bcache *bc, uint64_t lba)
+{
+	struct ext4_buf_hent *tab = bc->lba_hash;
+	uint32_t mask = bc->lba_hash_size - 1;
+	uint32_t i = ext4_bcache_hash(lba, bc->lba_hash_size);
+
+	for (; tab[i].buf; i = (i + 1) & mask) {
+		if (tab[i].lba == lba)
+			return tab[i].buf;
+	}
+
+	return NULL;
 }
 
 struct ext4_buf *ext4_buf_lowest_lru(struct ext4_bcache *bc)
 {
-	return RB_MIN(ext4_buf_lru, &bc->lru_root);
+	return bc->policy_ops->victim(bc);
 }
 
 void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
@@ -165,17 +1122,24 @@ void ext4_bcache_drop_buf(struct ext4_bcache *bc, struct ext4_buf *buf)
 		ext4_dbg(DEBUG_BCACHE, DBG_WARN "Buffer is still referenced. "
 				"lba: %" PRIu64 ", refctr: %" PRIu32 "\n",
 				buf->lba, buf->refctr);
-	} else
-		RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
+	}
+
+	bc->policy_ops->drop(bc, buf);
 
 	RB_REMOVE(ext4_buf_lba, &bc->lba_root, buf);
+	ext4_bcache_hash_remove(bc, buf);
 
 	/*Forcibly drop dirty buffer.*/
 	if (ext4_bcache_test_flag(buf, BC_DIRTY))
 		ext4_bcache_remove_dirty_node(bc, buf);
 
-	ext4_buf_free(buf);
+	if (ext4_bcache_test_flag(buf, BC_PREFETCH) && bc->bdev)
+		bc->bdev->ra_waste++;
+
+	ext4_buf_free(bc, buf);
 	bc->ref_blocks--;
+	if (bc->shared)
+		bc->shared->ref_blocks--;
 }
 
 void ext4_bcache_invalidate_buf(struct ext4_bcache *bc,
@@ -196,8 +1160,14 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
 				uint32_t cnt)
 {
 	uint64_t end = from + cnt - 1;
-	struct ext4_buf *tmp = ext4_buf_lookup(bc, from), *buf;
-	RB_FOREACH_FROM(buf, ext4_buf_lba, tmp) {
+	struct ext4_buf tmp = {
+		.lba = from
+	};
+	struct ext4_buf *buf, *next;
+
+	/* The first cached buffer at or after @from. */
+	next = RB_NFIND(ext4_buf_lba, &bc->lba_root, &tmp);
+	RB_FOREACH_FROM(buf, ext4_buf_lba, next) {
 		if (buf->lba > end)
 			break;
 
@@ -205,6 +1175,120 @@ void ext4_bcache_invalidate_lba(struct ext4_bcache *bc,
 	}
 }
 
+struct ext4_buf *ext4_bcache_find_dirty(struct ext4_bcache *bc,
+					uint64_t from, uint32_t cnt)
+{
+	uint64_t end = from + cnt - 1;
+	struct ext4_buf tmp = {
+		.lba = from
+	};
+	struct ext4_buf *buf, *next;
+
+	if (!cnt)
+		return NULL;
+
+	next = RB_NFIND(ext4_buf_lba, &bc->lba_root, &tmp);
+	RB_FOREACH_FROM(buf, ext4_buf_lba, next) {
+		if (buf->lba > end)
+			break;
+
+		if (ext4_bcache_test_flag(buf, BC_DIRTY) &&
+		    ext4_bcache_test_flag(buf, BC_UPTODATE))
+			return buf;
+	}
+
+	return NULL;
+}
+
+void ext4_bcache_sort_dirty(struct ext4_bcache *bc)
+{
+	struct ext4_buf *list = SLIST_FIRST(&bc->dirty_list);
+	struct ext4_buf *p, *q, *e, *tail;
+	uint32_t width, merges, psize, qsize;
+
+	if (!list)
+		return;
+
+	/* Bottom-up merge sort, the list is sorted in place. */
+	for (width = 1;; width *= 2) {
+		p = list;
+		list = tail = NULL;
+		merges = 0;
+
+		while (p) {
+			merges++;
+			q = p;
+			for (psize = 0; psize < width && q; psize++)
+				q = SLIST_NEXT(q, dirty_node);
+
+			qsize = width;
+			while (psize || (qsize && q)) {
+				if (!psize) {
+					e = q;
+					q = SLIST_NEXT(q, dirty_node);
+					qsize--;
+				} else if (!qsize || !q || p->lba <= q->lba) {
+					e = p;
+					p = SLIST_NEXT(p, dirty_node);
+					psize--;
+				} else {
+					e = q;
+					q = SLIST_NEXT(q, dirty_node);
+					qsize--;
+				}
+
+				if (tail)
+					SLIST_NEXT(tail, dirty_node) = e;
+				else
+					list = e;
+				tail = e;
+			}
+
+			p = q;
+		}
+
+		SLIST_NEXT(tail, dirty_node) = NULL;
+		if (merges <= 1)
+			break;
+	}
+
+	SLIST_FIRST(&bc->dirty_list) = list;
+}
+
+uint32_t ext4_bcache_dirty_run(struct ext4_bcache *bc, struct ext4_buf *buf,
+			       struct ext4_buf **run)
+{
+	struct ext4_buf *first = buf, *last = buf, *b;
+	uint32_t cnt = 1;
+
+	while (cnt < bc->flush_max) {
+		b = RB_PREV(ext4_buf_lba, &bc->lba_root, first);
+		if (!b || b->lba + 1 != first->lba ||
+		    !ext4_bcache_buf_mergeable(b))
+			break;
+
+		first = b;
+		cnt++;
+	}
+
+	while (cnt < bc->flush_max) {
+		b = RB_NEXT(ext4_buf_lba, &bc->lba_root, last);
+		if (!b || b->lba != last->lba + 1 ||
+		    !ext4_bcache_buf_mergeable(b))
+			break;
+
+		last = b;
+		cnt++;
+	}
+
+	for (cnt = 0, b = first; b != last;
+	     b = RB_NEXT(ext4_buf_lba, &bc->lba_root, b))
+		run[cnt++] = b;
+
+	run[cnt++] = last;
+	return cnt;
+}
+
 struct ext4_buf *
 ext4_bcache_find_get(struct ext4_bcache *bc, struct ext4_block *b,
 		     uint64_t lba)
@@ -212,15 +1296,11 @@ ext4_bcache_find_get(struct ext4_bcache *bc, struct ext4_block *b,
 	struct ext4_buf *buf = ext4_buf_lookup(bc, lba);
 	if (buf) {
 		/* If buffer is not referenced. */
-		if (!buf->refctr) {
-			/* Assign new value to LRU id and increment LRU counter
-			 * by 1*/
-			buf->lru_id = ++bc->lru_ctr;
-			RB_REMOVE(ext4_buf_lru, &bc->lru_root, buf);
-			if (ext4_bcache_test_flag(buf, BC_DIRTY))
-				ext4_bcache_remove_dirty_node(bc, buf);
+		if (!buf->refctr)
+			bc->policy_ops->get(bc, buf);
 
-		}
+		/* Only unused (possibly pinned) buffers are on dirty list. */
+		ext4_bcache_remove_dirty_node(bc, buf);
 
 		ext4_bcache_inc_ref(buf);
 
@@ -246,9 +1326,16 @@ int ext4_bcache_alloc(struct ext4_bcache *bc, struct ext4_block *b,
 	if (!buf)
 		return ENOMEM;
 
+	if (ext4_bcache_hash_insert(bc, buf) != EOK) {
+		ext4_buf_free(bc, buf);
+		return ENOMEM;
+	}
+
 	RB_INSERT(ext4_buf_lba, &bc->lba_root, buf);
 	/* One more buffer in bcache now. :-) */
 	bc->ref_blocks++;
+	if (bc->shared)
+		bc->shared->ref_blocks++;
 
 	/*Calc ref blocks max depth*/
 	if (bc->max_ref_blocks < bc->ref_blocks)
@@ -256,9 +1343,7 @@ int ext4_bcache_alloc(struct ext4_bcache *bc, struct ext4_block *b,
 
 
 	ext4_bcache_inc_ref(buf);
-	/* Assign new value to LRU id and increment LRU counter
-	 * by 1*/
-	buf->lru_id = ++bc->lru_ctr;
+	bc->policy_ops->alloc(bc, buf);
 
 	b->buf = buf;
 	b->data = buf->data;
@@ -285,9 +1370,12 @@ int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b)
 	/*Just decrease reference counter*/
 	ext4_bcache_dec_ref(buf);
 
-	/* We are the last one touching this buffer, do the cleanups. */
-	if (!buf->refctr) {
-		RB_INSERT(ext4_buf_lru, &bc->lru_root, buf);
+	if (!buf->refctr)
+		bc->policy_ops->put(bc, buf);
+
+	/* We are the last one touching this buffer (pin does not count),
+	 * do the cleanups. */
+	if (buf->refctr == (uint32_t)ext4_bcache_test_flag(buf, BC_PINNED)) {
 		/* This buffer is ready to be flushed. */
 		if (ext4_bcache_test_flag(buf, BC_DIRTY) &&
 		    ext4_bcache_test_flag(buf, BC_UPTODATE)) {
@@ -302,8 +1390,9 @@ int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b)
 		}
 
 		/* The buffer is invalidated...drop it. */
-		if (!ext4_bcache_test_flag(buf, BC_UPTODATE) ||
-		    ext4_bcache_test_flag(buf, BC_TMP))
+		if (!buf->refctr &&
+		    (!ext4_bcache_test_flag(buf, BC_UPTODATE) ||
+		     ext4_bcache_test_flag(buf, BC_TMP)))
 			ext4_bcache_drop_buf(bc, buf);
 
 	}
@@ -316,6 +1405,9 @@ int ext4_bcache_free(struct ext4_bcache *bc, struct ext4_block *b)
 
 bool ext4_bcache_is_full(struct ext4_bcache *bc)
 {
+	if (bc->shared && bc->shared->cnt <= bc->shared->ref_blocks)
+		return true;
+
 	return (bc->cnt <= bc->ref_blocks);
 }
 
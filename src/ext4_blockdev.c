@@ -65,12 +65,90 @@ static void ext4_bdif_unlock(struct ext4_blockdev *bdev)
 	ext4_assert(r == EOK);
 }
 
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+static void ext4_bdev_hist_add(struct ext4_bdev_hist *hist, uint64_t v)
+{
+	uint32_t b = 0;
+	uint64_t x = v ? v - 1 : 0;
+
+	while (x && b < EXT4_BDEV_HIST_BUCKETS - 1) {
+		x >>= 1;
+		b++;
+	}
+
+	hist->cnt++;
+	hist->sum += v;
+	if (v > hist->max)
+		hist->max = v;
+	hist->bucket[b]++;
+}
+
+/**@brief   Operation start time (zero without a clock).*/
+static uint64_t ext4_bdif_stamp(struct ext4_blockdev *bdev)
+{
+	return bdev->bdif->now_us ? bdev->bdif->now_us() : 0;
+}
+
+/**@brief   Account a synchronous device call started at @p stamp.*/
+static void ext4_bdif_account(struct ext4_blockdev *bdev,
+			      enum ext4_bdev_op op, uint64_t stamp,
+			      uint64_t blk_cnt)
+{
+	struct ext4_blockdev_stats *st = &bdev->bdif->stats;
+
+	if (bdev->bdif->now_us)
+		ext4_bdev_hist_add(&st->lat[op], bdev->bdif->now_us() - stamp);
+
+	if (op == EXT4_BDEV_OP_READ || op == EXT4_BDEV_OP_WRITE)
+		ext4_bdev_hist_add(&st->size[op],
+				   blk_cnt * bdev->bdif->ph_bsize);
+}
+
+/**@brief   Physical blocks of a vectored request.*/
+static uint64_t ext4_bdif_iov_blocks(const struct ext4_blockdev_iovec *iov,
+				     uint32_t iovcnt)
+{
+	uint64_t cnt = 0;
+
+	while (iovcnt--)
+		cnt += iov[iovcnt].blk_cnt;
+
+	return cnt;
+}
+#else
+#define ext4_bdif_stamp(bdev) 0
+#define ext4_bdif_account(...)
+#define ext4_bdif_iov_blocks(...) 0
+#endif
+
+/**@brief   Device read, the bdif lock is held by the caller.*/
+static int __ext4_bdif_bread(struct ext4_blockdev *bdev, void *buf,
+			     uint64_t blk_id, uint32_t blk_cnt)
+{
+	uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+	int r = bdev->bdif->bread(bdev, buf, blk_id, blk_cnt);
+	ext4_bdif_account(bdev, EXT4_BDEV_OP_READ, stamp, blk_cnt);
+	bdev->bdif->bread_ctr++;
+	return r;
+}
+
+/**@brief   Device write, the bdif lock is held by the caller.*/
+static int __ext4_bdif_bwrite(struct ext4_blockdev *bdev, const void *buf,
+			      uint64_t blk_id, uint32_t blk_cnt)
+{
+	uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+	int r = bdev->bdif->bwrite(bdev, buf, blk_id, blk_cnt);
+	ext4_bdif_account(bdev, EXT4_BDEV_OP_WRITE, stamp, blk_cnt);
+	bdev->bdif->bwrite_ctr++;
+	bdev->bdif->flush_pending = true;
+	return r;
+}
+
 static int ext4_bdif_bread(struct ext4_blockdev *bdev, void *buf,
 			   uint64_t blk_id, uint32_t blk_cnt)
 {
 	ext4_bdif_lock(bdev);
-	int r = bdev->bdif->bread(bdev, buf, blk_id, blk_cnt);
-	bdev->bdif->bread_ctr++;
+	int r = __ext4_bdif_bread(bdev, buf, blk_id, blk_cnt);
 	ext4_bdif_unlock(bdev);
 	return r;
 }
@@ -79,12 +157,123 @@ static int ext4_bdif_bwrite(struct ext4_blockdev *bdev, const void *buf,
 			    uint64_t blk_id, uint32_t blk_cnt)
 {
 	ext4_bdif_lock(bdev);
-	int r = bdev->bdif->bwrite(bdev, buf, blk_id, blk_cnt);
+	int r = __ext4_bdif_bwrite(bdev, buf, blk_id, blk_cnt);
+	ext4_bdif_unlock(bdev);
+	return r;
+}
+
+static int ext4_bdif_flush(struct ext4_blockdev *bdev)
+{
+	int r = EOK;
+
+	ext4_bdif_lock(bdev);
+	if (bdev->bdif->flush && bdev->bdif->flush_pending) {
+		uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+		r = bdev->bdif->flush(bdev);
+		ext4_bdif_account(bdev, EXT4_BDEV_OP_FLUSH, stamp, 0);
+		bdev->bdif->flush_ctr++;
+		if (r == EOK)
+			bdev->bdif->flush_pending = false;
+	}
+	ext4_bdif_unlock(bdev);
+	return r;
+}
+
+static int ext4_bdif_bwrite_fua(struct ext4_blockdev *bdev, const void *buf,
+				uint64_t blk_id, uint32_t blk_cnt)
+{
+	int r;
+
+	if (!bdev->bdif->bwrite_fua) {
+		r = ext4_bdif_bwrite(bdev, buf, blk_id, blk_cnt);
+		if (r != EOK)
+			return r;
+
+		return ext4_bdif_flush(bdev);
+	}
+
+	ext4_bdif_lock(bdev);
+	uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+	r = bdev->bdif->bwrite_fua(bdev, buf, blk_id, blk_cnt);
+	ext4_bdif_account(bdev, EXT4_BDEV_OP_WRITE, stamp, blk_cnt);
 	bdev->bdif->bwrite_ctr++;
 	ext4_bdif_unlock(bdev);
 	return r;
 }
 
+static int ext4_bdif_breadv(struct ext4_blockdev *bdev,
+			    const struct ext4_blockdev_iovec *iov,
+			    uint32_t iovcnt)
+{
+	int r = EOK;
+	uint32_t i;
+
+	if (!bdev->bdif->breadv) {
+		for (i = 0; i < iovcnt && r == EOK; i++)
+			r = ext4_bdif_bread(bdev, iov[i].buf, iov[i].blk_id,
+					    iov[i].blk_cnt);
+		return r;
+	}
+
+	ext4_bdif_lock(bdev);
+	uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+	r = bdev->bdif->breadv(bdev, iov, iovcnt);
+	ext4_bdif_account(bdev, EXT4_BDEV_OP_READ, stamp,
+			  ext4_bdif_iov_blocks(iov, iovcnt));
+	bdev->bdif->bread_ctr++;
+	ext4_bdif_unlock(bdev);
+	return r;
+}
+
+static int ext4_bdif_bwritev(struct ext4_blockdev *bdev,
+			     const struct ext4_blockdev_iovec *iov,
+			     uint32_t iovcnt)
+{
+	int r = EOK;
+	uint32_t i;
+
+	if (!bdev->bdif->bwritev) {
+		for (i = 0; i < iovcnt && r == EOK; i++)
+			r = ext4_bdif_bwrite(bdev, iov[i].buf, iov[i].blk_id,
+					     iov[i].blk_cnt);
+		return r;
+	}
+
+	ext4_bdif_lock(bdev);
+	uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+	r = bdev->bdif->bwritev(bdev, iov, iovcnt);
+	ext4_bdif_account(bdev, EXT4_BDEV_OP_WRITE, stamp,
+			  ext4_bdif_iov_blocks(iov, iovcnt));
+	bdev->bdif->bwrite_ctr++;
+	bdev->bdif->flush_pending = true;
+	ext4_bdif_unlock(bdev);
+	return r;
+}
+
+/**@brief   Fill I/O segment of @p cnt logical blocks.*/
+static void ext4_block_iov_set(struct ext4_blockdev *bdev,
+			       struct ext4_blockdev_iovec *iov, uint64_t lba,
+			       uint32_t cnt, void *buf)
+{
+	uint32_t pb_cnt = bdev->lg_bsize / bdev->bdif->ph_bsize;
+
+	iov->blk_id = (lba * bdev->lg_bsize + bdev->part_offset) /
+		      bdev->bdif->ph_bsize;
+	iov->blk_cnt = pb_cnt * cnt;
+	iov->buf = buf;
+}
+
+/**@brief   Requests of the device are asynchronous (submit/poll).*/
+static bool ext4_block_aio(struct ext4_blockdev *bdev)
+{
+#if CONFIG_BLOCK_DEV_ENABLE_AIO
+	return bdev->bdif->submit != NULL;
+#else
+	(void)bdev;
+	return false;
+#endif
+}
+
 int ext4_block_init(struct ext4_blockdev *bdev)
 {
 	int rc;
@@ -94,6 +283,19 @@ int ext4_block_init(struct ext4_blockdev *bdev)
 		   bdev->bdif->close &&
 		   bdev->bdif->bread &&
 		   bdev->bdif->bwrite);
+	ext4_assert(!bdev->bdif->submit || bdev->bdif->poll);
+
+	if (!bdev->aio_inflight) {
+#if CONFIG_BLOCK_DEV_ENABLE_AIO
+		uint32_t i;
+
+		SLIST_INIT(&bdev->aio_free);
+		for (i = 0; i < CONFIG_BLOCK_DEV_AIO_DEPTH; i++)
+			SLIST_INSERT_HEAD(&bdev->aio_free, &bdev->aio_reqs[i],
+					  node);
+#endif
+		bdev->aio_err = EOK;
+	}
 
 	if (bdev->bdif->ph_refctr) {
 		bdev->bdif->ph_refctr++;
@@ -112,6 +314,9 @@ int ext4_block_init(struct ext4_blockdev *bdev)
 int ext4_block_bind_bcache(struct ext4_blockdev *bdev, struct ext4_bcache *bc)
 {
 	ext4_assert(bdev && bc);
+	if (bc->shared && bdev->lg_bsize != bc->itemsize)
+		return ENOTSUP;
+
 	bdev->bc = bc;
 	bc->bdev = bdev;
 	return EOK;
@@ -148,7 +353,18 @@ int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 
 	if (ext4_bcache_test_flag(buf, BC_DIRTY) &&
 	    ext4_bcache_test_flag(buf, BC_UPTODATE)) {
-		r = ext4_blocks_set_direct(bdev, buf->data, buf->lba, 1);
+		if (ext4_bcache_test_flag(buf, BC_FUA)) {
+			struct ext4_blockdev_iovec iov;
+
+			ext4_block_iov_set(bdev, &iov, buf->lba, 1, buf->data);
+			r = ext4_bdif_bwrite_fua(bdev, buf->data, iov.blk_id,
+						 iov.blk_cnt);
+			if (r == EOK)
+				ext4_bcache_clear_flag(buf, BC_FUA);
+		} else {
+			r = ext4_blocks_set_direct(bdev, buf->data, buf->lba,
+						   1);
+		}
 		if (r) {
 			if (buf->end_write) {
 				bc->dont_shake = true;
@@ -161,6 +377,7 @@ int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 
 		ext4_bcache_remove_dirty_node(bc, buf);
 		ext4_bcache_clear_flag(buf, BC_DIRTY);
+		bc->stats[buf->cls].flushes++;
 		if (buf->end_write) {
 			bc->dont_shake = true;
 			buf->end_write(bc, buf, r, buf->end_write_arg);
@@ -170,6 +387,110 @@ int ext4_block_flush_buf(struct ext4_blockdev *bdev, struct ext4_buf *buf)
 	return EOK;
 }
 
+/**@brief   Write buffers of a batch (ascending LBAs): with one
+ *          asynchronous request per buffer, one vectored device write,
+ *          or one write per run of consecutive LBAs through the block
+ *          cache staging buffer.*/
+static int ext4_block_write_batch(struct ext4_blockdev *bdev,
+				  struct ext4_buf **bufs, uint32_t cnt)
+{
+	int r = EOK;
+	uint32_t i, j, k;
+	struct ext4_bcache *bc = bdev->bc;
+	struct ext4_blockdev_iovec iov[CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX];
+
+	if (ext4_block_aio(bdev)) {
+		for (i = 0; i < cnt && r == EOK; i++)
+			r = ext4_block_aio_submit(bdev, true, bufs[i]->lba, 1,
+						  bufs[i]->data, NULL, NULL);
+
+		if (r == EOK)
+			return ext4_block_aio_wait(bdev);
+
+		ext4_block_aio_wait(bdev);
+		return r;
+	}
+
+	if (bdev->bdif->bwritev) {
+		for (i = 0; i < cnt; i++)
+			ext4_block_iov_set(bdev, &iov[i], bufs[i]->lba, 1,
+					   bufs[i]->data);
+
+		return ext4_bdif_bwritev(bdev, iov, cnt);
+	}
+
+	for (i = 0; i < cnt && r == EOK; i = j) {
+		j = i + 1;
+		while (j < cnt && j - i < bc->flush_max &&
+		       bufs[j]->lba == bufs[j - 1]->lba + 1)
+			j++;
+
+		if (j - i == 1) {
+			r = ext4_blocks_set_direct(bdev, bufs[i]->data,
+						   bufs[i]->lba, 1);
+			continue;
+		}
+
+		for (k = i; k < j; k++)
+			memcpy(bc->flush_buf + (size_t)(k - i) * bc->itemsize,
+			       bufs[k]->data, bc->itemsize);
+
+		r = ext4_blocks_set_direct(bdev, bc->flush_buf, bufs[i]->lba,
+					   j - i);
+	}
+
+	return r;
+}
+
+/**@brief   Flush a batch of flushable buffers (ascending LBAs,
+ *          at most CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX of them).*/
+static int ext4_block_flush_batch(struct ext4_blockdev *bdev,
+				  struct ext4_buf **bufs, uint32_t cnt)
+{
+	int r;
+	uint32_t i;
+	struct ext4_bcache *bc = bdev->bc;
+
+	if (cnt == 1)
+		return ext4_block_flush_buf(bdev, bufs[0]);
+
+	r = ext4_block_write_batch(bdev, bufs, cnt);
+	if (r == EOK) {
+		for (i = 0; i < cnt; i++) {
+			ext4_bcache_remove_dirty_node(bc, bufs[i]);
+			ext4_bcache_clear_flag(bufs[i], BC_DIRTY);
+			bc->stats[bufs[i]->cls].flushes++;
+		}
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct ext4_buf *buf = bufs[i];
+		if (buf->end_write) {
+			bc->dont_shake = true;
+			buf->end_write(bc, buf, r, buf->end_write_arg);
+			bc->dont_shake = false;
+		}
+	}
+
+	return r;
+}
+
+/**@brief   Flush dirty buffer together with its dirty neighbours
+ *          (by LBA), merged into one device write.*/
+static int ext4_block_flush_cluster(struct ext4_blockdev *bdev,
+				    struct ext4_buf *buf)
+{
+	struct ext4_bcache *bc = bdev->bc;
+	struct ext4_buf *run[CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX];
+	uint32_t cnt;
+
+	if (!ext4_bcache_buf_mergeable(buf))
+		return ext4_block_flush_buf(bdev, buf);
+
+	cnt = ext4_bcache_dirty_run(bc, buf, run);
+	return ext4_block_flush_batch(bdev, run, cnt);
+}
+
 int ext4_block_flush_lba(struct ext4_blockdev *bdev, uint64_t lba)
 {
 	int r = EOK;
@@ -183,35 +504,64 @@ int ext4_block_flush_lba(struct ext4_blockdev *bdev, uint64_t lba)
 	return r;
 }
 
-int ext4_block_cache_shake(struct ext4_blockdev *bdev)
+/**@brief   Evict unreferenced buffers (flushing dirty ones) until
+ *          @p need new buffers fit into the cache.*/
+static int ext4_block_cache_evict(struct ext4_blockdev *bdev, uint32_t need)
 {
 	int r = EOK;
 	struct ext4_buf *buf;
-	if (bdev->bc->dont_shake)
+	struct ext4_bcache *vc, *bc = bdev->bc;
+	if (bc->dont_shake)
 		return EOK;
 
-	bdev->bc->dont_shake = true;
+	bc->dont_shake = true;
 
-	while (!RB_EMPTY(&bdev->bc->lru_root) &&
-		ext4_bcache_is_full(bdev->bc)) {
+	while (bc->ref_blocks + need > bc->cnt ||
+	       (bc->shared &&
+		bc->shared->ref_blocks + need > bc->shared->cnt)) {
+
+		/* A shared cache may evict buffers of another device. */
+		vc = ext4_bcache_victim_cache(bc);
+		buf = vc ? ext4_buf_lowest_lru(vc) : NULL;
+		if (!buf)
+			break;
 
-		buf = ext4_buf_lowest_lru(bdev->bc);
-		ext4_assert(buf);
 		if (ext4_bcache_test_flag(buf, BC_DIRTY)) {
-			r = ext4_block_flush_buf(bdev, buf);
+			r = ext4_block_flush_cluster(vc->bdev, buf);
 			if (r != EOK)
 				break;
 
+			vc->stats[buf->cls].dirty_evictions++;
 		}
 
-		ext4_bcache_drop_buf(bdev->bc, buf);
+		vc->stats[buf->cls].evictions++;
+		ext4_bcache_drop_buf(vc, buf);
 	}
-	bdev->bc->dont_shake = false;
+	bc->dont_shake = false;
 	return r;
 }
 
-int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
-			  uint64_t lba)
+int ext4_block_cache_shake(struct ext4_blockdev *bdev)
+{
+	return ext4_block_cache_evict(bdev, 1);
+}
+
+/**@brief   Retention priority of each buffer class.*/
+static const uint8_t ext4_block_cls_prio[EXT4_BCACHE_CLASS_COUNT] = {
+	[EXT4_BCACHE_CLASS_OTHER] = EXT4_BCACHE_PRIO_HIGH,
+	[EXT4_BCACHE_CLASS_BITMAP] = EXT4_BCACHE_PRIO_HIGH,
+	[EXT4_BCACHE_CLASS_ITABLE] = EXT4_BCACHE_PRIO_NORMAL,
+	[EXT4_BCACHE_CLASS_DIR] = EXT4_BCACHE_PRIO_LOW,
+	[EXT4_BCACHE_CLASS_DIR_INDEX] = EXT4_BCACHE_PRIO_HIGH,
+	[EXT4_BCACHE_CLASS_EXTENT] = EXT4_BCACHE_PRIO_HIGH,
+	[EXT4_BCACHE_CLASS_JOURNAL] = EXT4_BCACHE_PRIO_LOW,
+	[EXT4_BCACHE_CLASS_DATA] = EXT4_BCACHE_PRIO_LOW,
+};
+
+/**@brief   Get (and reference) cache buffer of given LBA, don't read.*/
+static int ext4_block_get_buf(struct ext4_blockdev *bdev,
+			      struct ext4_block *b, uint64_t lba,
+			      enum ext4_bcache_class cls)
 {
 	bool is_new;
 	int r;
@@ -238,23 +588,215 @@ int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
 	if (!b->data)
 		return ENOMEM;
 
+	b->buf->cls = cls;
+	b->buf->lru_prio = ext4_block_cls_prio[cls];
 	return EOK;
 }
 
+int ext4_block_get_noread(struct ext4_blockdev *bdev, struct ext4_block *b,
+			  uint64_t lba)
+{
+	return ext4_block_get_noread2(bdev, b, lba, EXT4_BCACHE_CLASS_OTHER);
+}
+
+int ext4_block_get_noread2(struct ext4_blockdev *bdev, struct ext4_block *b,
+			   uint64_t lba, enum ext4_bcache_class cls)
+{
+	int r = ext4_block_get_buf(bdev, b, lba, cls);
+	if (r != EOK)
+		return r;
+
+	/* Buffer is going to be overwritten, not a read-ahead hit. */
+	ext4_bcache_clear_flag(b->buf, BC_PREFETCH);
+	return EOK;
+}
+
+/**@brief   Read missing block @p b from device. Misses following
+ *          the previous one (by LBA) open a read-ahead window, which
+ *          doubles on each sequential miss up to
+ *          CONFIG_BLOCK_DEV_READ_AHEAD blocks. The window is read with
+ *          one device request (or one asynchronous request per block)
+ *          and left in the cache unreferenced.*/
+static int ext4_block_read_ahead(struct ext4_blockdev *bdev,
+				 struct ext4_block *b)
+{
+#if CONFIG_BLOCK_DEV_READ_AHEAD > 1
+	struct ext4_bcache *bc = bdev->bc;
+	struct ext4_block ra;
+	uint8_t *data;
+	uint64_t lba = b->lb_id;
+	uint32_t i, cnt, max = CONFIG_BLOCK_DEV_READ_AHEAD;
+	bool is_new;
+	int r;
+
+	/* Without vectored or asynchronous reads, the window goes through
+	 * the staging buffer. */
+	if (bdev->bdif->breadv || ext4_block_aio(bdev)) {
+		if (max > bc->cnt / 4)
+			max = bc->cnt / 4;
+	} else if (max > bc->flush_max) {
+		max = bc->flush_max;
+	}
+
+	if (lba == bdev->ra_next && max > 1) {
+		bdev->ra_win = bdev->ra_win ? bdev->ra_win * 2 : 4;
+		if (bdev->ra_win > max)
+			bdev->ra_win = max;
+	} else {
+		bdev->ra_win = 0;
+	}
+
+	bdev->ra_next = lba + 1;
+
+	cnt = bdev->ra_win;
+	if (cnt > bdev->lg_bcnt - lba)
+		cnt = (uint32_t)(bdev->lg_bcnt - lba);
+
+	/* Stop at the first cached block (the probe does not touch the
+	 * replacement policy). */
+	for (i = 1; i < cnt; i++)
+		if (ext4_buf_lookup(bc, lba + i))
+			break;
+
+	cnt = i;
+	if (cnt < 2)
+		return ext4_blocks_get_direct(bdev, b->data, lba, 1);
+
+	/* Make room for the window. */
+	r = ext4_block_cache_evict(bdev, cnt - 1);
+	if (r != EOK)
+		return r;
+
+	/* Window buffers stay referenced until the end, so they are found
+	 * again by LBA. */
+	for (i = 1; i < cnt; i++) {
+		if (ext4_bcache_is_full(bc))
+			break;
+
+		ra.lb_id = lba + i;
+		r = ext4_bcache_alloc(bc, &ra, &is_new);
+		if (r != EOK)
+			break;
+
+		if (!is_new) {
+			ext4_bcache_free(bc, &ra);
+			break;
+		}
+	}
+
+	cnt = i;
+	if (cnt == 1)
+		return ext4_blocks_get_direct(bdev, b->data, lba, 1);
+
+	if (ext4_block_aio(bdev)) {
+		r = EOK;
+		for (i = 0; i < cnt && r == EOK; i++) {
+			data = i ? ext4_buf_lookup(bc, lba + i)->data : b->data;
+			r = ext4_block_aio_submit(bdev, false, lba + i, 1,
+						  data, NULL, NULL);
+		}
+
+		if (r == EOK)
+			r = ext4_block_aio_wait(bdev);
+		else
+			ext4_block_aio_wait(bdev);
+	} else if (bdev->bdif->breadv) {
+		struct ext4_blockdev_iovec iov[CONFIG_BLOCK_DEV_READ_AHEAD];
+
+		ext4_block_iov_set(bdev, &iov[0], lba, 1, b->data);
+		for (i = 1; i < cnt; i++)
+			ext4_block_iov_set(bdev, &iov[i], lba + i, 1,
+					   ext4_buf_lookup(bc, lba + i)->data);
+
+		r = ext4_bdif_breadv(bdev, iov, cnt);
+	} else {
+		r = ext4_blocks_get_direct(bdev, bc->flush_buf, lba, cnt);
+		if (r == EOK) {
+			for (i = 0; i < cnt; i++) {
+				data = i ? ext4_buf_lookup(bc, lba + i)->data
+					 : b->data;
+				memcpy(data, bc->flush_buf +
+				       (size_t)i * bc->itemsize,
+				       bc->itemsize);
+			}
+		}
+	}
+
+	if (r == EOK) {
+		bdev->ra_reads++;
+		bdev->ra_blocks += cnt - 1;
+	}
+
+	for (i = 1; i < cnt; i++) {
+		ra.lb_id = lba + i;
+		ra.buf = ext4_buf_lookup(bc, ra.lb_id);
+		ra.data = ra.buf->data;
+		if (r == EOK) {
+			ext4_bcache_set_flag(ra.buf, BC_UPTODATE);
+			ext4_bcache_set_flag(ra.buf, BC_PREFETCH);
+			ra.buf->cls = b->buf->cls;
+			ra.buf->lru_prio = b->buf->lru_prio;
+		}
+
+		/* Not up-to-date buffers are dropped here. */
+		ext4_bcache_free(bc, &ra);
+	}
+
+	return r;
+#else
+	return ext4_blocks_get_direct(bdev, b->data, b->lb_id, 1);
+#endif
+}
+
+/**@brief   Zero-copy mode: reference device memory of block @p b.*/
+static bool ext4_block_map(struct ext4_blockdev *bdev, struct ext4_block *b)
+{
+	struct ext4_blockdev_iovec iov;
+	void *data;
+
+	ext4_block_iov_set(bdev, &iov, b->lb_id, 1, NULL);
+	data = bdev->bdif->bmap(bdev, iov.blk_id, iov.blk_cnt);
+	if (!data)
+		return false;
+
+	ext4_bcache_map(bdev->bc, b->buf, data);
+	b->data = data;
+	return true;
+}
+
 int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
 		   uint64_t lba)
 {
-	int r = ext4_block_get_noread(bdev, b, lba);
+	return ext4_block_get2(bdev, b, lba, EXT4_BCACHE_CLASS_OTHER);
+}
+
+int ext4_block_get2(struct ext4_blockdev *bdev, struct ext4_block *b,
+		    uint64_t lba, enum ext4_bcache_class cls)
+{
+	struct ext4_bcache_stats *stats = &bdev->bc->stats[cls];
+	int r = ext4_block_get_buf(bdev, b, lba, cls);
 	if (r != EOK)
 		return r;
 
 	if (ext4_bcache_test_flag(b->buf, BC_UPTODATE)) {
 		/* Data in the cache is up-to-date.
 		 * Reading from physical device is not required */
+		stats->hits++;
+		if (ext4_bcache_test_flag(b->buf, BC_PREFETCH)) {
+			ext4_bcache_clear_flag(b->buf, BC_PREFETCH);
+			stats->ra_hits++;
+			bdev->ra_hits++;
+			bdev->ra_next = lba + 1;
+		}
 		return EOK;
 	}
 
-	r = ext4_blocks_get_direct(bdev, b->data, lba, 1);
+	stats->misses++;
+
+	if (bdev->bc->zero_copy && ext4_block_map(bdev, b))
+		return EOK;
+
+	r = ext4_block_read_ahead(bdev, b);
 	if (r != EOK) {
 		ext4_bcache_free(bdev->bc, b);
 		b->lb_id = 0;
@@ -267,6 +809,40 @@ int ext4_block_get(struct ext4_blockdev *bdev, struct ext4_block *b,
 	return EOK;
 }
 
+int ext4_block_pin(struct ext4_blockdev *bdev, uint64_t lba,
+		   enum ext4_bcache_class cls)
+{
+	struct ext4_block b;
+	int r = ext4_block_get2(bdev, &b, lba, cls);
+	if (r != EOK)
+		return r;
+
+	/* Already pinned, drop the reference just taken. */
+	if (ext4_bcache_test_flag(b.buf, BC_PINNED))
+		return ext4_block_set(bdev, &b);
+
+	ext4_bcache_set_flag(b.buf, BC_PINNED);
+	bdev->bc->pinned_cnt++;
+	return EOK;
+}
+
+int ext4_block_unpin(struct ext4_blockdev *bdev, uint64_t lba)
+{
+	struct ext4_block b, pin;
+	struct ext4_buf *buf = ext4_bcache_find_get(bdev->bc, &b, lba);
+	if (!buf)
+		return EOK;
+
+	if (ext4_bcache_test_flag(buf, BC_PINNED)) {
+		pin = b;
+		ext4_bcache_clear_flag(buf, BC_PINNED);
+		bdev->bc->pinned_cnt--;
+		ext4_bcache_free(bdev->bc, &pin);
+	}
+
+	return ext4_bcache_free(bdev->bc, &b);
+}
+
 int ext4_block_set(struct ext4_blockdev *bdev, struct ext4_block *b)
 {
 	ext4_assert(bdev && b);
@@ -306,87 +882,194 @@ int ext4_blocks_set_direct(struct ext4_blockdev *bdev, const void *buf,
 	return ext4_bdif_bwrite(bdev, buf, pba, pb_cnt * cnt);
 }
 
-int ext4_block_writebytes(struct ext4_blockdev *bdev, uint64_t off,
-			  const void *buf, uint32_t len)
+/**@brief   Record result of a request and call its completion routine.*/
+static void ext4_block_aio_end(struct ext4_blockdev *bdev,
+			       struct ext4_blockdev_req *req, int res)
 {
-	uint64_t block_idx;
-	uint32_t blen;
-	uint32_t unalg;
-	int r = EOK;
+	if (res != EOK && bdev->aio_err == EOK)
+		bdev->aio_err = res;
 
-	const uint8_t *p = (void *)buf;
-
-	ext4_assert(bdev && buf);
+	if (req->end_io)
+		req->end_io(bdev, req, res);
+}
 
-	if (!bdev->bdif->ph_refctr)
-		return EIO;
+void ext4_block_aio_complete(struct ext4_blockdev *bdev,
+			     struct ext4_blockdev_req *req, int res)
+{
+	ext4_assert(bdev->aio_inflight);
+	bdev->aio_inflight--;
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	if (bdev->bdif->now_us)
+		ext4_bdev_hist_add(&bdev->bdif->stats.queue[req->write],
+				   bdev->bdif->now_us() - req->stamp);
+#endif
+	ext4_block_aio_end(bdev, req, res);
+#if CONFIG_BLOCK_DEV_ENABLE_AIO
+	SLIST_INSERT_HEAD(&bdev->aio_free, req, node);
+#endif
+}
 
-	if (off + len > bdev->part_size)
-		return EINVAL; /*Ups. Out of range operation*/
+static int ext4_bdif_poll(struct ext4_blockdev *bdev, uint32_t min_done)
+{
+	ext4_bdif_lock(bdev);
+	int r = bdev->bdif->poll(bdev, min_done);
+	ext4_bdif_unlock(bdev);
+	return r;
+}
 
-	block_idx = ((off + bdev->part_offset) / bdev->bdif->ph_bsize);
+int ext4_block_aio_submit(struct ext4_blockdev *bdev, bool write,
+			  uint64_t lba, uint32_t cnt, void *buf,
+			  void (*end_io)(struct ext4_blockdev *bdev,
+					 struct ext4_blockdev_req *req,
+					 int res),
+			  void *arg)
+{
+	int r;
+	struct ext4_blockdev_req *req, tmp;
 
-	/*OK lets deal with the first possible unaligned block*/
-	unalg = (off & (bdev->bdif->ph_bsize - 1));
-	if (unalg) {
+	ext4_assert(bdev && buf);
 
-		uint32_t wlen = (bdev->bdif->ph_bsize - unalg) > len
-				    ? len
-				    : (bdev->bdif->ph_bsize - unalg);
+	if (!ext4_block_aio(bdev)) {
+		req = &tmp;
+		req->write = write;
+		req->end_io = end_io;
+		req->arg = arg;
+		req->bdev = bdev;
+		ext4_block_iov_set(bdev, &req->seg, lba, cnt, buf);
+		r = write ? ext4_blocks_set_direct(bdev, buf, lba, cnt) :
+			    ext4_blocks_get_direct(bdev, buf, lba, cnt);
+		ext4_block_aio_end(bdev, req, r);
+		return EOK;
+	}
 
-		r = ext4_bdif_bread(bdev, bdev->bdif->ph_bbuf, block_idx, 1);
+#if CONFIG_BLOCK_DEV_ENABLE_AIO
+	while (SLIST_EMPTY(&bdev->aio_free)) {
+		r = ext4_bdif_poll(bdev, 1);
 		if (r != EOK)
 			return r;
+	}
 
-		memcpy(bdev->bdif->ph_bbuf + unalg, p, wlen);
-		r = ext4_bdif_bwrite(bdev, bdev->bdif->ph_bbuf, block_idx, 1);
-		if (r != EOK)
-			return r;
+	req = SLIST_FIRST(&bdev->aio_free);
+	SLIST_REMOVE_HEAD(&bdev->aio_free, node);
+	req->write = write;
+	req->end_io = end_io;
+	req->arg = arg;
+	req->bdev = bdev;
+	ext4_block_iov_set(bdev, &req->seg, lba, cnt, buf);
 
-		p += wlen;
-		len -= wlen;
-		block_idx++;
+	ext4_bdif_lock(bdev);
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+	req->stamp = ext4_bdif_stamp(bdev);
+	ext4_bdev_hist_add(&bdev->bdif->stats.size[write],
+			   req->seg.blk_cnt * bdev->bdif->ph_bsize);
+#endif
+	r = bdev->bdif->submit(bdev, req);
+	if (write) {
+		bdev->bdif->bwrite_ctr++;
+		bdev->bdif->flush_pending = true;
+	} else {
+		bdev->bdif->bread_ctr++;
 	}
+	ext4_bdif_unlock(bdev);
 
-	/*Aligned data*/
-	blen = len / bdev->bdif->ph_bsize;
-	if (blen != 0) {
-		r = ext4_bdif_bwrite(bdev, p, block_idx, blen);
-		if (r != EOK)
-			return r;
+	if (r != EOK) {
+		SLIST_INSERT_HEAD(&bdev->aio_free, req, node);
+		return r;
+	}
 
-		p += bdev->bdif->ph_bsize * blen;
-		len -= bdev->bdif->ph_bsize * blen;
+	bdev->aio_inflight++;
+#endif
+	return EOK;
+}
 
-		block_idx += blen;
-	}
+/**@brief   Asynchronous transfer split into CONFIG_BLOCK_DEV_AIO_CHUNK
+ *          requests.*/
+static int ext4_blocks_async(struct ext4_blockdev *bdev, bool write,
+			     void *buf, uint64_t lba, uint32_t cnt)
+{
+	int r;
+	uint8_t *p = buf;
+	uint32_t n, chunk = CONFIG_BLOCK_DEV_AIO_CHUNK / bdev->lg_bsize;
 
-	/*Rest of the data*/
-	if (len) {
-		r = ext4_bdif_bread(bdev, bdev->bdif->ph_bbuf, block_idx, 1);
+	if (!chunk)
+		chunk = 1;
+
+	while (cnt) {
+		n = cnt < chunk ? cnt : chunk;
+		r = ext4_block_aio_submit(bdev, write, lba, n, p, NULL, NULL);
 		if (r != EOK)
 			return r;
 
-		memcpy(bdev->bdif->ph_bbuf, p, len);
-		r = ext4_bdif_bwrite(bdev, bdev->bdif->ph_bbuf, block_idx, 1);
+		p += (size_t)n * bdev->lg_bsize;
+		lba += n;
+		cnt -= n;
+	}
+
+	return EOK;
+}
+
+int ext4_blocks_get_async(struct ext4_blockdev *bdev, void *buf,
+			  uint64_t lba, uint32_t cnt)
+{
+	return ext4_blocks_async(bdev, false, buf, lba, cnt);
+}
+
+int ext4_blocks_set_async(struct ext4_blockdev *bdev, const void *buf,
+			  uint64_t lba, uint32_t cnt)
+{
+	return ext4_blocks_async(bdev, true, (void *)buf, lba, cnt);
+}
+
+int ext4_block_aio_wait(struct ext4_blockdev *bdev)
+{
+	int r;
+
+	while (bdev->aio_inflight) {
+		r = ext4_bdif_poll(bdev, bdev->aio_inflight);
 		if (r != EOK)
 			return r;
 	}
 
+	r = bdev->aio_err;
+	bdev->aio_err = EOK;
 	return r;
 }
 
-int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
-			 uint32_t len)
+/**@brief   Read (or read-modify-write) part of one physical block
+ *          through the physical block buffer of the device.*/
+static int ext4_block_partial(struct ext4_blockdev *bdev, uint64_t pba,
+			      uint32_t off, void *buf, uint32_t len,
+			      bool write)
+{
+	int r;
+	uint8_t *scratch = bdev->bdif->ph_bbuf;
+
+	/* The physical block buffer is shared by all partitions of the
+	 * device. */
+	ext4_bdif_lock(bdev);
+	r = __ext4_bdif_bread(bdev, scratch, pba, 1);
+	if (r == EOK && write) {
+		memcpy(scratch + off, buf, len);
+		r = __ext4_bdif_bwrite(bdev, scratch, pba, 1);
+	} else if (r == EOK) {
+		memcpy(buf, scratch + off, len);
+	}
+	ext4_bdif_unlock(bdev);
+
+	return r;
+}
+
+/**@brief   Byte range transfer: partial first and last physical blocks
+ *          through ext4_block_partial, the rest directly.*/
+static int ext4_block_rwbytes(struct ext4_blockdev *bdev, uint64_t off,
+			      uint8_t *p, uint32_t len, bool write)
 {
 	uint64_t block_idx;
 	uint32_t blen;
 	uint32_t unalg;
 	int r = EOK;
 
-	uint8_t *p = (void *)buf;
-
-	ext4_assert(bdev && buf);
+	ext4_assert(bdev && p);
 
 	if (!bdev->bdif->ph_refctr)
 		return EIO;
@@ -400,26 +1083,24 @@ int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
 	unalg = (off & (bdev->bdif->ph_bsize - 1));
 	if (unalg) {
 
-		uint32_t rlen = (bdev->bdif->ph_bsize - unalg) > len
+		uint32_t plen = (bdev->bdif->ph_bsize - unalg) > len
 				    ? len
 				    : (bdev->bdif->ph_bsize - unalg);
 
-		r = ext4_bdif_bread(bdev, bdev->bdif->ph_bbuf, block_idx, 1);
+		r = ext4_block_partial(bdev, block_idx, unalg, p, plen, write);
 		if (r != EOK)
 			return r;
 
-		memcpy(p, bdev->bdif->ph_bbuf + unalg, rlen);
-
-		p += rlen;
-		len -= rlen;
+		p += plen;
+		len -= plen;
 		block_idx++;
 	}
 
 	/*Aligned data*/
 	blen = len / bdev->bdif->ph_bsize;
-
 	if (blen != 0) {
-		r = ext4_bdif_bread(bdev, p, block_idx, blen);
+		r = write ? ext4_bdif_bwrite(bdev, p, block_idx, blen) :
+			    ext4_bdif_bread(bdev, p, block_idx, blen);
 		if (r != EOK)
 			return r;
 
@@ -430,28 +1111,276 @@ int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
 	}
 
 	/*Rest of the data*/
-	if (len) {
-		r = ext4_bdif_bread(bdev, bdev->bdif->ph_bbuf, block_idx, 1);
+	if (len)
+		r = ext4_block_partial(bdev, block_idx, 0, p, len, write);
+
+	return r;
+}
+
+int ext4_block_writebytes(struct ext4_blockdev *bdev, uint64_t off,
+			  const void *buf, uint32_t len)
+{
+	return ext4_block_rwbytes(bdev, off, (void *)buf, len, true);
+}
+
+int ext4_block_readbytes(struct ext4_blockdev *bdev, uint64_t off, void *buf,
+			 uint32_t len)
+{
+	return ext4_block_rwbytes(bdev, off, buf, len, false);
+}
+
+int ext4_block_cache_read(struct ext4_blockdev *bdev, uint64_t lba,
+			  uint32_t off, void *buf, uint32_t len)
+{
+	int r;
+	struct ext4_block b;
+
+	ext4_assert(bdev && buf && off + len <= bdev->lg_bsize);
+
+	r = ext4_block_get2(bdev, &b, lba, EXT4_BCACHE_CLASS_DATA);
+	if (r != EOK)
+		return r;
+
+	memcpy(buf, b.data + off, len);
+	return ext4_block_set(bdev, &b);
+}
+
+int ext4_block_cache_write(struct ext4_blockdev *bdev, uint64_t lba,
+			   uint32_t off, const void *buf, uint32_t len,
+			   bool fresh)
+{
+	int r;
+	struct ext4_block b;
+
+	ext4_assert(bdev && buf && off + len <= bdev->lg_bsize);
+
+	if (fresh)
+		r = ext4_block_get_noread2(bdev, &b, lba,
+					   EXT4_BCACHE_CLASS_DATA);
+	else
+		r = ext4_block_get2(bdev, &b, lba, EXT4_BCACHE_CLASS_DATA);
+	if (r != EOK)
+		return r;
+
+	/*A new block reads zeros around the written bytes*/
+	if (fresh)
+		memset(b.data, 0, bdev->lg_bsize);
+
+	memcpy(b.data + off, buf, len);
+	ext4_bcache_set_dirty(b.buf);
+	return ext4_block_set(bdev, &b);
+}
+
+int ext4_block_cache_write_range(struct ext4_blockdev *bdev, uint64_t lba,
+				 uint32_t cnt)
+{
+	int r;
+	uint64_t end = lba + cnt;
+	struct ext4_buf *buf;
+
+	if (!bdev->bc->dirty_cnt)
+		return EOK;
+
+	while ((buf = ext4_bcache_find_dirty(bdev->bc, lba, end - lba))) {
+		r = ext4_block_flush_buf(bdev, buf);
 		if (r != EOK)
 			return r;
 
-		memcpy(p, bdev->bdif->ph_bbuf, len);
+		lba = buf->lba + 1;
 	}
 
-	return r;
+	return EOK;
 }
 
 int ext4_block_cache_flush(struct ext4_blockdev *bdev)
 {
-	while (!SLIST_EMPTY(&bdev->bc->dirty_list)) {
+	struct ext4_bcache *bc = bdev->bc;
+	struct ext4_buf *batch[CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX];
+	bool vectored = bdev->bdif->bwritev || ext4_block_aio(bdev);
+	uint32_t max = vectored ? CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX :
+				  bc->flush_max;
+
+	/* Write dirty buffers in LBA order: adjacent ones merged, or any
+	 * of them batched if the device supports vectored writes. */
+	ext4_bcache_sort_dirty(bc);
+	while (!SLIST_EMPTY(&bc->dirty_list)) {
 		int r;
-		struct ext4_buf *buf = SLIST_FIRST(&bdev->bc->dirty_list);
+		uint32_t cnt = 0;
+		struct ext4_buf *next, *buf = SLIST_FIRST(&bc->dirty_list);
 		ext4_assert(buf);
-		r = ext4_block_flush_buf(bdev, buf);
+
+		batch[cnt++] = buf;
+		while (cnt < max && ext4_bcache_buf_mergeable(buf)) {
+			next = SLIST_NEXT(buf, dirty_node);
+			if (!next || !ext4_bcache_buf_mergeable(next) ||
+			    (!vectored && next->lba != buf->lba + 1))
+				break;
+
+			batch[cnt++] = buf = next;
+		}
+
+		r = ext4_block_flush_batch(bdev, batch, cnt);
+		if (r != EOK)
+			return r;
+
+	}
+
+	/* Written buffers are durable from now on. */
+	return ext4_block_dev_flush(bdev);
+}
+
+int ext4_block_cache_drain(struct ext4_blockdev *bdev, uint32_t now,
+			   uint32_t dirty_ratio, uint32_t max_age,
+			   uint32_t max_cnt)
+{
+	struct ext4_bcache *bc = bdev->bc;
+	struct ext4_buf *run[CONFIG_BLOCK_DEV_CACHE_FLUSH_MAX];
+	struct ext4_buf *next, *buf;
+	uint32_t limit = (uint32_t)((uint64_t)bc->cnt * dirty_ratio / 100);
+	uint32_t done = 0;
+
+	/* Buffers dirtied from now on are stamped with this time. */
+	bc->wb_clock = now;
+	if (!max_cnt)
+		max_cnt = UINT32_MAX;
+
+	if (!max_age && bc->dirty_cnt <= limit)
+		return EOK;
+
+	ext4_bcache_sort_dirty(bc);
+	buf = SLIST_FIRST(&bc->dirty_list);
+	while (buf && done < max_cnt) {
+		int r;
+		uint32_t cnt = 0;
+
+		if (bc->dirty_cnt <= limit &&
+		    !(max_age && now - buf->dirty_time >= max_age)) {
+			buf = SLIST_NEXT(buf, dirty_node);
+			continue;
+		}
+
+		run[cnt++] = buf;
+		while (cnt < bc->flush_max && done + cnt < max_cnt &&
+		       ext4_bcache_buf_mergeable(buf)) {
+			next = SLIST_NEXT(buf, dirty_node);
+			if (!next || next->lba != buf->lba + 1 ||
+			    !ext4_bcache_buf_mergeable(next))
+				break;
+
+			run[cnt++] = buf = next;
+		}
+
+		next = SLIST_NEXT(buf, dirty_node);
+		r = ext4_block_flush_batch(bdev, run, cnt);
 		if (r != EOK)
 			return r;
 
+		done += cnt;
+		buf = next;
 	}
+
+	return EOK;
+}
+
+int ext4_block_cache_resize(struct ext4_blockdev *bdev, uint32_t cnt)
+{
+	int r;
+
+	if (!bdev->bc || !cnt)
+		return EINVAL;
+
+	r = ext4_bcache_resize(bdev->bc, cnt);
+	if (r != EOK)
+		return r;
+
+	/* Evict (according to the replacement policy) what is left
+	 * above the new capacity. */
+	return ext4_block_cache_evict(bdev, 0);
+}
+
+int ext4_block_dev_flush(struct ext4_blockdev *bdev)
+{
+	return ext4_bdif_flush(bdev);
+}
+
+int ext4_block_discard(struct ext4_blockdev *bdev, uint64_t lba,
+		       uint64_t cnt)
+{
+	int r;
+	uint64_t pba;
+	uint64_t pb_cnt;
+
+	if (!bdev->bdif->discard || !cnt)
+		return EOK;
+
+	pba = (lba * bdev->lg_bsize + bdev->part_offset) / bdev->bdif->ph_bsize;
+	pb_cnt = cnt * (bdev->lg_bsize / bdev->bdif->ph_bsize);
+
+	ext4_bdif_lock(bdev);
+	uint64_t stamp __unused = ext4_bdif_stamp(bdev);
+	r = bdev->bdif->discard(bdev, pba, pb_cnt);
+	ext4_bdif_account(bdev, EXT4_BDEV_OP_DISCARD, stamp, pb_cnt);
+	bdev->bdif->discard_ctr++;
+	ext4_bdif_unlock(bdev);
+	return r;
+}
+
+#if CONFIG_BLOCK_DEV_ENABLE_STATS
+void ext4_block_stats_clock(struct ext4_blockdev *bdev,
+			    uint64_t (*now_us)(void))
+{
+	ext4_bdif_lock(bdev);
+	bdev->bdif->now_us = now_us;
+	ext4_bdif_unlock(bdev);
+}
+
+void ext4_block_stats_get(struct ext4_blockdev *bdev,
+			  struct ext4_blockdev_stats *stats)
+{
+	ext4_bdif_lock(bdev);
+	*stats = bdev->bdif->stats;
+	ext4_bdif_unlock(bdev);
+}
+
+void ext4_block_stats_reset(struct ext4_blockdev *bdev)
+{
+	ext4_bdif_lock(bdev);
+	memset(&bdev->bdif->stats, 0, sizeof(bdev->bdif->stats));
+	ext4_bdif_unlock(bdev);
+}
+
+uint64_t ext4_block_stats_percentile(const struct ext4_bdev_hist *hist,
+				     uint32_t permille)
+{
+	uint64_t rank, seen = 0, upper;
+	uint32_t b;
+
+	if (!hist->cnt)
+		return 0;
+
+	/*Rank of the sample (1 based), rounded up*/
+	rank = (hist->cnt * permille + 999) / 1000;
+	if (!rank)
+		rank = 1;
+
+	for (b = 0; b < EXT4_BDEV_HIST_BUCKETS - 1; b++) {
+		seen += hist->bucket[b];
+		if (seen >= rank)
+			break;
+	}
+
+	upper = 1ULL << b;
+	return (b == EXT4_BDEV_HIST_BUCKETS - 1 || upper > hist->max) ?
+		hist->max : upper;
+}
+#endif
+
+int ext4_block_cache_zero_copy(struct ext4_blockdev *bdev, bool on)
+{
+	if (on && !bdev->bdif->bmap)
+		return ENOTSUP;
+
+	bdev->bc->zero_copy = on;
 	return EOK;
 }
 
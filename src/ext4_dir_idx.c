@@ -369,7 +369,8 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
 	if (rc != EOK)
 		return rc;
 
-	rc = ext4_trans_block_get_noread(dir->fs->bdev, &block, fblock);
+	rc = ext4_trans_block_get_noread(dir->fs->bdev, &block, fblock,
+					 EXT4_BCACHE_CLASS_DIR_INDEX);
 	if (rc != EOK)
 		return rc;
 
@@ -424,7 +425,8 @@ int ext4_dir_dx_init(struct ext4_inode_ref *dir, struct ext4_inode_ref *parent)
 	}
 
 	struct ext4_block new_block;
-	rc = ext4_trans_block_get_noread(dir->fs->bdev, &new_block, fblock);
+	rc = ext4_trans_block_get_noread(dir->fs->bdev, &new_block, fblock,
+					 EXT4_BCACHE_CLASS_DIR);
 	if (rc != EOK) {
 		ext4_block_set(dir->fs->bdev, &block);
 		return rc;
@@ -601,7 +603,8 @@ static int ext4_dir_dx_get_leaf(struct ext4_hash_info *hinfo,
 		if (r != EOK)
 			return r;
 
-		r = ext4_trans_block_get(inode_ref->fs->bdev, tmp_blk, fblk);
+		r = ext4_trans_block_get(inode_ref->fs->bdev, tmp_blk, fblk,
+					 EXT4_BCACHE_CLASS_DIR_INDEX);
 		if (r != EOK)
 			return r;
 
@@ -683,7 +686,8 @@ static int ext4_dir_dx_next_block(struct ext4_inode_ref *inode_ref,
 			return r;
 
 		struct ext4_block b;
-		r = ext4_trans_block_get(inode_ref->fs->bdev, &b, blk_adr);
+		r = ext4_trans_block_get(inode_ref->fs->bdev, &b, blk_adr,
+					 EXT4_BCACHE_CLASS_DIR_INDEX);
 		if (r != EOK)
 			return r;
 
@@ -726,7 +730,8 @@ int ext4_dir_dx_find_entry(struct ext4_dir_search_result *result,
 	struct ext4_fs *fs = inode_ref->fs;
 
 	struct ext4_block root_block;
-	rc = ext4_trans_block_get(fs->bdev, &root_block, root_block_addr);
+	rc = ext4_trans_block_get(fs->bdev, &root_block, root_block_addr,
+				  EXT4_BCACHE_CLASS_DIR_INDEX);
 	if (rc != EOK)
 		return rc;
 
@@ -774,7 +779,8 @@ int ext4_dir_dx_find_entry(struct ext4_dir_search_result *result,
 		if (rc != EOK)
 			goto cleanup;
 
-		rc = ext4_trans_block_get(fs->bdev, &b, leaf_block_addr);
+		rc = ext4_trans_block_get(fs->bdev, &b, leaf_block_addr,
+					  EXT4_BCACHE_CLASS_DIR);
 		if (rc != EOK)
 			goto cleanup;
 
@@ -1016,7 +1022,7 @@ static int ext4_dir_dx_split_data(struct ext4_inode_ref *inode_ref,
 	/* Load new block */
 	struct ext4_block new_data_block_tmp;
 	rc = ext4_trans_block_get_noread(inode_ref->fs->bdev, &new_data_block_tmp,
-				   new_fblock);
+				   new_fblock, EXT4_BCACHE_CLASS_DIR);
 	if (rc != EOK) {
 		ext4_free(sort);
 		ext4_free(entry_buffer);
@@ -1163,7 +1169,8 @@ ext4_dir_dx_split_index(struct ext4_inode_ref *ino_ref,
 
 		/* load new block */
 		struct ext4_block b;
-		r = ext4_trans_block_get_noread(ino_ref->fs->bdev, &b, new_fblk);
+		r = ext4_trans_block_get_noread(ino_ref->fs->bdev, &b, new_fblk,
+						EXT4_BCACHE_CLASS_DIR_INDEX);
 		if (r != EOK)
 			return r;
 
@@ -1284,7 +1291,8 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
 	struct ext4_fs *fs = parent->fs;
 	struct ext4_block root_blk;
 
-	r = ext4_trans_block_get(fs->bdev, &root_blk, rblock_addr);
+	r = ext4_trans_block_get(fs->bdev, &root_blk, rblock_addr,
+				 EXT4_BCACHE_CLASS_DIR_INDEX);
 	if (r != EOK)
 		return r;
 
@@ -1337,7 +1345,8 @@ int ext4_dir_dx_add_entry(struct ext4_inode_ref *parent,
 		goto release_target_index;
 
 	struct ext4_block target_block;
-	r = ext4_trans_block_get(fs->bdev, &target_block, leaf_block_addr);
+	r = ext4_trans_block_get(fs->bdev, &target_block, leaf_block_addr,
+				 EXT4_BCACHE_CLASS_DIR);
 	if (r != EOK)
 		goto release_index;
 
@@ -1415,7 +1424,8 @@ int ext4_dir_dx_reset_parent_inode(struct ext4_inode_ref *dir,
 		return rc;
 
 	struct ext4_block block;
-	rc = ext4_trans_block_get(dir->fs->bdev, &block, fblock);
+	rc = ext4_trans_block_get(dir->fs->bdev, &block, fblock,
+				  EXT4_BCACHE_CLASS_DIR_INDEX);
 	if (rc != EOK)
 		return rc;
 
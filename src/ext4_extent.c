@@ -160,6 +160,11 @@ static ext4_fsblk_t ext4_new_meta_blocks(struct ext4_inode_ref *inode_ref,
 {
 	ext4_fsblk_t block = 0;
 
+	if (count && *count > 1) {
+		*errp = ext4_balloc_alloc_blocks(inode_ref, goal, &block, count);
+		return block;
+	}
+
 	*errp = ext4_allocate_single_block(inode_ref, goal, &block);
 	if (count)
 		*count = 1;
@@ -440,7 +445,8 @@ static int read_extent_tree_block(struct ext4_inode_ref *inode_ref,
 {
 	int err;
 
-	err = ext4_trans_block_get(inode_ref->fs->bdev, bh, pblk);
+	err = ext4_trans_block_get(inode_ref->fs->bdev, bh, pblk,
+				   EXT4_BCACHE_CLASS_EXTENT);
 	if (err != EOK)
 		goto errout;
 
@@ -694,7 +700,8 @@ static int ext4_ext_split_node(struct ext4_inode_ref *inode_ref,
 
 		/*  For write access.*/
 		ret = ext4_trans_block_get_noread(inode_ref->fs->bdev, &bh,
-						  newblock);
+						  newblock,
+						  EXT4_BCACHE_CLASS_EXTENT);
 		if (ret != EOK)
 			goto cleanup;
 
@@ -858,6 +865,10 @@ static inline bool ext4_ext_can_prepend(struct ext4_extent *ex1,
 	    ext4_ext_pblock(ex1))
 		return 0;
 
+	/* Written and unwritten blocks must not share an extent */
+	if (ext4_ext_is_unwritten(ex1) != ext4_ext_is_unwritten(ex2))
+		return 0;
+
 #ifdef AGGRESSIVE_TEST
 	if (ext4_ext_get_actual_len(ex1) + ext4_ext_get_actual_len(ex2) > 4)
 		return 0;
@@ -886,6 +897,10 @@ static inline bool ext4_ext_can_append(struct ext4_extent *ex1,
 	    ext4_ext_pblock(ex2))
 		return 0;
 
+	/* Written and unwritten blocks must not share an extent */
+	if (ext4_ext_is_unwritten(ex1) != ext4_ext_is_unwritten(ex2))
+		return 0;
+
 #ifdef AGGRESSIVE_TEST
 	if (ext4_ext_get_actual_len(ex1) + ext4_ext_get_actual_len(ex2) > 4)
 		return 0;
@@ -940,6 +955,8 @@ static int ext4_ext_insert_leaf(struct ext4_inode_ref *inode_ref,
 		    ext4_ext_can_prepend(curp->extent, newext)) {
 			unwritten = ext4_ext_is_unwritten(curp->extent);
 			curp->extent->first_block = newext->first_block;
+			ext4_ext_store_pblock(curp->extent,
+					      ext4_ext_pblock(newext));
 			curp->extent->block_count =
 			    to_le16(ext4_ext_get_actual_len(curp->extent) +
 				    ext4_ext_get_actual_len(newext));
@@ -1033,7 +1050,8 @@ static int ext4_ext_grow_indepth(struct ext4_inode_ref *inode_ref,
 		return err;
 
 	/* # */
-	err = ext4_trans_block_get_noread(inode_ref->fs->bdev, &bh, newblock);
+	err = ext4_trans_block_get_noread(inode_ref->fs->bdev, &bh, newblock,
+					  EXT4_BCACHE_CLASS_EXTENT);
 	if (err != EOK) {
 		ext4_ext_free_blocks(inode_ref, newblock, 1, 0);
 		return err;
@@ -1260,6 +1278,14 @@ static int ext4_ext_remove_leaf(struct ext4_inode_ref *inode_ref,
 		new_start = start = to_le32(ex->first_block);
 		len = ext4_ext_get_actual_len(ex);
 		newblock = ext4_ext_pblock(ex);
+
+		/* The extent ends before the removed range: keep it */
+		if (start + len - 1 < from) {
+			start_ex++;
+			ex++;
+			continue;
+		}
+
 		/*
 		 * The 1st case:
 		 *   The position that we start truncation is inside the range of an
@@ -1378,16 +1404,13 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 		goto out;
 	}
 
+	/* The range may start in a hole: the extents after it are
+	 * removed all the same */
 	bool in_range = IN_RANGE(from, to_le32(path[depth].extent->first_block),
 				 ext4_ext_get_actual_len(path[depth].extent));
 
-	if (!in_range) {
-		ret = EOK;
-		goto out;
-	}
-
 	/* If we do remove_space inside the range of an extent */
-	if ((to_le32(path[depth].extent->first_block) < from) &&
+	if (in_range && (to_le32(path[depth].extent->first_block) < from) &&
 	    (to < to_le32(path[depth].extent->first_block) +
 		      ext4_ext_get_actual_len(path[depth].extent) - 1)) {
 
@@ -1396,6 +1419,7 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 		ext4_lblk_t ee_block = to_le32(ex->first_block);
 		int32_t len = ext4_ext_get_actual_len(ex);
 		ext4_fsblk_t newblock = to + 1 - ee_block + ext4_ext_pblock(ex);
+		ext4_fsblk_t start = from - ee_block + ext4_ext_pblock(ex);
 
 		ex->block_count = to_le16(from - ee_block);
 		if (unwritten)
@@ -1410,6 +1434,10 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 			ext4_ext_mark_unwritten(&newex);
 
 		ret = ext4_ext_insert_extent(inode_ref, &path, &newex, 0);
+		if (ret == EOK)
+			ext4_ext_free_blocks(inode_ref, start,
+					     to - from + 1, 0);
+
 		goto out;
 	}
 
@@ -1476,9 +1504,9 @@ int ext4_extent_remove_space(struct ext4_inode_ref *inode_ref, ext4_lblk_t from,
 					path[i - 1].index++;
 			}
 
+			/* Index block checksum is updated on release */
 			if (i)
-				ext4_block_set(inode_ref->fs->bdev,
-					       &path[i].block);
+				ext4_ext_drop_refs(inode_ref, path + i, true);
 
 			i--;
 		}
@@ -1566,9 +1594,31 @@ static int ext4_ext_convert_to_initialized(struct ext4_inode_ref *inode_ref,
 {
 	int32_t depth = ext_depth(inode_ref->inode), err = EOK;
 	struct ext4_extent *ex = (*ppath)[depth].extent;
+	struct ext4_extent *prev = ex - 1;
+	uint16_t ee_len = ext4_ext_get_actual_len(ex);
 
 	ext4_assert(to_le32(ex->first_block) <= split);
 
+	/* Blocks written at the start of the extent join the written extent
+	 * before it if both are contiguous (appends to a preallocated
+	 * range): the boundary moves, no extent is inserted. */
+	if (to_le32(ex->first_block) == split && blocks < ee_len &&
+	    ex != EXT_FIRST_EXTENT((*ppath)[depth].header) &&
+	    !ext4_ext_is_unwritten(prev) &&
+	    to_le32(prev->first_block) + ext4_ext_get_actual_len(prev) ==
+		split &&
+	    ext4_ext_pblock(prev) + ext4_ext_get_actual_len(prev) ==
+		ext4_ext_pblock(ex) &&
+	    ext4_ext_get_actual_len(prev) + blocks <= EXT_INIT_MAX_LEN) {
+		prev->block_count =
+		    to_le16(ext4_ext_get_actual_len(prev) + blocks);
+		ex->first_block = to_le32(split + blocks);
+		ext4_ext_store_pblock(ex, ext4_ext_pblock(ex) + blocks);
+		ex->block_count = to_le16(ee_len - blocks);
+		ext4_ext_mark_unwritten(ex);
+		return ext4_ext_dirty(inode_ref, *ppath + depth);
+	}
+
 	if (split + blocks ==
 	    to_le32(ex->first_block) + ext4_ext_get_actual_len(ex)) {
 		/* split and initialize right part */
@@ -1579,12 +1629,46 @@ static int ext4_ext_convert_to_initialized(struct ext4_inode_ref *inode_ref,
 		err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
 					       EXT4_EXT_MARK_UNWRIT2);
 	} else {
-		/* split 1 extent to 3 and initialize the 2nd */
-		err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
+		/* split 1 extent to 3 and initialize the 2nd (the path
+		 * follows the inserted right part of the first split) */
+		err = ext4_ext_split_extent_at(inode_ref, ppath, split,
 					       EXT4_EXT_MARK_UNWRIT1 |
 						   EXT4_EXT_MARK_UNWRIT2);
 		if (err == EOK) {
-			err = ext4_ext_split_extent_at(inode_ref, ppath, split,
+			err = ext4_ext_split_extent_at(inode_ref, ppath,
+						       split + blocks,
+						       EXT4_EXT_MARK_UNWRIT2);
+		}
+	}
+
+	return err;
+}
+
+static int ext4_ext_convert_to_unwritten(struct ext4_inode_ref *inode_ref,
+					 struct ext4_extent_path **ppath,
+					 ext4_lblk_t split, uint32_t blocks)
+{
+	int32_t depth = ext_depth(inode_ref->inode), err = EOK;
+	struct ext4_extent *ex = (*ppath)[depth].extent;
+
+	ext4_assert(to_le32(ex->first_block) <= split);
+	ext4_assert(blocks <= EXT_UNWRITTEN_MAX_LEN);
+
+	if (split + blocks ==
+	    to_le32(ex->first_block) + ext4_ext_get_actual_len(ex)) {
+		/* split and mark right part unwritten */
+		err = ext4_ext_split_extent_at(inode_ref, ppath, split,
+					       EXT4_EXT_MARK_UNWRIT2);
+	} else if (to_le32(ex->first_block) == split) {
+		/* split and mark left part unwritten */
+		err = ext4_ext_split_extent_at(inode_ref, ppath, split + blocks,
+					       EXT4_EXT_MARK_UNWRIT1);
+	} else {
+		/* split 1 extent to 3 and mark the 2nd unwritten */
+		err = ext4_ext_split_extent_at(inode_ref, ppath, split, 0);
+		if (err == EOK) {
+			err = ext4_ext_split_extent_at(inode_ref, ppath,
+						       split + blocks,
 						       EXT4_EXT_MARK_UNWRIT1);
 		}
 	}
@@ -1632,7 +1716,8 @@ static int ext4_ext_zero_unwritten_range(struct ext4_inode_ref *inode_ref,
 	for (i = 0; i < blocks_count; i++) {
 		struct ext4_block bh = EXT4_BLOCK_ZERO();
 		err = ext4_trans_block_get_noread(inode_ref->fs->bdev, &bh,
-						  block + i);
+						  block + i,
+						  EXT4_BCACHE_CLASS_DATA);
 		if (err != EOK)
 			break;
 
@@ -1670,9 +1755,10 @@ __unused static void print_path(struct ext4_extent_path *path)
 	}
 }
 
-int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
-			   uint32_t max_blocks, ext4_fsblk_t *result,
-			   bool create, uint32_t *blocks_count)
+static int ext4_ext_map_blocks(struct ext4_inode_ref *inode_ref,
+			       ext4_lblk_t iblock, uint32_t max_blocks,
+			       ext4_fsblk_t *result, bool create, bool zero,
+			       uint32_t *blocks_count)
 {
 	struct ext4_extent_path *path = NULL;
 	struct ext4_extent newex, *ex;
@@ -1729,10 +1815,12 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 				zero_range = max_blocks;
 
 			newblock = iblock - ee_block + ee_start;
-			err = ext4_ext_zero_unwritten_range(inode_ref, newblock,
-							    zero_range);
-			if (err != EOK)
-				goto out2;
+			if (zero) {
+				err = ext4_ext_zero_unwritten_range(
+				    inode_ref, newblock, zero_range);
+				if (err != EOK)
+					goto out2;
+			}
 
 			err = ext4_ext_convert_to_initialized(
 			    inode_ref, &path, iblock, zero_range);
@@ -1743,20 +1831,29 @@ int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
 		}
 	}
 
+	/* find next allocated block so that we know how many
+	 * blocks we can allocate without ovelapping next extent */
+	if (ex && iblock < to_le32(ex->first_block))
+		next = to_le32(ex->first_block);
+	else
+		next = ext4_ext_next_allocated_block(path);
+
+	allocated = next > iblock ? next - iblock : 1;
+
 	/*
 	 * requested block isn't allocated yet
-	 * we couldn't try to create block if create flag is zero
+	 * we couldn't try to create block if create flag is zero,
+	 * report the hole up to the next extent instead
 	 */
 	if (!create) {
-		goto out2;
+		newblock = 0;
+		goto out;
 	}
 
-	/* find next allocated block so that we know how many
-	 * blocks we can allocate without ovelapping next extent */
-	next = ext4_ext_next_allocated_block(path);
-	allocated = next - iblock;
 	if (allocated > max_blocks)
 		allocated = max_blocks;
+	if (allocated > EXT_INIT_MAX_LEN)
+		allocated = EXT_INIT_MAX_LEN;
 
 	/* allocate new block */
 	goal = ext4_ext_find_goal(inode_ref, path, iblock);
@@ -1797,3 +1894,91 @@ out2:
 
 	return err;
 }
+
+int ext4_extent_get_blocks(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
+			   uint32_t max_blocks, ext4_fsblk_t *result,
+			   bool create, uint32_t *blocks_count)
+{
+	return ext4_ext_map_blocks(inode_ref, iblock, max_blocks, result,
+				   create, true, blocks_count);
+}
+
+int ext4_extent_init_blocks(struct ext4_inode_ref *inode_ref,
+			    ext4_lblk_t iblock, uint32_t max_blocks,
+			    ext4_fsblk_t *result, uint32_t *blocks_count)
+{
+	return ext4_ext_map_blocks(inode_ref, iblock, max_blocks, result,
+				   true, false, blocks_count);
+}
+
+int ext4_extent_prealloc(struct ext4_inode_ref *inode_ref, ext4_lblk_t iblock,
+			 uint32_t max_blocks, bool zero,
+			 uint32_t *blocks_count)
+{
+	struct ext4_extent_path *path = NULL;
+	struct ext4_extent newex, *ex;
+	ext4_fsblk_t goal, newblock;
+	int err = EOK;
+	int32_t depth;
+	uint32_t allocated;
+	ext4_lblk_t next;
+
+	*blocks_count = 0;
+
+	err = ext4_find_extent(inode_ref, iblock, &path, 0);
+	if (err != EOK)
+		return err;
+
+	depth = ext_depth(inode_ref->inode);
+	ex = path[depth].extent;
+	if (ex && IN_RANGE(iblock, to_le32(ex->first_block),
+			   ext4_ext_get_actual_len(ex))) {
+		allocated = ext4_ext_get_actual_len(ex) -
+			    (iblock - to_le32(ex->first_block));
+		if (allocated > max_blocks)
+			allocated = max_blocks;
+
+		/* Allocated blocks are kept, written ones read zeros after
+		 * the conversion if asked to */
+		if (zero && !ext4_ext_is_unwritten(ex)) {
+			if (allocated > EXT_UNWRITTEN_MAX_LEN)
+				allocated = EXT_UNWRITTEN_MAX_LEN;
+
+			err = ext4_ext_convert_to_unwritten(inode_ref, &path,
+							    iblock, allocated);
+		}
+		goto out;
+	}
+
+	if (ex && iblock < to_le32(ex->first_block))
+		next = to_le32(ex->first_block);
+	else
+		next = ext4_ext_next_allocated_block(path);
+
+	allocated = next > iblock ? next - iblock : 1;
+	if (allocated > max_blocks)
+		allocated = max_blocks;
+	if (allocated > EXT_UNWRITTEN_MAX_LEN)
+		allocated = EXT_UNWRITTEN_MAX_LEN;
+
+	goal = ext4_ext_find_goal(inode_ref, path, iblock);
+	newblock = ext4_new_meta_blocks(inode_ref, goal, 0, &allocated, &err);
+	if (!newblock)
+		goto out;
+
+	newex.first_block = to_le32(iblock);
+	ext4_ext_store_pblock(&newex, newblock);
+	newex.block_count = to_le16(allocated);
+	ext4_ext_mark_unwritten(&newex);
+	err = ext4_ext_insert_extent(inode_ref, &path, &newex, 0);
+	if (err != EOK)
+		ext4_ext_free_blocks(inode_ref, newblock, allocated, 0);
+
+out:
+	if (err == EOK)
+		*blocks_count = allocated;
+
+	ext4_ext_drop_refs(inode_ref, path, 0);
+	ext4_free(path);
+	return err;
+}
@@ -71,6 +71,10 @@ int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
 
 	fs->read_only = read_only;
 
+#if CONFIG_EXT4_DISCARD_RANGES
+	fs->discard_cnt = 0;
+#endif
+
 	r = ext4_sb_read(fs->bdev, &fs->sb);
 	if (r != EOK)
 		return r;
@@ -313,7 +317,8 @@ static int ext4_fs_init_block_bitmap(struct ext4_block_group_ref *bg_ref)
 	uint32_t inode_table_bcnt = inodes_per_group * inode_size / block_size;
 
 	struct ext4_block block_bitmap;
-	rc = ext4_trans_block_get_noread(bg_ref->fs->bdev, &block_bitmap, bmp_blk);
+	rc = ext4_trans_block_get_noread(bg_ref->fs->bdev, &block_bitmap, bmp_blk,
+					 EXT4_BCACHE_CLASS_BITMAP);
 	if (rc != EOK)
 		return rc;
 
@@ -393,7 +398,8 @@ static int ext4_fs_init_inode_bitmap(struct ext4_block_group_ref *bg_ref)
 	ext4_fsblk_t bitmap_block_addr = ext4_bg_get_inode_bitmap(bg, sb);
 
 	struct ext4_block b;
-	rc = ext4_trans_block_get_noread(bg_ref->fs->bdev, &b, bitmap_block_addr);
+	rc = ext4_trans_block_get_noread(bg_ref->fs->bdev, &b, bitmap_block_addr,
+					 EXT4_BCACHE_CLASS_BITMAP);
 	if (rc != EOK)
 		return rc;
 
@@ -449,7 +455,8 @@ static int ext4_fs_init_inode_table(struct ext4_block_group_ref *bg_ref)
 	/* Initialization of all itable blocks */
 	for (fblock = first_block; fblock <= last_block; ++fblock) {
 		struct ext4_block b;
-		int rc = ext4_trans_block_get_noread(bg_ref->fs->bdev, &b, fblock);
+		int rc = ext4_trans_block_get_noread(bg_ref->fs->bdev, &b, fblock,
+						     EXT4_BCACHE_CLASS_ITABLE);
 		if (rc != EOK)
 			return rc;
 
@@ -580,7 +587,8 @@ int ext4_fs_get_block_group_ref(struct ext4_fs *fs, uint32_t bgid,
 
 	uint32_t offset = (bgid % dsc_cnt) * ext4_sb_get_desc_size(&fs->sb);
 
-	int rc = ext4_trans_block_get(fs->bdev, &ref->block, block_id);
+	int rc = ext4_trans_block_get(fs->bdev, &ref->block, block_id,
+				      EXT4_BCACHE_CLASS_OTHER);
 	if (rc != EOK)
 		return rc;
 
@@ -759,7 +767,8 @@ __ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
 	ext4_fsblk_t block_id =
 	    inode_table_start + (byte_offset_in_group / block_size);
 
-	rc = ext4_trans_block_get(fs->bdev, &ref->block, block_id);
+	rc = ext4_trans_block_get(fs->bdev, &ref->block, block_id,
+				  EXT4_BCACHE_CLASS_ITABLE);
 	if (rc != EOK) {
 		return rc;
 	}
@@ -964,7 +973,8 @@ int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref)
 	/* 2) Double indirect */
 	fblock = ext4_inode_get_indirect_block(inode_ref->inode, 1);
 	if (fblock != 0) {
-		int rc = ext4_trans_block_get(fs->bdev, &block, fblock);
+		int rc = ext4_trans_block_get(fs->bdev, &block, fblock,
+					      EXT4_BCACHE_CLASS_EXTENT);
 		if (rc != EOK)
 			return rc;
 
@@ -995,7 +1005,8 @@ int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref)
 	fblock = ext4_inode_get_indirect_block(inode_ref->inode, 2);
 	if (fblock == 0)
 		goto finish;
-	rc = ext4_trans_block_get(fs->bdev, &block, fblock);
+	rc = ext4_trans_block_get(fs->bdev, &block, fblock,
+				  EXT4_BCACHE_CLASS_EXTENT);
 	if (rc != EOK)
 		return rc;
 
@@ -1006,7 +1017,7 @@ int ext4_fs_free_inode(struct ext4_inode_ref *inode_ref)
 		if (ind_block == 0)
 			continue;
 		rc = ext4_trans_block_get(fs->bdev, &subblock,
-				ind_block);
+				ind_block, EXT4_BCACHE_CLASS_EXTENT);
 		if (rc != EOK) {
 			ext4_block_set(fs->bdev, &block);
 			return rc;
@@ -1070,7 +1081,90 @@ finish:
 }
 
 
+/**@brief Check whether an indirect block has no entries left.
+ * @param ids   Entries of the indirect block
+ * @param count Number of entries
+ * @param hint  Entry cleared last (its neighbours are checked first)
+ * @return True if all entries are zero
+ */
+static bool ext4_fs_ind_block_empty(const uint32_t *ids, uint32_t count,
+				    uint32_t hint)
+{
+	uint32_t i;
+
+	/* Releasing a range leaves a neighbour in use until the end */
+	if (hint > 0 && ids[hint - 1])
+		return false;
+	if (hint + 1 < count && ids[hint + 1])
+		return false;
+
+	for (i = 0; i < count; ++i)
+		if (ids[i])
+			return false;
+
+	return true;
+}
+
+/**@brief Release indirect blocks left without entries, bottom-up.
+ * @param inode_ref I-node the blocks belong to
+ * @param level     Indirection level of the topmost block
+ * @param path      Indirect blocks from the topmost one
+ * @param slot      Entry of the path taken in each block
+ * @param depth     Number of blocks in the path
+ * @return Error code
+ */
+static int ext4_fs_release_ind_blocks(struct ext4_inode_ref *inode_ref,
+				      unsigned int level,
+				      const ext4_fsblk_t *path,
+				      const uint32_t *slot, unsigned int depth)
+{
+	struct ext4_fs *fs = inode_ref->fs;
+	uint32_t count = ext4_sb_get_block_size(&fs->sb) / sizeof(uint32_t);
+	struct ext4_block block;
+	bool empty;
+	int rc;
+
+	while (depth--) {
+		rc = ext4_trans_block_get(fs->bdev, &block, path[depth],
+					  EXT4_BCACHE_CLASS_EXTENT);
+		if (rc != EOK)
+			return rc;
+
+		empty = ext4_fs_ind_block_empty((uint32_t *)block.data, count,
+						slot[depth]);
+		rc = ext4_block_set(fs->bdev, &block);
+		if (rc != EOK || !empty)
+			return rc;
+
+		/* Clear the reference of the parent */
+		if (depth) {
+			rc = ext4_trans_block_get(fs->bdev, &block,
+						  path[depth - 1],
+						  EXT4_BCACHE_CLASS_EXTENT);
+			if (rc != EOK)
+				return rc;
+
+			((uint32_t *)block.data)[slot[depth - 1]] = to_le32(0);
+			ext4_trans_set_block_dirty(block.buf);
+			rc = ext4_block_set(fs->bdev, &block);
+			if (rc != EOK)
+				return rc;
+		} else {
+			ext4_inode_set_indirect_block(inode_ref->inode,
+						      level - 1, 0);
+			inode_ref->dirty = true;
+		}
+
+		rc = ext4_balloc_free_block(inode_ref, path[depth]);
+		if (rc != EOK)
+			return rc;
+	}
+
+	return EOK;
+}
+
 /**@brief Release data block from i-node
+ *        (and the indirect blocks it leaves empty)
  * @param inode_ref I-node to release block from
  * @param iblock    Logical block to be released
  * @return Error code
@@ -1128,6 +1222,10 @@ static int ext4_fs_release_inode_block(struct ext4_inode_ref *inode_ref,
 	 * or find null reference meaning we are dealing with sparse file
 	 */
 	struct ext4_block block;
+	ext4_fsblk_t path[3];
+	uint32_t slot[3];
+	unsigned int top = level;
+	unsigned int depth = 0;
 
 	while (level > 0) {
 
@@ -1135,7 +1233,11 @@ static int ext4_fs_release_inode_block(struct ext4_inode_ref *inode_ref,
 		if (current_block == 0)
 			return EOK;
 
-		int rc = ext4_trans_block_get(fs->bdev, &block, current_block);
+		path[depth] = current_block;
+		slot[depth++] = offset_in_block;
+
+		int rc = ext4_trans_block_get(fs->bdev, &block, current_block,
+					      EXT4_BCACHE_CLASS_EXTENT);
 		if (rc != EOK)
 			return rc;
 
@@ -1172,7 +1274,36 @@ static int ext4_fs_release_inode_block(struct ext4_inode_ref *inode_ref,
 		return EOK;
 
 	/* Physical block is not referenced, it can be released */
-	return ext4_balloc_free_block(inode_ref, fblock);
+	int rc = ext4_balloc_free_block(inode_ref, fblock);
+	if (rc != EOK)
+		return rc;
+
+	return ext4_fs_release_ind_blocks(inode_ref, top, path, slot, depth);
+}
+
+bool ext4_fs_blocks_past_eof(struct ext4_inode_ref *inode_ref)
+{
+#if CONFIG_EXTENT_ENABLE
+	struct ext4_sblock *sb = &inode_ref->fs->sb;
+	uint32_t block_size = ext4_sb_get_block_size(sb);
+	uint64_t size = ext4_inode_get_size(sb, inode_ref->inode);
+	ext4_lblk_t end = (ext4_lblk_t)((size + block_size - 1) / block_size);
+	ext4_fsblk_t fblock;
+	uint32_t count;
+
+	if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		/* Anything but one hole up to the last logical block */
+		if (ext4_extent_get_blocks(inode_ref, end, EXT_MAX_BLOCKS - end,
+					   &fblock, false, &count) != EOK)
+			return true;
+
+		return fblock || count < EXT_MAX_BLOCKS - end;
+	}
+#else
+	(void)inode_ref;
+#endif
+	return false;
 }
 
 int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
@@ -1186,9 +1317,10 @@ int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
 	if (!ext4_inode_can_truncate(sb, inode_ref->inode))
 		return EINVAL;
 
-	/* If sizes are equal, nothing has to be done. */
+	/* If sizes are equal, nothing has to be done (except releasing
+	 * blocks preallocated past the end of file). */
 	uint64_t old_size = ext4_inode_get_size(sb, inode_ref->inode);
-	if (old_size == new_size)
+	if (old_size == new_size && !ext4_fs_blocks_past_eof(inode_ref))
 		return EOK;
 
 	/* It's not supported to make the larger file by truncate operation */
@@ -1228,14 +1360,12 @@ int ext4_fs_truncate_inode(struct ext4_inode_ref *inode_ref, uint64_t new_size)
 	if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
 	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
 
-		/* Extents require special operation */
-		if (diff_blocks_cnt) {
-			r = ext4_extent_remove_space(inode_ref, new_blocks_cnt,
-						     EXT_MAX_BLOCKS);
-			if (r != EOK)
-				return r;
-
-		}
+		/* Extents require special operation (preallocated blocks
+		 * past the end of file are released too) */
+		r = ext4_extent_remove_space(inode_ref, new_blocks_cnt,
+					     EXT_MAX_BLOCKS);
+		if (r != EOK)
+			return r;
 	} else
 #endif
 	{
@@ -1420,7 +1550,8 @@ static int ext4_fs_get_inode_dblk_idx_internal(struct ext4_inode_ref *inode_ref,
 	 */
 	while (l > 0) {
 		/* Load indirect block */
-		int rc = ext4_trans_block_get(fs->bdev, &block, current_block);
+		int rc = ext4_trans_block_get(fs->bdev, &block, current_block,
+					      EXT4_BCACHE_CLASS_EXTENT);
 		if (rc != EOK)
 			return rc;
 
@@ -1466,11 +1597,107 @@ int ext4_fs_get_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 						   false, support_unwritten);
 }
 
+static int ext4_fs_fill_inode_dblk(struct ext4_inode_ref *inode_ref,
+				   ext4_lblk_t iblock, ext4_fsblk_t *fblock);
+
+static int
+ext4_fs_get_inode_dblk_range_internal(struct ext4_inode_ref *inode_ref,
+				      ext4_lblk_t iblock, uint32_t max,
+				      ext4_fsblk_t *fblock, uint32_t *count,
+				      bool extent_create)
+{
+	struct ext4_fs *fs = inode_ref->fs;
+	ext4_fsblk_t next;
+	uint32_t n;
+	int rc;
+
+	ext4_assert(max);
+
+	if (!extent_create &&
+	    ext4_inode_get_size(&fs->sb, inode_ref->inode) == 0) {
+		*fblock = 0;
+		*count = max;
+		return EOK;
+	}
+
+#if CONFIG_EXTENT_ENABLE
+	if ((ext4_sb_feature_incom(&fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		if (extent_create)
+			rc = ext4_extent_init_blocks(inode_ref, iblock, max,
+						     fblock, count);
+		else
+			rc = ext4_extent_get_blocks(inode_ref, iblock, max,
+						    fblock, false, count);
+		if (rc != EOK)
+			return rc;
+
+		if (!*count)
+			*count = 1;
+		return EOK;
+	}
+#endif
+
+	/* Indirect blocks: follow the run block by block. */
+	rc = ext4_fs_get_inode_dblk_idx_internal(inode_ref, iblock, fblock,
+						 extent_create, true);
+	if (rc != EOK)
+		return rc;
+
+	/* A hole (punched) is filled block by block */
+	if (!*fblock && extent_create) {
+		*count = 1;
+		return ext4_fs_fill_inode_dblk(inode_ref, iblock, fblock);
+	}
+
+	for (n = 1; n < max; n++) {
+		rc = ext4_fs_get_inode_dblk_idx_internal(inode_ref, iblock + n,
+							 &next, extent_create,
+							 true);
+		if (rc != EOK)
+			return rc;
+
+		if (*fblock ? next != *fblock + n : next != 0)
+			break;
+	}
+
+	*count = n;
+	return EOK;
+}
+
+int ext4_fs_get_inode_dblk_range(struct ext4_inode_ref *inode_ref,
+				 ext4_lblk_t iblock, uint32_t max,
+				 ext4_fsblk_t *fblock, uint32_t *count)
+{
+	return ext4_fs_get_inode_dblk_range_internal(inode_ref, iblock, max,
+						     fblock, count, false);
+}
+
+int ext4_fs_init_inode_dblk_range(struct ext4_inode_ref *inode_ref,
+				  ext4_lblk_t iblock, uint32_t max,
+				  ext4_fsblk_t *fblock, uint32_t *count)
+{
+	return ext4_fs_get_inode_dblk_range_internal(inode_ref, iblock, max,
+						     fblock, count, true);
+}
+
 int ext4_fs_init_inode_dblk_idx(struct ext4_inode_ref *inode_ref,
 				ext4_lblk_t iblock, ext4_fsblk_t *fblock)
 {
-	return ext4_fs_get_inode_dblk_idx_internal(inode_ref, iblock, fblock,
-						   true, true);
+	int rc = ext4_fs_get_inode_dblk_idx_internal(inode_ref, iblock, fblock,
+						     true, true);
+	if (rc != EOK || *fblock)
+		return rc;
+
+#if CONFIG_EXTENT_ENABLE
+	/* Extent holes are allocated by the lookup */
+	if ((ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS)))
+		return EOK;
+#endif
+
+	/* Block maps: a hole (punched) is filled here */
+	return ext4_fs_fill_inode_dblk(inode_ref, iblock, fblock);
 }
 
 static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
@@ -1540,7 +1767,8 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 		inode_ref->dirty = true;
 
 		/* Load newly allocated block */
-		rc = ext4_trans_block_get_noread(fs->bdev, &new_block, new_blk);
+		rc = ext4_trans_block_get_noread(fs->bdev, &new_block, new_blk,
+						 EXT4_BCACHE_CLASS_EXTENT);
 		if (rc != EOK) {
 			ext4_balloc_free_block(inode_ref, new_blk);
 			return rc;
@@ -1563,7 +1791,8 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 	 * or find null reference meaning we are dealing with sparse file
 	 */
 	while (l > 0) {
-		int rc = ext4_trans_block_get(fs->bdev, &block, current_block);
+		int rc = ext4_trans_block_get(fs->bdev, &block, current_block,
+					      EXT4_BCACHE_CLASS_EXTENT);
 		if (rc != EOK)
 			return rc;
 
@@ -1586,7 +1815,7 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 
 			/* Load newly allocated block */
 			rc = ext4_trans_block_get_noread(fs->bdev, &new_block,
-					    new_blk);
+					    new_blk, EXT4_BCACHE_CLASS_EXTENT);
 
 			if (rc != EOK) {
 				ext4_block_set(fs->bdev, &block);
@@ -1638,41 +1867,72 @@ static int ext4_fs_set_inode_data_block_index(struct ext4_inode_ref *inode_ref,
 	return EOK;
 }
 
+/**@brief Allocate a data block for a hole of a block mapped i-node.
+ * @param inode_ref I-node reference
+ * @param iblock    Logical block of the hole
+ * @param fblock    Output allocated physical block
+ * @return Error code*/
+static int ext4_fs_fill_inode_dblk(struct ext4_inode_ref *inode_ref,
+				   ext4_lblk_t iblock, ext4_fsblk_t *fblock)
+{
+	ext4_fsblk_t goal, phys_block;
+	int rc;
 
-int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
-			      ext4_fsblk_t *fblock, ext4_lblk_t *iblock)
+	rc = ext4_fs_indirect_find_goal(inode_ref, &goal);
+	if (rc != EOK)
+		return rc;
+
+	rc = ext4_balloc_alloc_block(inode_ref, goal, &phys_block);
+	if (rc != EOK)
+		return rc;
+
+	rc = ext4_fs_set_inode_data_block_index(inode_ref, iblock, phys_block);
+	if (rc != EOK) {
+		ext4_balloc_free_block(inode_ref, phys_block);
+		return rc;
+	}
+
+	*fblock = phys_block;
+	return EOK;
+}
+
+
+int ext4_fs_append_inode_dblks(struct ext4_inode_ref *inode_ref,
+			       ext4_fsblk_t *fblock, ext4_lblk_t *iblock,
+			       uint32_t *count)
 {
+	struct ext4_sblock *sb = &inode_ref->fs->sb;
+	uint64_t inode_size = ext4_inode_get_size(sb, inode_ref->inode);
+	uint32_t block_size = ext4_sb_get_block_size(sb);
+	ext4_fsblk_t goal, phys_block;
+	uint32_t i;
+	int rc;
+
+	ext4_assert(*count);
+
 #if CONFIG_EXTENT_ENABLE
 	/* Handle extents separately */
-	if ((ext4_sb_feature_incom(&inode_ref->fs->sb, EXT4_FINCOM_EXTENTS)) &&
+	if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
 	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
-		int rc;
-		ext4_fsblk_t current_fsblk;
-		struct ext4_sblock *sb = &inode_ref->fs->sb;
-		uint64_t inode_size = ext4_inode_get_size(sb, inode_ref->inode);
-		uint32_t block_size = ext4_sb_get_block_size(sb);
 		*iblock = (uint32_t)((inode_size + block_size - 1) / block_size);
 
-		rc = ext4_extent_get_blocks(inode_ref, *iblock, 1,
-						&current_fsblk, true, NULL);
+		/* One allocation and one extent insert for the run, or
+		 * the blocks preallocated past the end of file */
+		rc = ext4_extent_init_blocks(inode_ref, *iblock, *count,
+					     &phys_block, count);
 		if (rc != EOK)
 			return rc;
 
-		*fblock = current_fsblk;
+		*fblock = phys_block;
 		ext4_assert(*fblock);
 
-		ext4_inode_set_size(inode_ref->inode, inode_size + block_size);
+		ext4_inode_set_size(inode_ref->inode,
+				    inode_size + (uint64_t)*count * block_size);
 		inode_ref->dirty = true;
 
-
 		return rc;
 	}
 #endif
-	struct ext4_sblock *sb = &inode_ref->fs->sb;
-
-	/* Compute next block index and allocate data block */
-	uint64_t inode_size = ext4_inode_get_size(sb, inode_ref->inode);
-	uint32_t block_size = ext4_sb_get_block_size(sb);
 
 	/* Align size i-node size */
 	if ((inode_size % block_size) != 0)
@@ -1681,26 +1941,35 @@ int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
 	/* Logical blocks are numbered from 0 */
 	uint32_t new_block_idx = (uint32_t)(inode_size / block_size);
 
-	/* Allocate new physical block */
-	ext4_fsblk_t goal, phys_block;
-	int rc = ext4_fs_indirect_find_goal(inode_ref, &goal);
+	/* Allocate new physical blocks */
+	rc = ext4_fs_indirect_find_goal(inode_ref, &goal);
 	if (rc != EOK)
 		return rc;
 
-	rc = ext4_balloc_alloc_block(inode_ref, goal, &phys_block);
+	rc = ext4_balloc_alloc_blocks(inode_ref, goal, &phys_block, count);
 	if (rc != EOK)
 		return rc;
 
-	/* Add physical block address to the i-node */
-	rc = ext4_fs_set_inode_data_block_index(inode_ref, new_block_idx,
-						phys_block);
-	if (rc != EOK) {
-		ext4_balloc_free_block(inode_ref, phys_block);
-		return rc;
+	/* Add physical block addresses to the i-node */
+	for (i = 0; i < *count; i++) {
+		rc = ext4_fs_set_inode_data_block_index(inode_ref,
+							new_block_idx + i,
+							phys_block + i);
+		if (rc != EOK)
+			break;
+	}
+
+	if (i < *count) {
+		ext4_balloc_free_blocks(inode_ref, phys_block + i, *count - i);
+		if (!i)
+			return rc;
+
+		*count = i;
 	}
 
 	/* Update i-node */
-	ext4_inode_set_size(inode_ref->inode, inode_size + block_size);
+	ext4_inode_set_size(inode_ref->inode,
+			    inode_size + (uint64_t)*count * block_size);
 	inode_ref->dirty = true;
 
 	*fblock = phys_block;
@@ -1709,6 +1978,75 @@ int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
 	return EOK;
 }
 
+int ext4_fs_append_inode_dblk(struct ext4_inode_ref *inode_ref,
+			      ext4_fsblk_t *fblock, ext4_lblk_t *iblock)
+{
+	uint32_t count = 1;
+
+	return ext4_fs_append_inode_dblks(inode_ref, fblock, iblock, &count);
+}
+
+int ext4_fs_punch_inode_dblks(struct ext4_inode_ref *inode_ref,
+			      ext4_lblk_t iblock, uint32_t count)
+{
+	uint32_t i;
+	int r;
+
+	if (!count)
+		return EOK;
+
+#if CONFIG_EXTENT_ENABLE
+	struct ext4_sblock *sb = &inode_ref->fs->sb;
+	if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS)))
+		return ext4_extent_remove_space(inode_ref, iblock,
+						iblock + count - 1);
+#endif
+
+	/* Block maps release block by block, holes are skipped */
+	for (i = 0; i < count; ++i) {
+		r = ext4_fs_release_inode_block(inode_ref, iblock + i);
+		if (r != EOK)
+			return r;
+	}
+
+	return EOK;
+}
+
+int ext4_fs_prealloc_inode_dblks(struct ext4_inode_ref *inode_ref,
+				 ext4_lblk_t iblock, uint32_t count,
+				 bool zero)
+{
+#if CONFIG_EXTENT_ENABLE
+	struct ext4_sblock *sb = &inode_ref->fs->sb;
+	uint32_t n;
+	int rc;
+
+	if ((ext4_sb_feature_incom(sb, EXT4_FINCOM_EXTENTS)) &&
+	    (ext4_inode_has_flag(inode_ref->inode, EXT4_INODE_FLAG_EXTENTS))) {
+		/* One extent (or allocated run) at a time */
+		while (count) {
+			rc = ext4_extent_prealloc(inode_ref, iblock, count,
+						  zero, &n);
+			if (rc != EOK)
+				return rc;
+
+			iblock += n;
+			count -= n;
+		}
+
+		return EOK;
+	}
+#else
+	(void)inode_ref;
+	(void)iblock;
+	(void)count;
+	(void)zero;
+#endif
+	/* Block maps have no unwritten blocks */
+	return ENOTSUP;
+}
+
 void ext4_fs_inode_links_count_inc(struct ext4_inode_ref *inode_ref)
 {
 	uint16_t link;
@@ -531,7 +531,7 @@ static int jbd_block_get(struct jbd_fs *jbd_fs,
 	if (rc != EOK)
 		return rc;
 
-	rc = ext4_block_get(bdev, block, fblock);
+	rc = ext4_block_get2(bdev, block, fblock, EXT4_BCACHE_CLASS_JOURNAL);
 
 	/* If succeeded, mark buffer as BC_FLUSH to indicate
 	 * that data should be written to disk immediately.*/
@@ -563,7 +563,8 @@ static int jbd_block_get_noread(struct jbd_fs *jbd_fs,
 	if (rc != EOK)
 		return rc;
 
-	rc = ext4_block_get_noread(bdev, block, fblock);
+	rc = ext4_block_get_noread2(bdev, block, fblock,
+				    EXT4_BCACHE_CLASS_JOURNAL);
 	if (rc == EOK)
 		ext4_bcache_set_flag(block->buf, BC_FLUSH);
 
@@ -1363,11 +1364,12 @@ jbd_journal_skip_pure_revoke(struct jbd_journal *journal,
 	jbd_journal_write_sb(journal);
 }
 
-void
+int
 jbd_journal_purge_cp_trans(struct jbd_journal *journal,
 			   bool flush,
 			   bool once)
 {
+	int r;
 	struct jbd_trans *trans;
 	while ((trans = TAILQ_FIRST(&journal->cp_queue))) {
 		if (!trans->data_cnt) {
@@ -1378,6 +1380,14 @@ jbd_journal_purge_cp_trans(struct jbd_journal *journal,
 		} else {
 			if (trans->data_cnt ==
 					trans->written_cnt) {
+				/* Checkpointed blocks have to be durable
+				 * before the log tail moves past their
+				 * transaction. */
+				r = ext4_block_dev_flush(
+						journal->jbd_fs->bdev);
+				if (r != EOK)
+					return r;
+
 				journal->start =
 					trans->start_iblock +
 					trans->alloc_blocks;
@@ -1407,6 +1417,8 @@ jbd_journal_purge_cp_trans(struct jbd_journal *journal,
 		if (once)
 			break;
 	}
+
+	return EOK;
 }
 
 /**@brief  Stop accessing the journal.
@@ -1419,8 +1431,10 @@ int jbd_journal_stop(struct jbd_journal *journal)
 	uint32_t features_incompatible;
 
 	/* Make sure that journalled content have reached
-	 * the disk.*/
-	jbd_journal_purge_cp_trans(journal, true, false);
+	 * the disk. On error the journal still needs recovery.*/
+	r = jbd_journal_purge_cp_trans(journal, true, false);
+	if (r != EOK)
+		return r;
 
 	/* There should be no block record in this journal
 	 * session. */
@@ -1771,6 +1785,12 @@ static int jbd_trans_write_commit_block(struct jbd_trans *trans)
 	uint32_t commit_iblock;
 	struct jbd_journal *journal = trans->journal;
 
+	/* Descriptor and log blocks have to be durable before the commit
+	 * block gets written. */
+	rc = ext4_block_dev_flush(journal->jbd_fs->bdev);
+	if (rc != EOK)
+		return rc;
+
 	commit_iblock = jbd_journal_alloc_block(journal, trans);
 
 	rc = jbd_block_get_noread(journal->jbd_fs, &block, commit_iblock);
@@ -1791,6 +1811,9 @@ static int jbd_trans_write_commit_block(struct jbd_trans *trans)
 	jbd_commit_csum_set(journal->jbd_fs, header);
 	ext4_bcache_set_dirty(block.buf);
 	ext4_bcache_set_flag(block.buf, BC_TMP);
+	/* Transaction is committed once the commit block is durable:
+	 * checkpoint writes may follow it right away. */
+	ext4_bcache_set_flag(block.buf, BC_FUA);
 	rc = jbd_block_set(journal->jbd_fs, &block);
 	return rc;
 }
@@ -2134,6 +2157,17 @@ static void jbd_trans_end_write(struct ext4_bcache *bc __unused,
 		 * transactions from checkpoint queue until we find
 		 * an unwritten one. */
 		if (first_in_queue) {
+			/* Checkpointed blocks have to be durable before the
+			 * log tail moves past their transaction. On error
+			 * the transaction stays on the checkpoint queue (and
+			 * in the log): the next purge retries the flush and
+			 * returns the error. */
+			int r = ext4_block_dev_flush(journal->jbd_fs->bdev);
+			if (r != EOK) {
+				trans->error = r;
+				return;
+			}
+
 			journal->start = trans->start_iblock +
 				trans->alloc_blocks;
 			wrap(&journal->jbd_fs->sb, journal->start);
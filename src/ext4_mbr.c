@@ -77,7 +77,10 @@ int ext4_mbr_scan(struct ext4_blockdev *parent, struct ext4_mbr_bdevs *bdevs)
 	if (r != EOK)
 		return r;
 
-	r = ext4_block_readbytes(parent, 0, parent->bdif->ph_bbuf, 512);
+	/* Whole physical block: ph_bbuf is also the scratch buffer of
+	 * partial block transfers. */
+	r = ext4_block_readbytes(parent, 0, parent->bdif->ph_bbuf,
+				 parent->bdif->ph_bsize);
 	if (r != EOK) {
 		goto blockdev_fini;
 	}
@@ -152,6 +155,13 @@ int ext4_mbr_write(struct ext4_blockdev *parent, struct ext4_mbr_parts *parts)
 	const uint32_t cyl_size = 63 * k;
 	const uint32_t cyl_count = disk_size / cyl_size;
 
+	/* Keep the rest of physical block 0 and write it back whole, see
+	 * ext4_mbr_scan. */
+	r = ext4_block_readbytes(parent, 0, parent->bdif->ph_bbuf,
+				 parent->bdif->ph_bsize);
+	if (r != EOK)
+		goto blockdev_fini;
+
 	struct ext4_mbr *mbr = (void *)parent->bdif->ph_bbuf;
 	memset(mbr, 0, sizeof(struct ext4_mbr));
 
@@ -188,7 +198,8 @@ int ext4_mbr_write(struct ext4_blockdev *parent, struct ext4_mbr_parts *parts)
 	}
 
 	mbr->signature = MBR_SIGNATURE;
-	r = ext4_block_writebytes(parent, 0, parent->bdif->ph_bbuf, 512);
+	r = ext4_block_writebytes(parent, 0, parent->bdif->ph_bbuf,
+				  parent->bdif->ph_bsize);
 	if (r != EOK)
 		goto blockdev_fini;
 
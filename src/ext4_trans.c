@@ -66,9 +66,10 @@ int ext4_trans_set_block_dirty(struct ext4_buf *buf)
 
 int ext4_trans_block_get_noread(struct ext4_blockdev *bdev,
 			  struct ext4_block *b,
-			  uint64_t lba)
+			  uint64_t lba,
+			  enum ext4_bcache_class cls)
 {
-	int r = ext4_block_get_noread(bdev, b, lba);
+	int r = ext4_block_get_noread2(bdev, b, lba, cls);
 	if (r != EOK)
 		return r;
 
@@ -77,9 +78,10 @@ int ext4_trans_block_get_noread(struct ext4_blockdev *bdev,
 
 int ext4_trans_block_get(struct ext4_blockdev *bdev,
 		   struct ext4_block *b,
-		   uint64_t lba)
+		   uint64_t lba,
+		   enum ext4_bcache_class cls)
 {
-	int r = ext4_block_get(bdev, b, lba);
+	int r = ext4_block_get2(bdev, b, lba, cls);
 	if (r != EOK)
 		return r;
 
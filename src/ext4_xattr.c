@@ -856,7 +856,8 @@ int ext4_xattr_list(struct ext4_inode_ref *inode_ref,
 	 * If there is a xattr block used by the inode
 	 */
 	if (xattr_block) {
-		ret = ext4_trans_block_get(fs->bdev, &block, xattr_block);
+		ret = ext4_trans_block_get(fs->bdev, &block, xattr_block,
+					   EXT4_BCACHE_CLASS_OTHER);
 		if (ret != EOK)
 			goto out;
 
@@ -982,7 +983,8 @@ int ext4_xattr_get(struct ext4_inode_ref *inode_ref, uint8_t name_index,
 		}
 
 		block_finder.i = i;
-		ret = ext4_trans_block_get(fs->bdev, &block, xattr_block);
+		ret = ext4_trans_block_get(fs->bdev, &block, xattr_block,
+					   EXT4_BCACHE_CLASS_OTHER);
 		if (ret != EOK)
 			goto out;
 
@@ -1062,7 +1064,8 @@ static int ext4_xattr_copy_new_block(struct ext4_inode_ref *inode_ref,
 		if (ret != EOK)
 			goto out;
 
-		ret = ext4_trans_block_get(fs->bdev, new_block, xattr_block);
+		ret = ext4_trans_block_get(fs->bdev, new_block, xattr_block,
+					   EXT4_BCACHE_CLASS_OTHER);
 		if (ret != EOK)
 			goto out;
 
@@ -1139,7 +1142,8 @@ int ext4_xattr_remove(struct ext4_inode_ref *inode_ref, uint8_t name_index,
 		goto out;
 
 	if (ibody_finder.s.not_found && xattr_block) {
-		ret = ext4_trans_block_get(fs->bdev, &block, xattr_block);
+		ret = ext4_trans_block_get(fs->bdev, &block, xattr_block,
+					   EXT4_BCACHE_CLASS_OTHER);
 		if (ret != EOK)
 			goto out;
 
@@ -1251,7 +1255,8 @@ static int ext4_xattr_block_set(struct ext4_inode_ref *inode_ref,
 
 		orig_xattr_block =
 		    ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
-		ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block);
+		ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block,
+					   EXT4_BCACHE_CLASS_OTHER);
 		if (ret != EOK) {
 			ext4_xattr_try_free_block(inode_ref);
 			goto out;
@@ -1281,7 +1286,8 @@ static int ext4_xattr_block_set(struct ext4_inode_ref *inode_ref,
 		struct ext4_xattr_finder finder;
 		struct ext4_xattr_header *header;
 		finder.i = *i;
-		ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block);
+		ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block,
+					   EXT4_BCACHE_CLASS_OTHER);
 		if (ret != EOK)
 			goto out;
 
@@ -1371,7 +1377,8 @@ static int ext4_xattr_block_remove(struct ext4_inode_ref *inode_ref,
 	orig_xattr_block = ext4_inode_get_file_acl(inode_ref->inode, &fs->sb);
 
 	ext4_assert(orig_xattr_block);
-	ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block);
+	ret = ext4_trans_block_get(fs->bdev, &block, orig_xattr_block,
+				   EXT4_BCACHE_CLASS_OTHER);
 	if (ret != EOK)
 		goto out;
 